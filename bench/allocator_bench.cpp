@@ -0,0 +1,123 @@
+/**
+ * Multi-threaded read benchmark comparing SQLite's default allocator with SQLiteAllocator
+ * usage: allocator_bench [default|pool] [threads] [seconds]
+ * Every thread opens its own connection to a shared temp file database and mixes point lookups with short range scans
+ */
+#include <sqlite3.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sqlite.h"
+#include "sqlite_allocator.h"
+
+using namespace database;
+
+static sqlite3_mem_methods			gDefaultMethods;
+static std::atomic<uint64_t>		gDefaultAllocations(0);
+static thread_local uint64_t		tDefaultAllocations = 0;
+
+static void* counting_malloc(int size) { ++tDefaultAllocations; return gDefaultMethods.xMalloc(size); }
+static void* counting_realloc(void* ptr, int size) { ++tDefaultAllocations; return gDefaultMethods.xRealloc(ptr, size); }
+
+static void install_counting_default()
+{
+	static sqlite3_mem_methods methods;
+	sqlite3_config(SQLITE_CONFIG_GETMALLOC, &gDefaultMethods);
+	methods = gDefaultMethods;
+	methods.xMalloc = &counting_malloc;
+	methods.xRealloc = &counting_realloc;
+	sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+}
+
+/**
+ * Returns the given field of /proc/self/status in KiB (VmRSS or VmHWM)
+ */
+static long status_kib(const char* field)
+{
+	long value = 0;
+	char line[256];
+	FILE* file = fopen("/proc/self/status", "r");
+	if(file != nullptr)
+	{
+		while(fgets(line, sizeof(line), file) != nullptr)
+		{
+			if(strncmp(line, field, strlen(field)) == 0) { value = atol(line + strlen(field) + 1); }
+		}
+		fclose(file);
+	}
+	return value;
+}
+
+int main(int argc, char** argv)
+{
+	const bool use_pool = (argc > 1) && (strcmp(argv[1], "pool") == 0);
+	const int threads = (argc > 2) ? atoi(argv[2]) : 8;
+	const int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+	const int rows = 200000;
+
+	if(use_pool) { SQLiteAllocator::install(); }
+	else { install_counting_default(); }
+
+	char path[] = "/tmp/allocator_bench_XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) { perror("mkstemp"); return 1; }
+	close(fd);
+	{
+		SQLite db(path);
+		db.execute("PRAGMA journal_mode=WAL");
+		db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT, n REAL)");
+		db.execute("BEGIN");
+		auto insert = db.prepare("INSERT INTO kv(k, v, n) VALUES(?, ?, ?)");
+		for(int i = 0; i < rows; ++i)
+		{ insert->bind(static_cast<int64_t>(i)).bind(std::string("value-") + std::to_string(i)).bind(i * 0.5).execute(); }
+		db.execute("COMMIT");
+	}
+
+	const long rss_before = status_kib("VmRSS");
+	std::atomic<bool> running(true);
+	std::atomic<uint64_t> operations(0);
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threads; ++t)
+	{
+		workers.emplace_back([&, t]()
+		{
+			SQLite db(path);
+			uint64_t ops = 0;
+			uint32_t seed = 2654435761u * (t + 1);
+			while(running.load(std::memory_order_relaxed))
+			{
+				seed = seed * 1664525u + 1013904223u;
+				//prepare on every iteration to exercise parser and VDBE allocations, not only the page cache
+				auto lookup = db.prepare("SELECT v, n FROM kv WHERE k = ?");
+				lookup->bind(static_cast<int64_t>(seed % rows));
+				if(auto row = lookup->step()) { (*row)[0].asString(); }
+				auto scan = db.prepare("SELECT sum(length(v)) FROM kv WHERE k BETWEEN ? AND ?");
+				scan->bind(static_cast<int64_t>(seed % rows)).bind(static_cast<int64_t>(seed % rows + 100));
+				scan->step();
+				ops += 2;
+			}
+			operations.fetch_add(ops);
+			gDefaultAllocations.fetch_add(tDefaultAllocations);
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	running = false;
+	for(auto& worker : workers) { worker.join(); }
+
+	const uint64_t system_allocations = use_pool ? SQLiteAllocator::stats().systemAllocations : gDefaultAllocations.load();
+	printf("{\"allocator\":\"%s\",\"threads\":%d,\"ops_per_sec\":%.0f,\"system_allocations\":%llu,\"system_allocations_per_op\":%.4f,\"peak_rss_growth_kib\":%ld,\"rss_after_close_kib\":%ld}\n"
+		, use_pool ? "pool" : "default", threads, operations.load() / static_cast<double>(seconds)
+		, static_cast<unsigned long long>(system_allocations), system_allocations / static_cast<double>(operations.load() ? operations.load() : 1)
+		, status_kib("VmHWM") - rss_before, status_kib("VmRSS"));
+
+	unlink(path);
+	unlink((std::string(path) + "-wal").c_str());
+	unlink((std::string(path) + "-shm").c_str());
+	return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * Self-contained micro-benchmark harness: ns/op and allocations/op of a callable
+ * Allocations are counted for operator new (replaced below) and for SQLite's allocator (counting wrapper installed by
+ * bench::countSqliteAllocations() before the library initializes).
+ * Replaces the global operator new/delete, include it in exactly one translation unit of a benchmark binary.
+ */
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+	//benchmarks run on one thread, plain counters keep the counting overhead out of the measurement
+	inline uint64_t gNewCalls = 0;
+	inline uint64_t gSqliteCalls = 0;
+	inline sqlite3_mem_methods gSqliteMethods;
+
+	inline void* counting_malloc(int size) { ++gSqliteCalls; return gSqliteMethods.xMalloc(size); }
+	inline void* counting_realloc(void* ptr, int size) { ++gSqliteCalls; return gSqliteMethods.xRealloc(ptr, size); }
+
+	/**
+	 * Wraps SQLite's allocator with a counter, has to be called before the first connection is opened
+	 */
+	inline bool countSqliteAllocations()
+	{
+		static sqlite3_mem_methods methods;
+		if(sqlite3_config(SQLITE_CONFIG_GETMALLOC, &gSqliteMethods) != SQLITE_OK) { return false; }
+		methods = gSqliteMethods;
+		methods.xMalloc = &counting_malloc;
+		methods.xRealloc = &counting_realloc;
+		return sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) == SQLITE_OK;
+	}
+
+	/**
+	 * Keeps the compiler from dropping a computed value
+	 */
+	template <typename T>
+	inline void doNotOptimize(const T& value) { asm volatile("" : : "r,m"(value) : "memory"); }
+
+	struct Result
+	{
+		std::string	name;
+		uint64_t	iterations;
+		double		nsPerOp;		//median of the samples
+		double		newPerOp;		//operator new calls
+		double		sqlitePerOp;	//SQLite malloc/realloc calls
+	};
+
+	class Suite
+	{
+	public:
+		/**
+		 * @param filter Only benchmarks whose name contains it are run, all when empty
+		 */
+		Suite(const std::string& filter = std::string(), std::chrono::milliseconds sample = std::chrono::milliseconds(50), int samples = 5)
+			: mFilter(filter)
+			, mSample(sample)
+			, mSamples(samples)
+		{
+			printf("%-36s %12s %10s %10s %12s\n", "benchmark", "iterations", "ns/op", "new/op", "sqlite/op");
+		}
+
+		/**
+		 * Runs body(iterations) in samples, body has to run its operation the given number of times
+		 */
+		template <typename F>
+		const Result* run(const std::string& name, F&& body)
+		{
+			if( !mFilter.empty() && (name.find(mFilter) == std::string::npos) ) { return nullptr; }
+			//grow the iteration count until one call takes a tenth of a sample
+			uint64_t iterations = 1;
+			for(;;)
+			{
+				auto start = std::chrono::steady_clock::now();
+				body(iterations);
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				if( (elapsed >= mSample / 10) || (iterations >= (1ull << 32)) )
+				{
+					const double ns = std::max<double>(1.0, std::chrono::duration<double, std::nano>(elapsed).count());
+					iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * std::chrono::duration<double, std::nano>(mSample).count() / ns));
+					break;
+				}
+				iterations *= 10;
+			}
+			std::vector<double> ns_per_op;
+			uint64_t new_calls = 0;
+			uint64_t sqlite_calls = 0;
+			for(int i = 0; i < mSamples; ++i)
+			{
+				const uint64_t new_before = gNewCalls;
+				const uint64_t sqlite_before = gSqliteCalls;
+				auto start = std::chrono::steady_clock::now();
+				body(iterations);
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				new_calls += gNewCalls - new_before;
+				sqlite_calls += gSqliteCalls - sqlite_before;
+				ns_per_op.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+			}
+			std::sort(ns_per_op.begin(), ns_per_op.end());
+			const double operations = static_cast<double>(iterations) * mSamples;
+			mResults.push_back({ name, iterations, ns_per_op[ns_per_op.size() / 2], new_calls / operations, sqlite_calls / operations });
+			const Result& result = mResults.back();
+			printf("%-36s %12llu %10.1f %10.2f %12.2f\n", result.name.c_str(), static_cast<unsigned long long>(result.iterations)
+				, result.nsPerOp, result.newPerOp, result.sqlitePerOp);
+			fflush(stdout);
+			return &result;
+		}
+
+		/**
+		 * Prints the cost of the wrapper over the raw C calls for every pair of benchmarks that ran
+		 */
+		void compare(const std::vector<std::pair<std::string, std::string>>& pairs) const
+		{
+			printf("\n%-36s %10s %10s %10s\n", "wrapper vs raw", "raw ns", "wrapper ns", "overhead");
+			for(const auto& pair : pairs)
+			{
+				const Result* raw = find(pair.first);
+				const Result* wrapper = find(pair.second);
+				if( (raw == nullptr) || (wrapper == nullptr) ) { continue; }
+				printf("%-36s %10.1f %10.1f %+9.1f%%\n", wrapper->name.c_str(), raw->nsPerOp, wrapper->nsPerOp
+					, (raw->nsPerOp > 0.0) ? (wrapper->nsPerOp / raw->nsPerOp - 1.0) * 100.0 : 0.0);
+			}
+		}
+
+		const Result* find(const std::string& name) const
+		{
+			for(const auto& result : mResults)
+			{
+				if(result.name == name) { return &result; }
+			}
+			return nullptr;
+		}
+	private:
+		const std::string					mFilter;
+		const std::chrono::nanoseconds		mSample;
+		const int							mSamples;
+		std::vector<Result>					mResults;
+	};
+}
+
+void* operator new(size_t size)
+{
+	++bench::gNewCalls;
+	if(void* ptr = malloc(size ? size : 1)) { return ptr; }
+	throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	++bench::gNewCalls;
+	return malloc(size ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+#endif /* BENCH_BENCH_H_ */
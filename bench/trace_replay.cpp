@@ -0,0 +1,273 @@
+/**
+ * Replays a trace written by SQLiteTraceRecorder against a copy of a database and compares statement latencies
+ * usage: trace_replay <trace> <database> [--speed=1|N|max] [--top=N] [--keep]
+ * <database> must be a snapshot taken before recording began (SQLiteTraceRecorder::saveBaseline), the live database
+ * already holds the recorded writes and replaying them on top of it fails or diverges.
+ * The database (and its -wal) is copied next to itself first, the original is never written. Every recorded
+ * connection is replayed by a thread of its own with its own connection, cycles start at their recorded time divided
+ * by the speed (--speed=max runs flat out, in recorded order per connection).
+ * Prints a summary and the statements taking the most replay time: recorded vs replayed p50/p99/total latency, and
+ * cycles whose result or row count differed from the recording.
+ */
+#include <sqlite3.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sqlite.h"
+#include "sqlite_trace.h"
+
+using namespace database;
+
+struct StatementStats
+{
+	std::vector<int64_t>	recorded;//latencies in nanoseconds
+	std::vector<int64_t>	replayed;
+	uint64_t				mismatches = 0;
+	uint64_t				errors = 0;
+
+	void merge(const StatementStats& other)
+	{
+		recorded.insert(recorded.end(), other.recorded.begin(), other.recorded.end());
+		replayed.insert(replayed.end(), other.replayed.begin(), other.replayed.end());
+		mismatches += other.mismatches;
+		errors += other.errors;
+	}
+};
+
+static bool copy_file(const std::string& from, const std::string& to)
+{
+	FILE* in = fopen(from.c_str(), "rb");
+	if(in == nullptr) { return false; }
+	FILE* out = fopen(to.c_str(), "wb");
+	if(out == nullptr)
+	{
+		fclose(in);
+		return false;
+	}
+	std::vector<char> buffer(1 << 20);
+	size_t read = 0;
+	bool ok = true;
+	while( ok && ((read = fread(buffer.data(), 1, buffer.size(), in)) > 0) ) { ok = fwrite(buffer.data(), 1, read, out) == read; }
+	fclose(in);
+	return (fclose(out) == 0) && ok;
+}
+
+static int64_t percentile(std::vector<int64_t>& values, double p)
+{
+	if(values.empty()) { return 0; }
+	const size_t rank = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + rank, values.end());
+	return values[rank];
+}
+
+static int64_t total(const std::vector<int64_t>& values)
+{
+	int64_t sum = 0;
+	for(int64_t value : values) { sum += value; }
+	return sum;
+}
+
+static void bind_parameters(SQLiteStatement& stmt, const std::vector<SQLiteTraceValue>& parameters)
+{
+	for(size_t i = 0; i < parameters.size(); ++i)
+	{
+		const int32_t index = static_cast<int32_t>(i + 1);
+		const SQLiteTraceValue& value = parameters[i];
+		switch(value.type)
+		{
+			case SQLiteValueType::INTEGER: stmt.bind(value.integer, index); break;
+			case SQLiteValueType::FLOAT: stmt.bind(value.real, index); break;
+			case SQLiteValueType::TEXT: stmt.bind(value.bytes, index); break;
+			case SQLiteValueType::BLOB:
+				stmt.bindNull(index);//resets the statement if needed
+				sqlite3_bind_blob(stmt.native(), index, value.bytes.data(), static_cast<int>(value.bytes.size()), SQLITE_TRANSIENT);
+				break;
+			default: stmt.bindNull(index); break;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		fprintf(stderr, "usage: %s <trace> <database> [--speed=1|N|max] [--top=N] [--keep]\n"
+			"<database> must be a snapshot taken before recording began, see SQLiteTraceRecorder::saveBaseline\n", argv[0]);
+		return 1;
+	}
+	double speed = 1.0;//0 runs flat out
+	size_t top = 20;
+	bool keep = false;
+	for(int i = 3; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "--speed=max") == 0) { speed = 0.0; }
+		else if(strncmp(argv[i], "--speed=", 8) == 0) { speed = atof(argv[i] + 8); }
+		else if(strncmp(argv[i], "--top=", 6) == 0) { top = static_cast<size_t>(atoll(argv[i] + 6)); }
+		else if(strcmp(argv[i], "--keep") == 0) { keep = true; }
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if(speed < 0.0) { speed = 0.0; }
+
+	SQLiteTraceReader reader(argv[1]);
+	if(!reader)
+	{
+		fprintf(stderr, "%s is not a trace\n", argv[1]);
+		return 1;
+	}
+	std::map<uint32_t, std::vector<SQLiteTraceEvent>> connections;
+	SQLiteTraceEvent event;
+	uint64_t events = 0;
+	while(reader.next(event))
+	{
+		connections[event.connection].push_back(event);
+		++events;
+	}
+	if(reader.corrupt()) { fprintf(stderr, "trace ends with a partial record, replaying the %llu complete events\n", static_cast<unsigned long long>(events)); }
+	std::vector<std::string> sql(reader.sqlCount());
+	for(uint32_t i = 0; i < sql.size(); ++i) { sql[i] = reader.sql(i); }
+	//cycles are written when they end, a connection replays them in the order they started
+	for(auto& connection : connections)
+	{
+		std::stable_sort(connection.second.begin(), connection.second.end(), [](const SQLiteTraceEvent& a, const SQLiteTraceEvent& b)
+		{ return a.start < b.start; });
+	}
+
+	const std::string database = argv[2];
+	const std::string copy = database + ".replay-" + std::to_string(getpid());
+	if(!copy_file(database, copy))
+	{
+		fprintf(stderr, "cannot copy %s to %s\n", database.c_str(), copy.c_str());
+		return 1;
+	}
+	if(access((database + "-wal").c_str(), F_OK) == 0) { copy_file(database + "-wal", copy + "-wal"); }
+
+	std::mutex mutex;
+	std::unordered_map<uint32_t, StatementStats> statements;
+	int64_t max_lag = 0;
+	auto replay_start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for(const auto& connection : connections)
+	{
+		workers.emplace_back([&, events_of = &connection.second]()
+		{
+			SQLite db(copy);
+			db.execute("PRAGMA busy_timeout=10000");
+			std::unordered_map<uint32_t, SQLiteStmt_sptr> prepared;
+			std::unordered_map<uint32_t, StatementStats> local;
+			int64_t lag = 0;
+			for(const SQLiteTraceEvent& recorded : *events_of)
+			{
+				if(speed > 0.0)
+				{
+					const auto scheduled = replay_start + std::chrono::nanoseconds(static_cast<int64_t>(recorded.start.count() / speed));
+					const auto now = std::chrono::steady_clock::now();
+					if(now < scheduled) { std::this_thread::sleep_until(scheduled); }
+					else { lag = std::max<int64_t>(lag, std::chrono::duration_cast<std::chrono::nanoseconds>(now - scheduled).count()); }
+				}
+				StatementStats& stats = local[recorded.sql];
+				auto& stmt = prepared[recorded.sql];
+				if(!stmt) { stmt = db.prepare( (recorded.sql < sql.size()) ? sql[recorded.sql] : std::string() ); }
+				if(!*stmt)
+				{
+					++stats.errors;
+					continue;
+				}
+				bind_parameters(*stmt, recorded.parameters);
+				//recorded latencies are the time spent inside sqlite3_step, binding and reading rows are left out here too
+				std::chrono::nanoseconds latency(0);
+				//a cycle stopped on a row is stopped after as many rows again
+				int64_t rows = 0;
+				int result = SQLITE_DONE;
+				for(;;)
+				{
+					if( (recorded.result == SQLITE_ROW) && (rows >= recorded.rows) )
+					{
+						result = SQLITE_ROW;
+						sqlite3_reset(stmt->native());
+						break;
+					}
+					auto start = std::chrono::steady_clock::now();
+					const bool stepped = stmt->step().has_value();
+					latency += std::chrono::steady_clock::now() - start;
+					if(!stepped)
+					{
+						result = stmt->valid() ? SQLITE_DONE : stmt->errorCode();
+						break;
+					}
+					++rows;
+				}
+				stats.recorded.push_back(recorded.latency.count());
+				stats.replayed.push_back(latency.count());
+				if( (result != SQLITE_DONE) && (result != SQLITE_ROW) ) { ++stats.errors; }
+				if( (result != recorded.result) || (rows != recorded.rows) ) { ++stats.mismatches; }
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			for(const auto& entry : local) { statements[entry.first].merge(entry.second); }
+			max_lag = std::max(max_lag, lag);
+		});
+	}
+	for(auto& worker : workers) { worker.join(); }
+	const double replay_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
+
+	std::vector<std::pair<uint32_t, StatementStats*>> ranked;
+	int64_t recorded_total = 0;
+	int64_t replayed_total = 0;
+	uint64_t mismatches = 0;
+	uint64_t errors = 0;
+	for(auto& entry : statements)
+	{
+		ranked.emplace_back(entry.first, &entry.second);
+		recorded_total += total(entry.second.recorded);
+		replayed_total += total(entry.second.replayed);
+		mismatches += entry.second.mismatches;
+		errors += entry.second.errors;
+	}
+	std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return total(a.second->replayed) > total(b.second->replayed); });
+
+	char speed_text[32] = "max";
+	if(speed > 0.0) { snprintf(speed_text, sizeof(speed_text), "%gx", speed); }
+	printf("events %llu, connections %zu, statements %zu, speed %s, replay %.3f s, max lag %.3f ms\n"
+		, static_cast<unsigned long long>(events), connections.size(), sql.size(), speed_text, replay_seconds, max_lag / 1e6);
+	printf("statement time recorded %.3f ms, replayed %.3f ms (%+.1f%%), mismatching cycles %llu, errors %llu\n\n"
+		, recorded_total / 1e6, replayed_total / 1e6, (recorded_total > 0) ? (replayed_total / static_cast<double>(recorded_total) - 1.0) * 100.0 : 0.0
+		, static_cast<unsigned long long>(mismatches), static_cast<unsigned long long>(errors));
+	printf("%10s %11s %11s %11s %11s %12s %12s %8s %9s  %s\n", "cycles", "rec p50 us", "rep p50 us", "rec p99 us", "rep p99 us"
+		, "rec total ms", "rep total ms", "change", "mismatch", "sql");
+	for(size_t i = 0; (i < ranked.size()) && (i < top); ++i)
+	{
+		StatementStats& stats = *ranked[i].second;
+		const int64_t recorded = total(stats.recorded);
+		const int64_t replayed = total(stats.replayed);
+		std::string text = (ranked[i].first < sql.size()) ? sql[ranked[i].first] : std::string("?");
+		std::replace(text.begin(), text.end(), '\n', ' ');
+		if(text.size() > 80) { text = text.substr(0, 77) + "..."; }
+		printf("%10zu %11.1f %11.1f %11.1f %11.1f %12.3f %12.3f %+7.1f%% %9llu  %s\n", stats.replayed.size()
+			, percentile(stats.recorded, 0.50) / 1e3, percentile(stats.replayed, 0.50) / 1e3
+			, percentile(stats.recorded, 0.99) / 1e3, percentile(stats.replayed, 0.99) / 1e3
+			, recorded / 1e6, replayed / 1e6, (recorded > 0) ? (replayed / static_cast<double>(recorded) - 1.0) * 100.0 : 0.0
+			, static_cast<unsigned long long>(stats.mismatches + stats.errors), text.c_str());
+	}
+
+	if(!keep)
+	{
+		unlink(copy.c_str());
+		unlink((copy + "-wal").c_str());
+		unlink((copy + "-shm").c_str());
+		unlink((copy + "-journal").c_str());
+	}
+	else { printf("\nreplayed database kept at %s\n", copy.c_str()); }
+	return 0;
+}
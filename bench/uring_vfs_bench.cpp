@@ -0,0 +1,86 @@
+/**
+ * Cold-cache benchmark comparing the unix VFS with SQLiteUringVfs
+ * usage: uring_vfs_bench [default|uring] [rows] [commits]
+ * Measures small WAL commits (synchronous=FULL) and a full table scan after dropping the database from the OS page cache
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "sqlite.h"
+#include "sqlite_uring_vfs.h"
+
+using namespace database;
+
+static void drop_page_cache(const std::string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) { return; }
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+int main(int argc, char** argv)
+{
+	const bool use_uring = (argc > 1) && (strcmp(argv[1], "uring") == 0);
+	const int rows = (argc > 2) ? atoi(argv[2]) : 500000;
+	const int commits = (argc > 3) ? atoi(argv[3]) : 2000;
+
+	SQLiteOpenOptions options;
+	if(use_uring)
+	{
+		if(SQLiteUringVfs::install() != SQLiteCode::OK) { fprintf(stderr, "io_uring vfs: registration failed\n"); return 1; }
+		options.vfs = SQLiteUringVfs::NAME;
+	}
+
+	char path[] = "/tmp/uring_vfs_bench_XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) { perror("mkstemp"); return 1; }
+	close(fd);
+
+	double commit_seconds = 0;
+	{
+		SQLite db(path, options);
+		db.execute("PRAGMA journal_mode=WAL");
+		db.execute("PRAGMA synchronous=FULL");
+		db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v BLOB)");
+		auto insert = db.prepare("INSERT INTO kv(k, v) VALUES(?, randomblob(200))");
+		db.execute("BEGIN");
+		for(int i = 0; i < rows; ++i) { insert->bind(static_cast<int64_t>(i)).execute(); }
+		db.execute("COMMIT");
+		db.execute("PRAGMA wal_checkpoint(TRUNCATE)");
+
+		auto update = db.prepare("UPDATE kv SET v = randomblob(200) WHERE k = ?");
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < commits; ++i) { update->bind(static_cast<int64_t>((i * 7919) % rows)).execute(); }
+		commit_seconds = seconds_since(start);
+		db.execute("PRAGMA wal_checkpoint(TRUNCATE)");
+	}
+
+	drop_page_cache(path);
+	double scan_seconds = 0;
+	int64_t bytes = 0;
+	{
+		SQLite db(path, options);
+		auto start = std::chrono::steady_clock::now();
+		auto scan = db.prepare("SELECT sum(length(v)) FROM kv");
+		if(auto row = scan->step()) { bytes = (*row)[0].asInt64(); }
+		scan_seconds = seconds_since(start);
+	}
+
+	printf("{\"vfs\":\"%s\",\"uring_available\":%s,\"rows\":%d,\"commits_per_sec\":%.0f,\"cold_scan_ms\":%.1f,\"scanned_mib\":%.1f}\n"
+		, use_uring ? SQLiteUringVfs::NAME : "unix", SQLiteUringVfs::uringAvailable() ? "true" : "false", rows
+		, commits / commit_seconds, scan_seconds * 1000, bytes / 1048576.0);
+
+	unlink(path);
+	unlink((std::string(path) + "-wal").c_str());
+	unlink((std::string(path) + "-shm").c_str());
+	return 0;
+}
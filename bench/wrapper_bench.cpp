@@ -0,0 +1,218 @@
+/**
+ * Micro-benchmarks of the wrapper hot paths against the raw sqlite3 C calls doing the same work
+ * usage: wrapper_bench [filter]
+ * Runs on an in-memory database of 1000 rows, the overhead table at the end is the cost of the wrapper per operation
+ */
+#include <sqlite3.h>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include "sqlite.h"
+#include "bench.h"
+
+using namespace database;
+
+static const int ROWS = 1000;
+
+int main(int argc, char** argv)
+{
+	bench::countSqliteAllocations();
+	SQLite db(":memory:");
+	if(!db.isOpen()) { fprintf(stderr, "cannot open an in-memory database\n"); return 1; }
+	sqlite3* raw = db.native();
+	db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT, n REAL)");
+	db.execute("BEGIN");
+	auto insert = db.prepare("INSERT INTO kv(k, v, n) VALUES(?, ?, ?)");
+	for(int i = 0; i < ROWS; ++i)
+	{ insert->bind(static_cast<int64_t>(i)).bind(std::string("value-") + std::to_string(i)).bind(i * 0.5).execute(); }
+	db.execute("COMMIT");
+
+	bench::Suite suite((argc > 1) ? argv[1] : "");
+	std::vector<std::pair<std::string, std::string>> pairs;
+
+	//prepare
+	const std::string lookup_sql = "SELECT v, n FROM kv WHERE k = ?1";
+	suite.run("raw/prepare", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			sqlite3_stmt* stmt = nullptr;
+			sqlite3_prepare_v2(raw, lookup_sql.c_str(), static_cast<int>(lookup_sql.size()), &stmt, nullptr);
+			sqlite3_finalize(stmt);
+		}
+	});
+	suite.run("wrapper/prepare", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize(db.prepare(lookup_sql)); }
+	});
+	pairs.emplace_back("raw/prepare", "wrapper/prepare");
+
+	//bind, by index and by name
+	auto by_index = db.prepare("SELECT ?1");
+	auto by_name = db.prepare("SELECT :value");
+	sqlite3_stmt* index_stmt = by_index->native();
+	sqlite3_stmt* name_stmt = by_name->native();
+	const std::string text = "value-123";
+	suite.run("raw/bind_double", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_double(index_stmt, 1, 0.5 * i); } });
+	suite.run("wrapper/bind_double", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_index->bind(0.5 * i, 1); } });
+	suite.run("raw/bind_int32", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_int(index_stmt, 1, static_cast<int32_t>(i)); } });
+	suite.run("wrapper/bind_int32", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_index->bind(static_cast<int32_t>(i), 1); } });
+	suite.run("raw/bind_int64", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_int64(index_stmt, 1, static_cast<int64_t>(i)); } });
+	suite.run("wrapper/bind_int64", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_index->bind(static_cast<int64_t>(i), 1); } });
+	suite.run("raw/bind_string", [&](uint64_t n)
+	{ for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_text(index_stmt, 1, text.c_str(), static_cast<int>(text.size()), SQLITE_TRANSIENT); } });
+	suite.run("wrapper/bind_string", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_index->bind(text, 1); } });
+	suite.run("raw/bind_null", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_null(index_stmt, 1); } });
+	suite.run("wrapper/bind_null", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_index->bindNull(1); } });
+	const std::string name = ":value";
+	suite.run("raw/bind_double_by_name", [&](uint64_t n)
+	{ for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_double(name_stmt, sqlite3_bind_parameter_index(name_stmt, name.c_str()), 0.5 * i); } });
+	suite.run("wrapper/bind_double_by_name", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_name->bind(0.5 * i, name); } });
+	suite.run("raw/bind_int32_by_name", [&](uint64_t n)
+	{ for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_int(name_stmt, sqlite3_bind_parameter_index(name_stmt, name.c_str()), static_cast<int32_t>(i)); } });
+	suite.run("wrapper/bind_int32_by_name", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_name->bind(static_cast<int32_t>(i), name); } });
+	suite.run("raw/bind_int64_by_name", [&](uint64_t n)
+	{ for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_int64(name_stmt, sqlite3_bind_parameter_index(name_stmt, name.c_str()), static_cast<int64_t>(i)); } });
+	suite.run("wrapper/bind_int64_by_name", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_name->bind(static_cast<int64_t>(i), name); } });
+	suite.run("raw/bind_string_by_name", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{ sqlite3_bind_text(name_stmt, sqlite3_bind_parameter_index(name_stmt, name.c_str()), text.c_str(), static_cast<int>(text.size()), SQLITE_TRANSIENT); }
+	});
+	suite.run("wrapper/bind_string_by_name", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_name->bind(text, name); } });
+	suite.run("raw/bind_null_by_name", [&](uint64_t n)
+	{ for(uint64_t i = 0; i < n; ++i) { sqlite3_bind_null(name_stmt, sqlite3_bind_parameter_index(name_stmt, name.c_str())); } });
+	suite.run("wrapper/bind_null_by_name", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { by_name->bindNull(name); } });
+	for(const char* type : { "bind_double", "bind_int32", "bind_int64", "bind_string", "bind_null", "bind_double_by_name", "bind_int32_by_name",
+		"bind_int64_by_name", "bind_string_by_name", "bind_null_by_name" })
+	{ pairs.emplace_back(std::string("raw/") + type, std::string("wrapper/") + type); }
+
+	//step: one row of a point lookup (bind, step, reset)
+	auto lookup = db.prepare(lookup_sql);
+	sqlite3_stmt* lookup_stmt = lookup->native();
+	suite.run("raw/step_lookup", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			sqlite3_reset(lookup_stmt);
+			sqlite3_bind_int64(lookup_stmt, 1, static_cast<int64_t>(i % ROWS));
+			bench::doNotOptimize(sqlite3_step(lookup_stmt));
+		}
+		sqlite3_reset(lookup_stmt);
+	});
+	suite.run("wrapper/step_lookup", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			//the statement is left on its row, binding needs it reset first like the raw loop does
+			sqlite3_reset(lookup_stmt);
+			lookup->bind(static_cast<int64_t>(i % ROWS), 1);
+			bench::doNotOptimize(lookup->step().has_value());
+		}
+		sqlite3_reset(lookup_stmt);
+	});
+	pairs.emplace_back("raw/step_lookup", "wrapper/step_lookup");
+
+	//step: rows of a scan, per row
+	auto scan = db.prepare("SELECT k, v, n FROM kv");
+	sqlite3_stmt* scan_stmt = scan->native();
+	suite.run("raw/step_scan_row", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			if(sqlite3_step(scan_stmt) != SQLITE_ROW) { sqlite3_reset(scan_stmt); }
+		}
+		sqlite3_reset(scan_stmt);
+	});
+	suite.run("wrapper/step_scan_row", [&](uint64_t n)
+	{
+		//step() resets the statement by itself once it returned the end
+		for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize(scan->step().has_value()); }
+		sqlite3_reset(scan_stmt);
+	});
+	pairs.emplace_back("raw/step_scan_row", "wrapper/step_scan_row");
+
+	//column accessors on the current row
+	lookup->bind(static_cast<int64_t>(123), 1);
+	auto row = lookup->step();
+	if(!row) { fprintf(stderr, "lookup returned no row\n"); return 1; }
+	suite.run("raw/column_double", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize(sqlite3_column_double(lookup_stmt, 1)); } });
+	suite.run("wrapper/asDouble", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize((*row)[1].asDouble()); } });
+	suite.run("raw/column_int", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize(sqlite3_column_int(lookup_stmt, 1)); } });
+	suite.run("wrapper/asInt", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize((*row)[1].asInt()); } });
+	suite.run("raw/column_int64", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize(sqlite3_column_int64(lookup_stmt, 1)); } });
+	suite.run("wrapper/asInt64", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize((*row)[1].asInt64()); } });
+	suite.run("raw/column_text", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			const unsigned char* data = sqlite3_column_text(lookup_stmt, 0);
+			std::string value(reinterpret_cast<const char*>(data), sqlite3_column_bytes(lookup_stmt, 0));
+			bench::doNotOptimize(value);
+		}
+	});
+	suite.run("wrapper/asString", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize((*row)[0].asString()); } });
+	suite.run("wrapper/asWString", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { bench::doNotOptimize((*row)[0].asWString()); } });
+	sqlite3_reset(lookup_stmt);
+	pairs.emplace_back("raw/column_double", "wrapper/asDouble");
+	pairs.emplace_back("raw/column_int", "wrapper/asInt");
+	pairs.emplace_back("raw/column_int64", "wrapper/asInt64");
+	pairs.emplace_back("raw/column_text", "wrapper/asString");
+
+	//evaluate: a full scan reading every column, per scan
+	suite.run("raw/scan_loop", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			int64_t sum = 0;
+			while(sqlite3_step(scan_stmt) == SQLITE_ROW)
+			{
+				sum += sqlite3_column_int64(scan_stmt, 0) + sqlite3_column_bytes(scan_stmt, 1) + static_cast<int64_t>(sqlite3_column_double(scan_stmt, 2));
+			}
+			sqlite3_reset(scan_stmt);
+			bench::doNotOptimize(sum);
+		}
+	});
+	suite.run("wrapper/evaluate", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			int64_t sum = 0;
+			scan->evaluate([&sum](SQLiteRow& current)
+			{
+				sum += current[0].asInt64() + static_cast<int64_t>(current[1].asString().size()) + static_cast<int64_t>(current[2].asDouble());
+				return true;
+			});
+			bench::doNotOptimize(sum);
+		}
+	});
+	pairs.emplace_back("raw/scan_loop", "wrapper/evaluate");
+
+	//execute: a write statement, and sql text run once
+	db.execute("BEGIN");
+	auto update = db.prepare("UPDATE kv SET n = n + 1 WHERE k = ?1");
+	sqlite3_stmt* update_stmt = update->native();
+	suite.run("raw/step_update", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i)
+		{
+			sqlite3_bind_int64(update_stmt, 1, static_cast<int64_t>(i % ROWS));
+			sqlite3_step(update_stmt);
+			sqlite3_reset(update_stmt);
+		}
+	});
+	suite.run("wrapper/execute", [&](uint64_t n)
+	{
+		for(uint64_t i = 0; i < n; ++i) { update->bind(static_cast<int64_t>(i % ROWS), 1).execute(); }
+	});
+	const std::string sql = "UPDATE kv SET n = n + 1 WHERE k = 7";
+	suite.run("raw/exec_sql", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { sqlite3_exec(raw, sql.c_str(), nullptr, nullptr, nullptr); } });
+	suite.run("wrapper/execute_sql", [&](uint64_t n) { for(uint64_t i = 0; i < n; ++i) { db.execute(sql); } });
+	db.execute("COMMIT");
+	pairs.emplace_back("raw/step_update", "wrapper/execute");
+	pairs.emplace_back("raw/exec_sql", "wrapper/execute_sql");
+
+	suite.compare(pairs);
+	return 0;
+}
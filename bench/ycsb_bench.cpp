@@ -0,0 +1,505 @@
+/**
+ * YCSB-style workload driver on a temp file database, through the database::SQLite API
+ * usage: ycsb_bench [--workload=a..f] [--records=N] [--operations=N | --seconds=S] [--threads=N]
+ *                   [--distribution=uniform|zipfian|latest] [--durability=off|normal|full|rollback]
+ *                   [--fields=N] [--field-length=N] [--max-scan=N] [--dir=PATH]
+ * Workloads (core YCSB mixes):
+ *   a 50% read 50% update, zipfian          b 95% read 5% update, zipfian
+ *   c 100% read, zipfian                    d 95% read 5% insert, latest
+ *   e 95% scan 5% insert, zipfian           f 50% read 50% read-modify-write, zipfian
+ * Durability profiles: off (WAL, synchronous=OFF), normal (WAL, NORMAL), full (WAL, FULL), rollback (DELETE journal, FULL)
+ * The table is loaded first, then every thread runs the mix on its own connection. Prints one JSON object with the
+ * throughput and the p50/p99/p999 latencies of every operation type.
+ */
+#include <sqlite3.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sqlite.h"
+
+using namespace database;
+
+struct Options
+{
+	char		workload = 'a';
+	int64_t		records = 100000;
+	int64_t		operations = 0;//run for seconds when 0
+	double		seconds = 10.0;
+	int			threads = 4;
+	std::string	distribution;//the one of the workload when empty
+	std::string	durability = "normal";
+	int			fields = 10;
+	int			fieldLength = 100;
+	int			maxScan = 100;
+	std::string	dir = "/tmp";
+};
+
+struct Mix
+{
+	double		read;
+	double		update;
+	double		insert;
+	double		scan;
+	double		readModifyWrite;
+	const char*	distribution;
+};
+
+struct Operation
+{
+	enum Enum
+	{
+		READ,
+		UPDATE,
+		INSERT,
+		SCAN,
+		READ_MODIFY_WRITE,
+		COUNT
+	};
+};
+static const char* OPERATION_NAMES[] = { "read", "update", "insert", "scan", "read_modify_write" };
+
+static bool workload_mix(char workload, Mix& mix)
+{
+	switch(workload)
+	{
+		case 'a': mix = { 0.50, 0.50, 0.00, 0.00, 0.00, "zipfian" }; return true;
+		case 'b': mix = { 0.95, 0.05, 0.00, 0.00, 0.00, "zipfian" }; return true;
+		case 'c': mix = { 1.00, 0.00, 0.00, 0.00, 0.00, "zipfian" }; return true;
+		case 'd': mix = { 0.95, 0.00, 0.05, 0.00, 0.00, "latest" }; return true;
+		case 'e': mix = { 0.00, 0.00, 0.05, 0.95, 0.00, "zipfian" }; return true;
+		case 'f': mix = { 0.50, 0.00, 0.00, 0.00, 0.50, "zipfian" }; return true;
+		default: return false;
+	}
+}
+
+static uint64_t fnv1a64(uint64_t value)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for(int i = 0; i < 8; ++i)
+	{
+		hash ^= value & 0xFF;
+		hash *= 0x100000001B3ull;
+		value >>= 8;
+	}
+	return hash;
+}
+
+/**
+ * Keys are hashed like YCSB does, so inserts in key number order land all over the b-tree
+ */
+static std::string key_of(int64_t number)
+{ return "user" + std::to_string(fnv1a64(static_cast<uint64_t>(number))); }
+
+class Random
+{
+public:
+	explicit Random(uint64_t seed) : mState(seed) {}
+	inline uint64_t next()
+	{
+		//splitmix64
+		uint64_t z = (mState += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+	inline double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+private:
+	uint64_t mState;
+};
+
+/**
+ * Zipfian ranks 0..items-1 with theta 0.99, rank 0 is the most popular (Gray et al., as in YCSB)
+ */
+class Zipfian
+{
+public:
+	explicit Zipfian(int64_t items, double theta = 0.99)
+		: mItems(items)
+		, mTheta(theta)
+		, mZetaN(zeta(items, theta))
+		, mAlpha(1.0 / (1.0 - theta))
+		, mEta((1.0 - std::pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta(2, theta) / mZetaN))
+	{}
+	int64_t next(Random& random) const
+	{
+		const double u = random.uniform();
+		const double uz = u * mZetaN;
+		if(uz < 1.0) { return 0; }
+		if(uz < 1.0 + std::pow(0.5, mTheta)) { return 1; }
+		const int64_t rank = static_cast<int64_t>(mItems * std::pow(mEta * u - mEta + 1.0, mAlpha));
+		return (rank < mItems) ? rank : mItems - 1;
+	}
+private:
+	const int64_t	mItems;
+	const double	mTheta;
+	const double	mZetaN;
+	const double	mAlpha;
+	const double	mEta;
+
+	static double zeta(int64_t items, double theta)
+	{
+		double sum = 0.0;
+		for(int64_t i = 1; i <= items; ++i) { sum += 1.0 / std::pow(static_cast<double>(i), theta); }
+		return sum;
+	}
+};
+
+/**
+ * Keys handed out to inserts and the end of the range of keys whose inserts returned (YCSB's acknowledged counter)
+ * Inserts finish out of order, the limit only moves past a key once every key before it was acknowledged as well, so
+ * reads never pick a row whose insert is still running
+ */
+class AcknowledgedCounter
+{
+public:
+	explicit AcknowledgedCounter(int64_t start) : mNext(start), mLimit(start) {}
+	inline int64_t next() { return mNext.fetch_add(1, std::memory_order_relaxed); }
+	inline int64_t limit() const { return mLimit.load(std::memory_order_acquire); }
+	void acknowledge(int64_t key)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mAcknowledged.insert(key);
+		int64_t limit = mLimit.load(std::memory_order_relaxed);
+		while( !mAcknowledged.empty() && (*mAcknowledged.begin() == limit) )
+		{
+			mAcknowledged.erase(mAcknowledged.begin());
+			++limit;
+		}
+		mLimit.store(limit, std::memory_order_release);
+	}
+private:
+	std::atomic<int64_t>	mNext;
+	std::atomic<int64_t>	mLimit;
+	std::mutex				mMutex;
+	std::set<int64_t>		mAcknowledged;//returned ahead of the limit
+};
+
+/**
+ * Log-linear latency histogram: 16 buckets per power of two, values are reported with at most 6% error
+ */
+class Histogram
+{
+public:
+	Histogram() : mBuckets(1024, 0), mCount(0), mMax(0) {}
+	inline void record(uint64_t nanos)
+	{
+		++mBuckets[index(nanos)];
+		++mCount;
+		if(nanos > mMax) { mMax = nanos; }
+	}
+	void merge(const Histogram& other)
+	{
+		for(size_t i = 0; i < mBuckets.size(); ++i) { mBuckets[i] += other.mBuckets[i]; }
+		mCount += other.mCount;
+		if(other.mMax > mMax) { mMax = other.mMax; }
+	}
+	inline uint64_t count() const { return mCount; }
+	inline uint64_t max() const { return mMax; }
+	uint64_t percentile(double p) const
+	{
+		if(mCount == 0) { return 0; }
+		const uint64_t rank = static_cast<uint64_t>(std::ceil(p * mCount));
+		uint64_t seen = 0;
+		for(size_t i = 0; i < mBuckets.size(); ++i)
+		{
+			seen += mBuckets[i];
+			if( (seen >= rank) && (mBuckets[i] > 0) ) { return value(i); }
+		}
+		return mMax;
+	}
+private:
+	std::vector<uint64_t>	mBuckets;
+	uint64_t				mCount;
+	uint64_t				mMax;
+
+	static inline size_t index(uint64_t nanos)
+	{
+		if(nanos < 16) { return static_cast<size_t>(nanos); }
+		const int msb = 63 - __builtin_clzll(nanos);
+		return static_cast<size_t>( (msb - 3) * 16 + ((nanos >> (msb - 4)) & 15) );
+	}
+	static inline uint64_t value(size_t index)
+	{
+		if(index < 16) { return index; }
+		const int msb = static_cast<int>(index / 16) + 3;
+		const uint64_t lower = (16 + index % 16) << (msb - 4);
+		return lower + ((1ull << (msb - 4)) >> 1);
+	}
+};
+
+struct ThreadResult
+{
+	Histogram	latencies[Operation::COUNT];
+	uint64_t	errors[Operation::COUNT] = {};
+	uint64_t	notFound = 0;
+};
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = strchr(arg, '=');
+		if( (strncmp(arg, "--", 2) != 0) || (value == nullptr) ) { return false; }
+		const std::string name(arg + 2, value - arg - 2);
+		++value;
+		if(name == "workload") { options.workload = value[0]; }
+		else if(name == "records") { options.records = atoll(value); }
+		else if(name == "operations") { options.operations = atoll(value); }
+		else if(name == "seconds") { options.seconds = atof(value); }
+		else if(name == "threads") { options.threads = atoi(value); }
+		else if(name == "distribution") { options.distribution = value; }
+		else if(name == "durability") { options.durability = value; }
+		else if(name == "fields") { options.fields = atoi(value); }
+		else if(name == "field-length") { options.fieldLength = atoi(value); }
+		else if(name == "max-scan") { options.maxScan = atoi(value); }
+		else if(name == "dir") { options.dir = value; }
+		else { return false; }
+	}
+	return (options.records > 0) && (options.threads > 0) && (options.fields > 0) && (options.fieldLength > 0) && (options.maxScan > 0);
+}
+
+/**
+ * Applies the durability profile, synchronous is a setting of each connection
+ */
+static bool configure(SQLite& db, const std::string& durability, bool set_journal_mode)
+{
+	const char* journal_mode = (durability == "rollback") ? "DELETE" : "WAL";
+	const char* synchronous = nullptr;
+	if(durability == "off") { synchronous = "OFF"; }
+	else if(durability == "normal") { synchronous = "NORMAL"; }
+	else if( (durability == "full") || (durability == "rollback") ) { synchronous = "FULL"; }
+	else { return false; }
+	if(set_journal_mode) { db.execute(std::string("PRAGMA journal_mode=") + journal_mode); }
+	db.execute(std::string("PRAGMA synchronous=") + synchronous);
+	db.execute("PRAGMA busy_timeout=10000");
+	return true;
+}
+
+static std::string field_list(int fields)
+{
+	std::string result;
+	for(int i = 0; i < fields; ++i) { result += ((i > 0) ? ", field" : "field") + std::to_string(i); }
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	Mix mix;
+	if(!parse_options(argc, argv, options) || !workload_mix(options.workload, mix))
+	{
+		fprintf(stderr, "usage: %s [--workload=a..f] [--records=N] [--operations=N | --seconds=S] [--threads=N] "
+			"[--distribution=uniform|zipfian|latest] [--durability=off|normal|full|rollback] [--fields=N] [--field-length=N] "
+			"[--max-scan=N] [--dir=PATH]\n", argv[0]);
+		return 1;
+	}
+	if(options.distribution.empty()) { options.distribution = mix.distribution; }
+	if( (options.distribution != "uniform") && (options.distribution != "zipfian") && (options.distribution != "latest") )
+	{
+		fprintf(stderr, "unknown distribution %s\n", options.distribution.c_str());
+		return 1;
+	}
+
+	std::string path = options.dir + "/ycsb_bench_XXXXXX";
+	int fd = mkstemp(&path[0]);
+	if(fd < 0) { perror("mkstemp"); return 1; }
+	close(fd);
+
+	//load phase
+	const std::string fields = field_list(options.fields);
+	std::string placeholders;
+	for(int i = 0; i < options.fields; ++i) { placeholders += ", ?" + std::to_string(i + 2); }
+	const std::string insert_sql = "INSERT INTO usertable(ycsb_key, " + fields + ") VALUES(?1" + placeholders + ")";
+	std::string random_text(64 * 1024, ' ');
+	{
+		Random random(42);
+		for(auto& c : random_text) { c = static_cast<char>('a' + random.next() % 26); }
+	}
+	auto load_start = std::chrono::steady_clock::now();
+	{
+		SQLite db(path);
+		if(!db.isOpen() || !configure(db, options.durability, true))
+		{
+			fprintf(stderr, "cannot set up %s with durability %s\n", path.c_str(), options.durability.c_str());
+			unlink(path.c_str());
+			return 1;
+		}
+		std::string columns;
+		for(int i = 0; i < options.fields; ++i) { columns += ", field" + std::to_string(i) + " TEXT"; }
+		db.execute("CREATE TABLE usertable(ycsb_key TEXT PRIMARY KEY" + columns + ")");
+		auto insert = db.prepare(insert_sql);
+		Random random(1);
+		db.execute("BEGIN");
+		for(int64_t i = 0; i < options.records; ++i)
+		{
+			insert->bind(key_of(i), 1);
+			for(int f = 0; f < options.fields; ++f)
+			{ insert->bind(random_text.substr(random.next() % (random_text.size() - options.fieldLength), options.fieldLength), f + 2); }
+			insert->execute();
+			if( (i + 1) % 10000 == 0 ) { db.execute("COMMIT"); db.execute("BEGIN"); }
+		}
+		db.execute("COMMIT");
+	}
+	const double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+
+	//run phase
+	const Zipfian zipfian(options.records);
+	AcknowledgedCounter inserted(options.records);
+	std::atomic<int64_t> claimed(0);
+	std::atomic<bool> running(true);
+	std::vector<ThreadResult> results(options.threads);
+	std::vector<std::thread> workers;
+	auto run_start = std::chrono::steady_clock::now();
+	const auto deadline = run_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options.seconds));
+	for(int t = 0; t < options.threads; ++t)
+	{
+		workers.emplace_back([&, t]()
+		{
+			ThreadResult& result = results[t];
+			SQLite db(path);
+			configure(db, options.durability, false);
+			auto read = db.prepare("SELECT " + fields + " FROM usertable WHERE ycsb_key = ?1");
+			auto scan = db.prepare("SELECT " + fields + " FROM usertable WHERE ycsb_key >= ?1 ORDER BY ycsb_key LIMIT ?2");
+			auto insert = db.prepare(insert_sql);
+			std::vector<SQLiteStmt_sptr> updates;
+			for(int f = 0; f < options.fields; ++f)
+			{ updates.push_back(db.prepare("UPDATE usertable SET field" + std::to_string(f) + " = ?1 WHERE ycsb_key = ?2")); }
+			Random random(0x5EED + t);
+			auto value = [&]() { return random_text.substr(random.next() % (random_text.size() - options.fieldLength), options.fieldLength); };
+			auto choose_key = [&]() -> int64_t
+			{
+				const int64_t count = inserted.limit();
+				if(options.distribution == "uniform") { return static_cast<int64_t>(random.next() % count); }
+				if(options.distribution == "latest")
+				{
+					const int64_t key = count - 1 - zipfian.next(random);
+					return (key >= 0) ? key : 0;
+				}
+				//scrambled zipfian: popular keys are spread over the key space
+				return static_cast<int64_t>(fnv1a64(zipfian.next(random)) % count);
+			};
+			auto read_row = [&](SQLiteRow& row)
+			{
+				size_t bytes = 0;
+				for(int f = 0; f < options.fields; ++f) { bytes += row[f].asString().size(); }
+				return bytes;
+			};
+
+			for(;;)
+			{
+				if(options.operations > 0)
+				{
+					if(claimed.fetch_add(1, std::memory_order_relaxed) >= options.operations) { break; }
+				}
+				else if(!running.load(std::memory_order_relaxed)) { break; }
+
+				const double choice = random.uniform();
+				Operation::Enum operation = Operation::READ_MODIFY_WRITE;
+				if(choice < mix.read) { operation = Operation::READ; }
+				else if(choice < mix.read + mix.update) { operation = Operation::UPDATE; }
+				else if(choice < mix.read + mix.update + mix.insert) { operation = Operation::INSERT; }
+				else if(choice < mix.read + mix.update + mix.insert + mix.scan) { operation = Operation::SCAN; }
+
+				const int64_t key_number = (operation == Operation::INSERT) ? inserted.next() : choose_key();
+				const std::string key = key_of(key_number);
+				const std::string new_value = value();
+				const int field = static_cast<int>(random.next() % options.fields);
+				const int64_t scan_length = 1 + static_cast<int64_t>(random.next() % options.maxScan);
+				bool ok = true;
+
+				auto start = std::chrono::steady_clock::now();
+				switch(operation)
+				{
+					case Operation::READ:
+					case Operation::READ_MODIFY_WRITE:
+					{
+						//evaluated to the end, a statement left on its row would keep the read transaction open
+						size_t rows = 0;
+						sqlite3_reset(read->native());
+						read->bind(key, 1).evaluate([&](SQLiteRow& row) { read_row(row); ++rows; return true; });
+						ok = read->valid();
+						if( ok && (rows == 0) ) { ++result.notFound; }
+						if( ok && (operation == Operation::READ_MODIFY_WRITE) )
+						{ ok = updates[field]->bind(new_value, 1).bind(key, 2).execute() == SQLiteCode::DONE; }
+						break;
+					}
+					case Operation::UPDATE:
+						ok = updates[field]->bind(new_value, 1).bind(key, 2).execute() == SQLiteCode::DONE;
+						break;
+					case Operation::INSERT:
+						insert->bind(key, 1);
+						for(int f = 0; f < options.fields; ++f) { insert->bind(value(), f + 2); }
+						ok = insert->execute() == SQLiteCode::DONE;
+						//a failed insert is acknowledged too, like YCSB does, or the limit would stop at its key for good
+						inserted.acknowledge(key_number);
+						break;
+					case Operation::SCAN:
+						sqlite3_reset(scan->native());
+						scan->bind(key, 1).bind(scan_length, 2);
+						while(auto row = scan->step()) { read_row(*row); }
+						ok = scan->valid();
+						break;
+					default:
+						break;
+				}
+				auto end = std::chrono::steady_clock::now();
+				result.latencies[operation].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+				if(!ok) { ++result.errors[operation]; }
+				if( (options.operations == 0) && (end >= deadline) ) { running = false; }
+			}
+		});
+	}
+	for(auto& worker : workers) { worker.join(); }
+	const double run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+
+	Histogram all;
+	Histogram per_operation[Operation::COUNT];
+	uint64_t errors[Operation::COUNT] = {};
+	uint64_t not_found = 0;
+	for(const auto& result : results)
+	{
+		for(int o = 0; o < Operation::COUNT; ++o)
+		{
+			per_operation[o].merge(result.latencies[o]);
+			all.merge(result.latencies[o]);
+			errors[o] += result.errors[o];
+		}
+		not_found += result.notFound;
+	}
+	auto latency_json = [](const Histogram& histogram)
+	{
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "{\"count\":%llu,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}"
+			, static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.50) / 1000.0, histogram.percentile(0.99) / 1000.0
+			, histogram.percentile(0.999) / 1000.0, histogram.max() / 1000.0);
+		return std::string(buffer);
+	};
+	uint64_t total_errors = 0;
+	std::string latencies = "\"all\":" + latency_json(all);
+	for(int o = 0; o < Operation::COUNT; ++o)
+	{
+		total_errors += errors[o];
+		if(per_operation[o].count() > 0) { latencies += std::string(",\"") + OPERATION_NAMES[o] + "\":" + latency_json(per_operation[o]); }
+	}
+	printf("{\"workload\":\"%c\",\"records\":%lld,\"threads\":%d,\"distribution\":\"%s\",\"durability\":\"%s\",\"fields\":%d,\"field_length\":%d"
+		",\"load_seconds\":%.3f,\"run_seconds\":%.3f,\"operations\":%llu,\"ops_per_sec\":%.0f,\"errors\":%llu,\"not_found\":%llu,\"latency_us\":{%s}}\n"
+		, options.workload, static_cast<long long>(options.records), options.threads, options.distribution.c_str(), options.durability.c_str()
+		, options.fields, options.fieldLength, load_seconds, run_seconds, static_cast<unsigned long long>(all.count())
+		, all.count() / run_seconds, static_cast<unsigned long long>(total_errors), static_cast<unsigned long long>(not_found), latencies.c_str());
+
+	unlink(path.c_str());
+	unlink((path + "-wal").c_str());
+	unlink((path + "-shm").c_str());
+	unlink((path + "-journal").c_str());
+	return 0;
+}
@@ -1,6 +1,12 @@
 #include "sqlite.h"
+#include "sqlite_arena.h"
 #include <sqlite3.h>
 #include <regex.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace database
 {
@@ -28,29 +34,23 @@ static void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** va
     sqlite3_result_int(context, (ret != REG_NOMATCH));
 }
 
-SQLiteColumn::SQLiteColumn(const SQLiteStmt_sptr& stmt, int32_t col) : mStatement(stmt), mCol(col) {}
-
-bool SQLiteColumn::valid() const noexcept { return (mStatement != nullptr) && (mCol > 0); }
-
-double SQLiteColumn::asDouble() 
-{ 
-	return sqlite3_column_double(mStatement->native(), mCol); 
-}
-
-int32_t SQLiteColumn::asInt() 
-{ 
-	return sqlite3_column_int(mStatement->native(), mCol); 
-}
-
-int64_t SQLiteColumn::asInt64() 
-{ 
-	return sqlite3_column_int64(mStatement->native(), mCol); 
+static bool starts_with(const std::string& str, const char* prefix)
+{
+	return str.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
 }
 
-std::string SQLiteColumn::asString() 
-{ 
-	const uint8_t* data = sqlite3_column_text(mStatement->native(), mCol);
-	return std::string(reinterpret_cast<const char*>(data)); 
+/**
+ * Returns the table name of a full scan step or an empty string if the step is not a table scan
+ * Handles both "SCAN TABLE t ..." (before 3.36) and "SCAN t ..." detail formats
+ */
+static std::string scanned_table(const std::string& detail)
+{
+	if(!starts_with(detail, "SCAN ")) { return std::string(); }
+	size_t begin = 5;
+	if(detail.compare(begin, 6, "TABLE ") == 0) { begin += 6; }
+	if( (detail.compare(begin, 8, "SUBQUERY") == 0) || (detail.compare(begin, 8, "CONSTANT") == 0) || (detail.compare(begin, 1, "(") == 0) ) 
+	{ return std::string(); }
+	return detail.substr(begin, detail.find(' ', begin) - begin);
 }
 
 std::wstring SQLiteColumn::asWString() 
@@ -63,17 +63,22 @@ SQLiteRow::SQLiteRow(const SQLiteStmt_sptr& stmt)
 	, mColumn(nullptr, 0)
 {}
 
-SQLiteColumn& SQLiteRow::operator[]( const size_t index ) noexcept
-{
-	mColumn = SQLiteColumn(mStatement, index);
-	return mColumn;
-}
-
 SQLiteStatement::SQLiteStatement(int error_code, sqlite3_stmt* stmt)
 	: mErrorCode(static_cast<SQLiteCode::Enum>(error_code))
 	, mStatement(stmt)
 	, mNextIndex(1)
 	, mIsEvaluated(false)
+	, mQueryPlan(nullptr)
+	, mSlowQueryLog(nullptr)
+	, mCycleStart()
+	, mCycleRows(-1)
+	, mCycleStepTime(0)
+	, mResultCache(nullptr)
+	, mReadTables()
+	, mChangesSchema(false)
+	, mTraceRecorder(nullptr)
+	, mTraceEvent()
+	, mColumnBatch(nullptr)
 {}
 
 SQLiteStmt_sptr SQLiteStatement::makeShared(int error_code, sqlite3_stmt* stmt)
@@ -84,11 +89,68 @@ SQLiteStmt_sptr SQLiteStatement::makeShared(int error_code, sqlite3_stmt* stmt)
 SQLiteStatement::~SQLiteStatement()
 {
 	if(mStatement != nullptr)
-	{ sqlite3_finalize(mStatement); }
+	{
+		endCycle(SQLITE_ROW);
+		sqlite3_finalize(mStatement);
+	}
+}
+
+void SQLiteStatement::beginCycle()
+{
+	if( (mSlowQueryLog || mTraceRecorder) && (mCycleRows < 0) )
+	{
+		mCycleStart = std::chrono::steady_clock::now();
+		mCycleRows = 0;
+		mCycleStepTime = std::chrono::nanoseconds(0);
+	}
+}
+
+int SQLiteStatement::timedStep()
+{
+	//only the time spent in SQLite counts, a slow consumer between steps does not make a query slow
+	if(mCycleRows < 0) { return sqlite3_step(mStatement); }
+	auto start = std::chrono::steady_clock::now();
+	int result = sqlite3_step(mStatement);
+	mCycleStepTime += std::chrono::steady_clock::now() - start;
+	return result;
+}
+
+void SQLiteStatement::endCycle(int result_code)
+{
+	if(mCycleRows < 0) { return; }
+	auto wall_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mCycleStart);
+	auto latency = mCycleStepTime;
+	if(mSlowQueryLog)
+	{
+		//counters are reset every cycle so they always describe the last one
+		int32_t fullscan_steps = sqlite3_stmt_status(mStatement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+		int32_t sorts = sqlite3_stmt_status(mStatement, SQLITE_STMTSTATUS_SORT, 1);
+		int32_t auto_indexes = sqlite3_stmt_status(mStatement, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+		int32_t vm_steps = sqlite3_stmt_status(mStatement, SQLITE_STMTSTATUS_VM_STEP, 1);
+		if(latency >= mSlowQueryLog->threshold())
+		{
+			char* sql = sqlite3_expanded_sql(mStatement);
+			mSlowQueryLog->push({ (sql != nullptr) ? sql : sqlite3_sql(mStatement), latency, wall_time, mCycleRows
+								, fullscan_steps, sorts, auto_indexes, vm_steps });
+			sqlite3_free(sql);
+		}
+	}
+	if(mTraceRecorder)
+	{
+		mTraceEvent.start = mTraceRecorder->sinceStart(mCycleStart);
+		mTraceEvent.latency = latency;
+		mTraceEvent.rows = mCycleRows;
+		mTraceEvent.result = result_code;
+		mTraceRecorder->record(mTraceEvent);
+	}
+	mCycleRows = -1;
 }
 
-sqlite3_stmt* SQLiteStatement::native() const
-{ return mStatement; }
+SQLiteTraceValue* SQLiteStatement::traceParameter(int32_t index)
+{
+	if( !mTraceRecorder || (index < 1) || (static_cast<size_t>(index) > mTraceEvent.parameters.size()) ) { return nullptr; }
+	return &mTraceEvent.parameters[index - 1];
+}
 
 std::optional<SQLiteRow> SQLiteStatement::step()
 {
@@ -98,13 +160,18 @@ std::optional<SQLiteRow> SQLiteStatement::step()
 		mNextIndex = 1;
 		mIsEvaluated = false;
 	}
-	auto error_code = static_cast<SQLiteCode::Enum>(sqlite3_step(mStatement));
+	beginCycle();
+	auto error_code = static_cast<SQLiteCode::Enum>(timedStep());
 	mErrorCode = SQLiteCode::OK;
 	if(error_code != SQLiteCode::ROW)
 	{ 
 		mIsEvaluated = true;
 		mErrorCode = (error_code == SQLiteCode::DONE) ? SQLiteCode::OK : error_code;
+		endCycle(error_code);
 	}
+	else if(mCycleRows >= 0)
+	{ ++mCycleRows; }
+	if(mChangesSchema && mResultCache) { mResultCache->clear(); }
 	return (error_code == SQLiteCode::ROW) ? std::make_optional<SQLiteRow>(shared_from_this()) : std::nullopt;
 }
 
@@ -118,6 +185,7 @@ void SQLiteStatement::evaluate(const std::function<bool (SQLiteRow&)>& on_row_fe
 			{
 				mIsEvaluated = true; 
 				mErrorCode = SQLiteCode::OK;
+				endCycle(SQLITE_ROW);
 				break; 
 			}
 		}
@@ -126,61 +194,101 @@ void SQLiteStatement::evaluate(const std::function<bool (SQLiteRow&)>& on_row_fe
 
 SQLiteCode::Enum SQLiteStatement::execute()
 {
-	auto error_code = static_cast<SQLiteCode::Enum>(sqlite3_step(mStatement));
+	mCycleRows = -1;
+	beginCycle();
+	auto error_code = static_cast<SQLiteCode::Enum>(timedStep());
+	if( (error_code == SQLiteCode::ROW) && (mCycleRows >= 0) ) { mCycleRows = 1; }
+	endCycle(error_code);
 	mNextIndex = 1;
 	mIsEvaluated = false;
 	sqlite3_reset(mStatement);
+	if(mChangesSchema && mResultCache) { mResultCache->clear(); }
 	return error_code;
 }
 
-SQLiteStatement& SQLiteStatement::bind(double value, int32_t index) 
-{ 
-	if(mStatement != nullptr)
+SQLiteResultSet_sptr SQLiteStatement::fetchAll()
+{
+	if(mStatement == nullptr) { return nullptr; }
+	//a statement stopped on a row would only return and cache the rows left
+	resetIfStepped();
+	std::string key;
+	const bool cached = mResultCache && sqlite3_stmt_readonly(mStatement);
+	if(cached)
 	{
-		if(index == NEXT_INDEX) { index = mNextIndex++; }
-		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_double(mStatement, index, value));
+		char* sql = sqlite3_expanded_sql(mStatement);
+		if(sql != nullptr) { key = sql; }
+		sqlite3_free(sql);
+		if(auto hit = mResultCache->find(key))
+		{
+			mNextIndex = 1;
+			mErrorCode = SQLiteCode::OK;
+			return hit;
+		}
 	}
-	return *this; 
-}
 
-SQLiteStatement& SQLiteStatement::bind(int32_t value, int32_t index) 
-{ 	
-	if(mStatement != nullptr)
+	auto result = std::make_shared<SQLiteResultSet>();
+	mCycleRows = -1;
+	beginCycle();
+	int error_code = SQLITE_ROW;
+	while( (error_code = timedStep()) == SQLITE_ROW )
 	{
-		if(index == NEXT_INDEX) { index = mNextIndex++; }
-		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_int(mStatement, index, value));
+		result->appendRow(mStatement);
+		if(mCycleRows >= 0) { ++mCycleRows; }
 	}
-	return *this; 
+	endCycle(error_code);
+	mNextIndex = 1;
+	sqlite3_reset(mStatement);
+	mErrorCode = (error_code == SQLITE_DONE) ? SQLiteCode::OK : static_cast<SQLiteCode::Enum>(error_code);
+	if(mErrorCode != SQLiteCode::OK) { return nullptr; }
+	result->shrink();
+	if( cached && !key.empty() ) { mResultCache->insert(key, result, mReadTables); }
+	return result;
 }
 
-SQLiteStatement& SQLiteStatement::bind(int64_t value, int32_t index) 
-{ 
-	if(mStatement != nullptr)
+SQLiteColumnBatch_sptr SQLiteStatement::fetchColumns(size_t batch_size)
+{
+	if(mStatement == nullptr) { return nullptr; }
+	if(mIsEvaluated)
 	{
-		if(index == NEXT_INDEX) { index = mNextIndex++; }
-		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_int64(mStatement, index, value)); 
+		sqlite3_reset(mStatement);
+		mIsEvaluated = false;
 	}
-	return *this; 
-}
-
-SQLiteStatement& SQLiteStatement::bind(const std::string& value, int32_t index)
-{
-	if(mStatement != nullptr)
+	batch_size = std::max<size_t>(batch_size, 1);
+	//a statement that is not running starts a new evaluation, column types are determined again
+	const bool new_evaluation = !sqlite3_stmt_busy(mStatement);
+	if(new_evaluation) { mCycleRows = -1; }
+	std::shared_ptr<SQLiteColumnBatch> batch = mColumnBatch;
+	if( !batch || (batch.use_count() > 2) ) { batch = std::make_shared<SQLiteColumnBatch>(); }
+	batch->begin(mStatement, mColumnBatch.get(), new_evaluation, batch_size);
+	mColumnBatch = batch;
+
+	beginCycle();
+	int error_code = SQLITE_ROW;
+	while( (batch->mRows < batch_size) && ((error_code = timedStep()) == SQLITE_ROW) ) { batch->appendRow(mStatement); }
+	if(mCycleRows >= 0) { mCycleRows += static_cast<int64_t>(batch->mRows); }
+	mErrorCode = SQLiteCode::OK;
+	if(error_code != SQLITE_ROW)
 	{
-		if(index == NEXT_INDEX) { index = mNextIndex++; }
-		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_text(mStatement, index, value.c_str(), value.size(), SQLITE_TRANSIENT)); 
+		endCycle(error_code);
+		mNextIndex = 1;
+		sqlite3_reset(mStatement);
+		batch->mLast = true;
+		if(error_code != SQLITE_DONE)
+		{
+			mErrorCode = static_cast<SQLiteCode::Enum>(error_code);
+			return nullptr;
+		}
 	}
-	return *this; 
+	if(mChangesSchema && mResultCache) { mResultCache->clear(); }
+	return batch;
 }
 
-SQLiteStatement& SQLiteStatement::bindNull(int32_t index) 
-{ 
-	if(mStatement != nullptr)
-	{
-		if(index == NEXT_INDEX) { index = mNextIndex++; }
-		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_null(mStatement, index));
-	}
-	return *this; 
+void SQLiteStatement::reset()
+{
+	endCycle(SQLITE_ROW);
+	sqlite3_reset(mStatement);
+	mNextIndex = 1;
+	mIsEvaluated = false;
 }
 
 SQLiteStatement& SQLiteStatement::bind(double value, const std::string& name) 
@@ -218,19 +326,113 @@ SQLiteStatement& SQLiteStatement::bindNull(const std::string& name)
 	return bindNull(index); 
 }
 
+//percent-encodes the characters with a meaning in URI filenames
+static std::string uri_path(const std::string& path)
+{
+	static const char* HEX = "0123456789ABCDEF";
+	std::string uri("file:");
+	for(unsigned char c : path)
+	{
+		if( (c == '%') || (c == '?') || (c == '#') || (c <= ' ') ) { uri += '%'; uri += HEX[c >> 4]; uri += HEX[c & 0xF]; }
+		else { uri += static_cast<char>(c); }
+	}
+	return uri;
+}
+
+static int open_database(const std::string& path, const SQLiteOpenOptions& options, sqlite3** handle)
+{
+	const char* vfs = options.vfs.empty() ? nullptr : options.vfs.c_str();
+	if(options.immutable)
+	{ return sqlite3_open_v2((uri_path(path) + "?immutable=1").c_str(), handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_URI, vfs); }
+	int flags = options.readOnly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | (options.create ? SQLITE_OPEN_CREATE : 0));
+	return sqlite3_open_v2(path.c_str(), handle, flags, vfs);
+}
+
+/**
+ * Loads the file into the page cache
+ * @return The size of the file or -1 if it cannot be read
+ */
+static int64_t warm_up(const std::string& path, SQLiteWarmUp::Enum mode)
+{
+	struct stat info;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if( (fd < 0) || (fstat(fd, &info) != 0) )
+	{
+		if(fd >= 0) { close(fd); }
+		return -1;
+	}
+	if( (mode == SQLiteWarmUp::POPULATE) && (info.st_size > 0) )
+	{
+		//faulting the pages in through a shared mapping leaves them in the page cache for every process
+		void* image = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+		if(image != MAP_FAILED) { munmap(image, info.st_size); }
+	}
+	else if(mode == SQLiteWarmUp::ADVISE)
+	{ posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED); }
+	close(fd);
+	return info.st_size;
+}
+
 SQLite::SQLite(const std::string& path)
+	: SQLite(path, SQLiteOpenOptions())
+{}
+
+SQLite::SQLite(const std::string& path, const SQLiteOpenOptions& options)
 	: mHandle(nullptr)
-	, mErrorCode(static_cast<SQLiteCode::Enum>(sqlite3_open(path.c_str(), &mHandle)))
+	, mErrorCode(static_cast<SQLiteCode::Enum>(open_database(path, options, &mHandle)))
+	, mCaptureQueryPlans(false)
+	, mLargeTableRows(0)
+	, mOnFlaggedQueryPlan(nullptr)
+	, mQueryPlans()
+	, mQueryPlansSchemaVersion(-1)
+	, mSchemaVersion(nullptr)
+	, mSlowQueryLog(nullptr)
+	, mTraceRecorder(nullptr)
+	, mTraceConnection(0)
+	, mImage(nullptr)
+	, mImageSize(0)
+	, mResultCache(nullptr)
+	, mResultCacheListener(0)
+	, mResultCacheCommitListener(0)
+	, mResultCacheRollbackListener(0)
+	, mUpdateListeners()
+	, mCommitListeners()
+	, mRollbackListeners()
+	, mAuthorizer(nullptr)
+	, mNextListenerId(1)
+	, mCollectTables(false)
+	, mPreparedTables()
+	, mPreparedDdl(false)
 {
 	if(isOpen())
 	{
+		if(SQLiteArena::installed() && (SQLiteArena::config().lookasideSlots > 0))
+		{
+			//lookaside is carved out of the arena heap once, while opening
+			sqlite3_db_config(mHandle, SQLITE_DBCONFIG_LOOKASIDE, nullptr, SQLiteArena::config().lookasideSlotSize, SQLiteArena::config().lookasideSlots);
+		}
 		sqlite3_create_function(mHandle, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0);
+		if(options.immutable)
+		{
+			//mmap_size is capped by SQLITE_MAX_MMAP_SIZE (0x7fff0000 unless compiled otherwise)
+			int64_t file_size = warm_up(path, options.warmUp);
+			int64_t mmap_size = (options.mmapSize > 0) ? options.mmapSize : file_size;
+			if(mmap_size > 0) { execute("PRAGMA mmap_size=" + std::to_string(mmap_size)); }
+		}
 	}
 }
 
 SQLite::~SQLite()
 {
-	if(mHandle != nullptr){ sqlite3_close_v2(mHandle); }
+	//statements may keep the cache alive, it must not touch the connection once closed
+	if(mResultCache) { mResultCache->detach(); }
+	sqlite3_finalize(mSchemaVersion);
+	if(mHandle != nullptr)
+	{
+		//a mapped image is released only if the connection really closed, statements still alive keep it in use
+		if( (mImage != nullptr) && (sqlite3_close(mHandle) == SQLITE_OK) ) { munmap(mImage, mImageSize); }
+		else { sqlite3_close_v2(mHandle); }
+	}
 }
 
 bool SQLite::isOpen() const noexcept
@@ -240,11 +442,52 @@ SQLiteStmt_sptr SQLite::prepare(const std::string& statement)
 {
 	SQLiteCode::Enum error_code = SQLiteCode::CANTOPEN;
 	sqlite3_stmt* stmt = nullptr;
+	const char* tail = nullptr;
 	if(mHandle)
 	{
-		error_code = static_cast<SQLiteCode::Enum>(sqlite3_prepare_v2(mHandle, statement.c_str(), statement.size()+1, &stmt, nullptr));
+		mPreparedTables.clear();
+		mPreparedDdl = false;
+		mCollectTables = (mResultCache != nullptr);
+		error_code = static_cast<SQLiteCode::Enum>(sqlite3_prepare_v2(mHandle, statement.c_str(), statement.size()+1, &stmt, &tail));
+		mCollectTables = false;
+	}
+	auto result = SQLiteStatement::makeShared(error_code, (error_code == SQLiteCode::OK) ? stmt : nullptr);
+	if(mResultCache && (stmt != nullptr))
+	{
+		result->mResultCache = mResultCache;
+		result->mReadTables = mPreparedTables;
+		result->mChangesSchema = mPreparedDdl;
+	}
+	if(mCaptureQueryPlans && (stmt != nullptr))
+	{
+		std::string sql = (tail != nullptr) ? statement.substr(0, tail - statement.c_str()) : statement;
+		//plans explained before a schema change may no longer be the ones SQLite picks
+		const int64_t schema_version = schemaVersion();
+		if( (schema_version != mQueryPlansSchemaVersion) || (mQueryPlans.size() >= MAX_QUERY_PLANS) )
+		{
+			mQueryPlans.clear();
+			mQueryPlansSchemaVersion = schema_version;
+		}
+		auto it = mQueryPlans.find(sql);
+		if(it == mQueryPlans.end())
+		{
+			auto plan = explainQueryPlan(sql);
+			it = mQueryPlans.emplace(sql, plan).first;
+			if(plan && plan->flagged() && mOnFlaggedQueryPlan)
+			{ mOnFlaggedQueryPlan(sql, *plan); }
+		}
+		result->mQueryPlan = it->second;
 	}
-	return SQLiteStatement::makeShared(error_code, (error_code == SQLiteCode::OK) ? stmt : nullptr);
+	if(stmt != nullptr)
+	{ result->mSlowQueryLog = mSlowQueryLog; }
+	if(mTraceRecorder && (stmt != nullptr))
+	{
+		result->mTraceRecorder = mTraceRecorder;
+		result->mTraceEvent.connection = mTraceConnection;
+		result->mTraceEvent.sql = mTraceRecorder->sqlId(sqlite3_sql(stmt));
+		result->mTraceEvent.parameters.resize(sqlite3_bind_parameter_count(stmt));
+	}
+	return result;
 }
 
 SQLiteCode::Enum SQLite::execute(const std::string& statement)
@@ -252,6 +495,12 @@ SQLiteCode::Enum SQLite::execute(const std::string& statement)
 	SQLiteCode::Enum error_code = SQLiteCode::CANTOPEN;
 	if(mHandle)
 	{
+		//prepare() times the statement and lets the result cache see DDL
+		if(mSlowQueryLog || mTraceRecorder || mResultCache)
+		{ 
+			auto timed = prepare(statement);
+			return (*timed) ? timed->execute() : timed->errorCode(); 
+		}
 		sqlite3_stmt* stmt = nullptr;
 		error_code = static_cast<SQLiteCode::Enum>(sqlite3_prepare_v2(mHandle, statement.c_str(), statement.size()+1, &stmt, nullptr));
 		if(error_code == SQLiteCode::OK)
@@ -293,9 +542,342 @@ std::string	SQLite::describeTable(const std::string& table_name)
 	return result;
 }
 
+std::string SQLite::quoteIdentifier(const std::string& name)
+{
+	std::string result = "`";
+	for(char c : name)
+	{
+		if(c == '`') { result += '`'; }
+		result += c;
+	}
+	return result + "`";
+}
+
 SQLiteCode::Enum SQLite::dropTable(const std::string& table_name)
 {
 	return execute("DROP TABLE IF EXISTS`" + table_name + "`;");
 }
 
+void SQLite::captureQueryPlans(bool enabled, const SQLiteQueryPlanCallback& on_flagged, int64_t large_table_rows)
+{
+	mCaptureQueryPlans = enabled;
+	mOnFlaggedQueryPlan = on_flagged;
+	mLargeTableRows = large_table_rows;
+	mQueryPlans.clear();
+}
+
+int64_t SQLite::schemaVersion()
+{
+	if(mSchemaVersion == nullptr) { sqlite3_prepare_v2(mHandle, "PRAGMA schema_version", -1, &mSchemaVersion, nullptr); }
+	if(mSchemaVersion == nullptr) { return -1; }
+	int64_t version = (sqlite3_step(mSchemaVersion) == SQLITE_ROW) ? sqlite3_column_int64(mSchemaVersion, 0) : -1;
+	sqlite3_reset(mSchemaVersion);
+	return version;
+}
+
+void SQLite::setTraceRecorder(const SQLiteTraceRecorder_sptr& recorder)
+{
+	mTraceRecorder = (recorder && recorder->valid()) ? recorder : nullptr;
+	mTraceConnection = mTraceRecorder ? mTraceRecorder->addConnection() : 0;
+}
+
+void SQLite::setSlowQueryThreshold(std::chrono::microseconds threshold, const SQLiteSlowQueryCallback& sink)
+{
+	mSlowQueryLog = (sink != nullptr) ? std::make_shared<SQLiteSlowQueryLog>(threshold, sink) : nullptr;
+}
+
+void SQLite::cacheResults(bool enabled, const SQLiteResultCacheConfig& config)
+{
+	if(mResultCache)
+	{
+		removeUpdateListener(mResultCacheListener);
+		removeCommitListener(mResultCacheCommitListener);
+		removeRollbackListener(mResultCacheRollbackListener);
+		mResultCache->detach();
+		mResultCache = nullptr;
+		updateAuthorizer();
+	}
+	if(!enabled || (mHandle == nullptr)) { return; }
+	mResultCache = std::make_shared<SQLiteResultCache>(mHandle, config);
+	SQLiteResultCache* cache = mResultCache.get();
+	mResultCacheListener = addUpdateListener([cache](int, const char*, const char* table, int64_t) { cache->invalidate(table); });
+	mResultCacheCommitListener = addCommitListener([cache]() { cache->committed(); return true; });
+	mResultCacheRollbackListener = addRollbackListener([cache]() { cache->rolledBack(); });
+	updateAuthorizer();
+}
+
+template<typename Callback>
+static void remove_listener(std::vector<std::pair<int32_t, Callback>>& listeners, int32_t id)
+{
+	for(auto it = listeners.begin(); it != listeners.end(); ++it)
+	{
+		if(it->first == id)
+		{
+			listeners.erase(it);
+			break;
+		}
+	}
+}
+
+int32_t SQLite::addUpdateListener(const SQLiteUpdateCallback& listener)
+{
+	if(mHandle == nullptr) { return 0; }
+	if(mUpdateListeners.empty()) { sqlite3_update_hook(mHandle, &SQLite::onUpdate, this); }
+	mUpdateListeners.emplace_back(mNextListenerId, listener);
+	return mNextListenerId++;
+}
+
+void SQLite::removeUpdateListener(int32_t id)
+{
+	remove_listener(mUpdateListeners, id);
+	if( mUpdateListeners.empty() && (mHandle != nullptr) ) { sqlite3_update_hook(mHandle, nullptr, nullptr); }
+}
+
+int32_t SQLite::addCommitListener(const SQLiteCommitCallback& listener)
+{
+	if(mHandle == nullptr) { return 0; }
+	if(mCommitListeners.empty()) { sqlite3_commit_hook(mHandle, &SQLite::onCommit, this); }
+	mCommitListeners.emplace_back(mNextListenerId, listener);
+	return mNextListenerId++;
+}
+
+void SQLite::removeCommitListener(int32_t id)
+{
+	remove_listener(mCommitListeners, id);
+	if( mCommitListeners.empty() && (mHandle != nullptr) ) { sqlite3_commit_hook(mHandle, nullptr, nullptr); }
+}
+
+int32_t SQLite::addRollbackListener(const SQLiteRollbackCallback& listener)
+{
+	if(mHandle == nullptr) { return 0; }
+	if(mRollbackListeners.empty()) { sqlite3_rollback_hook(mHandle, &SQLite::onRollback, this); }
+	mRollbackListeners.emplace_back(mNextListenerId, listener);
+	return mNextListenerId++;
+}
+
+void SQLite::removeRollbackListener(int32_t id)
+{
+	remove_listener(mRollbackListeners, id);
+	if( mRollbackListeners.empty() && (mHandle != nullptr) ) { sqlite3_rollback_hook(mHandle, nullptr, nullptr); }
+}
+
+void SQLite::setAuthorizer(const SQLiteAuthorizer& authorizer)
+{
+	mAuthorizer = authorizer;
+	updateAuthorizer();
+}
+
+void SQLite::updateAuthorizer()
+{
+	if(mHandle == nullptr) { return; }
+	//the result cache collects the tables read by statements through the authorizer
+	if( mResultCache || mAuthorizer ) { sqlite3_set_authorizer(mHandle, &SQLite::onAuthorize, this); }
+	else { sqlite3_set_authorizer(mHandle, nullptr, nullptr); }
+}
+
+void SQLite::onUpdate(void* context, int operation, const char* schema, const char* table, long long rowid)
+{
+	for(const auto& listener : static_cast<SQLite*>(context)->mUpdateListeners)
+	{ listener.second(operation, schema, table, rowid); }
+}
+
+int SQLite::onCommit(void* context)
+{
+	bool commit = true;
+	for(const auto& listener : static_cast<SQLite*>(context)->mCommitListeners)
+	{ commit = listener.second() && commit; }
+	return commit ? 0 : 1;
+}
+
+void SQLite::onRollback(void* context)
+{
+	for(const auto& listener : static_cast<SQLite*>(context)->mRollbackListeners) { listener.second(); }
+}
+
+int SQLite::onAuthorize(void* context, int action, const char* arg1, const char* arg2, const char* schema, const char* trigger)
+{
+	SQLite* self = static_cast<SQLite*>(context);
+	//the authorizer of the application decides, tables and DDL are collected for the result cache regardless
+	const int result = self->mAuthorizer ? self->mAuthorizer(action, arg1, arg2, schema, trigger) : SQLITE_OK;
+	if(!self->mCollectTables) { return result; }
+	switch(action)
+	{
+		case SQLITE_READ:
+			if( (arg1 != nullptr) && (std::find(self->mPreparedTables.begin(), self->mPreparedTables.end(), arg1) == self->mPreparedTables.end()) )
+			{ self->mPreparedTables.emplace_back(arg1); }
+			break;
+		case SQLITE_CREATE_INDEX: case SQLITE_CREATE_TABLE: case SQLITE_CREATE_TEMP_INDEX: case SQLITE_CREATE_TEMP_TABLE:
+		case SQLITE_CREATE_TEMP_TRIGGER: case SQLITE_CREATE_TEMP_VIEW: case SQLITE_CREATE_TRIGGER: case SQLITE_CREATE_VIEW:
+		case SQLITE_DROP_INDEX: case SQLITE_DROP_TABLE: case SQLITE_DROP_TEMP_INDEX: case SQLITE_DROP_TEMP_TABLE:
+		case SQLITE_DROP_TEMP_TRIGGER: case SQLITE_DROP_TEMP_VIEW: case SQLITE_DROP_TRIGGER: case SQLITE_DROP_VIEW:
+		case SQLITE_ALTER_TABLE: case SQLITE_ATTACH: case SQLITE_DETACH: case SQLITE_CREATE_VTABLE: case SQLITE_DROP_VTABLE:
+			self->mPreparedDdl = true;
+			break;
+		default:
+			break;
+	}
+	return result;
+}
+
+std::vector<SQLiteIoCounters> SQLite::ioStats() const
+{
+	std::vector<SQLiteIoCounters> result;
+	const char* file_name = (mHandle != nullptr) ? sqlite3_db_filename(mHandle, "main") : nullptr;
+	if( (file_name != nullptr) && (file_name[0] != '\0') )
+	{
+		for(const char* suffix : { "", "-journal", "-wal" })
+		{ result.emplace_back(SQLiteIoStatsVfs::counters(std::string(file_name) + suffix)); }
+	}
+	return result;
+}
+
+std::unique_ptr<SQLite> SQLite::openInMemoryFrom(const std::string& path, bool read_only)
+{
+	std::unique_ptr<SQLite> db(new SQLite(":memory:"));
+	if(!db->isOpen()) { return db; }
+
+	struct stat info;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if( (fd < 0) || (fstat(fd, &info) != 0) )
+	{
+		if(fd >= 0) { close(fd); }
+		db->mErrorCode = SQLiteCode::CANTOPEN;
+		return db;
+	}
+	const size_t size = static_cast<size_t>(info.st_size);
+	if(size == 0)
+	{
+		close(fd);
+		return db;
+	}
+
+	int error_code = SQLITE_OK;
+	if(read_only)
+	{
+		//private writable mapping: patching the header below copies only its first page
+		void* image = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		close(fd);
+		if(image == MAP_FAILED)
+		{
+			db->mErrorCode = SQLiteCode::NOMEM;
+			return db;
+		}
+		//a WAL mode header (file format versions 2) would make the in-memory database look for a WAL
+		unsigned char* header = static_cast<unsigned char*>(image);
+		if( (size > 19) && (header[18] == 2) ) { header[18] = header[19] = 1; }
+		error_code = sqlite3_deserialize(db->mHandle, "main", header, size, size, SQLITE_DESERIALIZE_READONLY);
+		if(error_code == SQLITE_OK)
+		{
+			db->mImage = image;
+			db->mImageSize = size;
+			//pages are handed out straight from the image instead of being copied into the page cache
+			db->execute("PRAGMA mmap_size=" + std::to_string(size));
+		}
+		else { munmap(image, size); }
+	}
+	else
+	{
+		unsigned char* image = static_cast<unsigned char*>(sqlite3_malloc64(size));
+		size_t done = 0;
+		while( (image != nullptr) && (done < size) )
+		{
+			ssize_t result = read(fd, image + done, size - done);
+			if( (result < 0) && (errno == EINTR) ) { continue; }
+			if(result <= 0) { break; }
+			done += result;
+		}
+		close(fd);
+		if( (image == nullptr) || (done != size) )
+		{
+			sqlite3_free(image);
+			db->mErrorCode = (image == nullptr) ? SQLiteCode::NOMEM : SQLiteCode::IOERR;
+			return db;
+		}
+		if( (size > 19) && (image[18] == 2) ) { image[18] = image[19] = 1; }
+		//on failure the buffer is released by sqlite3_deserialize itself
+		error_code = sqlite3_deserialize(db->mHandle, "main", image, size, size, SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+	}
+	//reading the schema rejects files that are no database
+	if(error_code == SQLITE_OK)
+	{ error_code = sqlite3_exec(db->mHandle, "SELECT count(*) FROM sqlite_master", nullptr, nullptr, nullptr); }
+	db->mErrorCode = static_cast<SQLiteCode::Enum>(error_code);
+	return db;
+}
+
+std::vector<uint8_t> SQLite::serialize(const std::string& schema) const
+{
+	std::vector<uint8_t> result;
+	if(mHandle == nullptr) { return result; }
+	sqlite3_int64 size = 0;
+	//in-memory databases are returned without an intermediate copy
+	unsigned char* data = sqlite3_serialize(mHandle, schema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY);
+	if(data != nullptr) { return std::vector<uint8_t>(data, data + size); }
+	data = sqlite3_serialize(mHandle, schema.c_str(), &size, 0);
+	if(data != nullptr)
+	{
+		result.assign(data, data + size);
+		sqlite3_free(data);
+	}
+	return result;
+}
+
+SQLiteQueryPlan_sptr SQLite::explainQueryPlan(const std::string& sql)
+{
+	sqlite3_stmt* stmt = nullptr;
+	std::string explain = "EXPLAIN QUERY PLAN " + sql;
+	if(sqlite3_prepare_v2(mHandle, explain.c_str(), explain.size()+1, &stmt, nullptr) != SQLITE_OK)
+	{ 
+		if(stmt != nullptr) { sqlite3_finalize(stmt); }
+		return nullptr; 
+	}
+	auto plan = std::make_shared<SQLiteQueryPlan>();
+	while(sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		const unsigned char* detail = sqlite3_column_text(stmt, 3);
+		plan->steps.push_back({ sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1)
+							  , (detail != nullptr) ? reinterpret_cast<const char*>(detail) : "" });
+	}
+	sqlite3_finalize(stmt);
+
+	for(const auto& step : plan->steps)
+	{
+		if(starts_with(step.detail, "USE TEMP B-TREE"))
+		{
+			plan->warnings.emplace_back(step.detail);
+			continue;
+		}
+		std::string table_name = scanned_table(step.detail);
+		if(!table_name.empty())
+		{
+			int64_t rows = (mLargeTableRows > 0) ? estimateTableRows(table_name) : 0;
+			if( (rows < 0) || (rows >= mLargeTableRows) )
+			{ plan->warnings.emplace_back(step.detail); }
+		}
+	}
+	return plan;
+}
+
+int64_t SQLite::estimateTableRows(const std::string& table_name)
+{
+	//sqlite_stat1 is only present after ANALYZE, max(rowid) is a single b-tree descent otherwise
+	static const char* queries[] = { "SELECT `stat` FROM `sqlite_stat1` WHERE `tbl` = ?1 LIMIT 1"
+								   , "SELECT max(`rowid`) FROM " };
+	int64_t rows = -1;
+	for(size_t i = 0; (i < 2) && (rows < 0); ++i)
+	{
+		sqlite3_stmt* stmt = nullptr;
+		std::string sql = (i == 0) ? std::string(queries[i]) : (queries[i] + quoteIdentifier(table_name));
+		if(sqlite3_prepare_v2(mHandle, sql.c_str(), sql.size()+1, &stmt, nullptr) == SQLITE_OK)
+		{
+			if(i == 0) { sqlite3_bind_text(stmt, 1, table_name.c_str(), table_name.size(), SQLITE_TRANSIENT); }
+			if( (sqlite3_step(stmt) == SQLITE_ROW) && (sqlite3_column_type(stmt, 0) != SQLITE_NULL) )
+			{ rows = sqlite3_column_int64(stmt, 0); }
+			else if(i == 1)
+			{ rows = 0; }
+		}
+		if(stmt != nullptr) { sqlite3_finalize(stmt); }
+	}
+	return rows;
+}
+
 }
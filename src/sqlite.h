@@ -5,28 +5,69 @@
 #include <vector>
 #include <memory>
 #include <functional>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 #include "sqlite_error_code.h"
-//pre-declarations
-struct sqlite3;
-struct sqlite3_stmt;
+#include "sqlite_slow_query_log.h"
+#include "sqlite_io_stats.h"
+#include "sqlite_result_cache.h"
+#include "sqlite_trace.h"
+#include "sqlite_column_batch.h"
+#include <sqlite3.h>//the hot accessors below are inline so column reads and binds compile into the caller
 
 namespace database
 {
 	class SQLiteStatement;
 	using SQLiteStmt_sptr = std::shared_ptr<SQLiteStatement>;
 
+	struct SQLiteQueryPlan
+	{
+		struct Step
+		{
+			int32_t		id;
+			int32_t		parent;
+			std::string	detail;
+		};
+		std::vector<Step>			steps;
+		/**
+		 * Details of the steps flagged as full scan over a large table or temp b-tree usage
+		 */
+		std::vector<std::string>	warnings;
+		inline bool flagged() const { return !warnings.empty(); }
+	};
+	using SQLiteQueryPlan_sptr = std::shared_ptr<const SQLiteQueryPlan>;
+	using SQLiteQueryPlanCallback = std::function<void (const std::string& sql, const SQLiteQueryPlan& plan)>;
+	/**
+	 * Row change of a connection, operation is SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE
+	 */
+	using SQLiteUpdateCallback = std::function<void (int operation, const char* schema, const char* table, int64_t rowid)>;
+	/**
+	 * Called before a transaction of a connection commits, returning false turns the commit into a rollback
+	 */
+	using SQLiteCommitCallback = std::function<bool ()>;
+	using SQLiteRollbackCallback = std::function<void ()>;
+	/**
+	 * Authorizer of a connection, same arguments and result codes as sqlite3_set_authorizer
+	 */
+	using SQLiteAuthorizer = std::function<int (int action, const char* arg1, const char* arg2, const char* schema, const char* trigger)>;
+
 	class SQLiteColumn
 	{
 		SQLiteStmt_sptr mStatement;
 		int32_t			mCol;
 	public:
-		SQLiteColumn(const SQLiteStmt_sptr& stmt, int32_t col);
-		bool valid() const noexcept;
+		SQLiteColumn(const SQLiteStmt_sptr& stmt, int32_t col) : mStatement(stmt), mCol(col) {}
+		inline bool valid() const noexcept { return (mStatement != nullptr) && (mCol > 0); }
 		explicit operator bool() const noexcept { return valid(); }
-		double asDouble();
-		int32_t asInt();
-		int64_t asInt64();
-		std::string asString();
+		inline double asDouble();
+		inline int32_t asInt();
+		inline int64_t asInt64();
+		inline std::string asString();
+		/**
+		 * Returns the text of the column without copying it, valid until the statement steps, resets or converts the column
+		 */
+		inline std::string_view asStringView();
 		std::wstring asWString();//unsupported
 	};
 
@@ -36,17 +77,36 @@ namespace database
 		SQLiteColumn	mColumn;
 	public:
 		SQLiteRow(const SQLiteStmt_sptr& stmt);
-		SQLiteColumn& operator[]( const size_t index ) noexcept;
+		inline SQLiteColumn& operator[]( const size_t index ) noexcept;
 	};
 
 	class SQLiteStatement : public std::enable_shared_from_this<SQLiteStatement>
 	{
+		friend class SQLite;
 	private:
 		SQLiteCode::Enum 	mErrorCode;
 		sqlite3_stmt* 		mStatement;
 		int32_t				mNextIndex;
 		bool				mIsEvaluated;
+		SQLiteQueryPlan_sptr mQueryPlan;
+		SQLiteSlowQueryLog_sptr mSlowQueryLog;
+		std::chrono::steady_clock::time_point mCycleStart;
+		int64_t				mCycleRows;//-1 when no cycle is being timed
+		std::chrono::nanoseconds mCycleStepTime;//spent inside sqlite3_step during the cycle
+		SQLiteResultCache_sptr mResultCache;
+		std::vector<std::string> mReadTables;//tables read by the statement, collected while preparing with a result cache
+		bool				mChangesSchema;
+		SQLiteTraceRecorder_sptr mTraceRecorder;
+		SQLiteTraceEvent	mTraceEvent;//parameters are kept up to date by bind while recording
+		std::shared_ptr<SQLiteColumnBatch> mColumnBatch;//reused by fetchColumns once the caller released it
 		SQLiteStatement(int error_code, sqlite3_stmt* stmt);
+		void beginCycle();
+		void endCycle(int result_code);
+		int timedStep();
+		SQLiteTraceValue* traceParameter(int32_t index);
+		inline void resetIfStepped();
+		void reset();
+		inline int32_t bindIndex(int32_t index);
 	public:
 		static constexpr int32_t NEXT_INDEX = 0;
 		static SQLiteStmt_sptr makeShared(int error_code, sqlite3_stmt* stmt);
@@ -62,7 +122,11 @@ namespace database
 		/**
 		 * Returns the native statement handler
 		 */
-		sqlite3_stmt* native() const; 
+		inline sqlite3_stmt* native() const { return mStatement; }
+		/**
+		 * Returns the query plan captured when the sql was first prepared or nullptr if capturing is disabled
+		 */
+		inline SQLiteQueryPlan_sptr queryPlan() const { return mQueryPlan; }
 		/**
 		 * Evaluates statement by one row
 		 * @return Optionally an SQLiteRow is returned if fetched successfully, otherwise nullopt is returned
@@ -80,15 +144,37 @@ namespace database
 		 * Execute statement without fetching results
 		 */
 		SQLiteCode::Enum execute();
+		/**
+		 * Evaluates the statement and returns every row, the statement can be bound again afterwards
+		 * With a result cache on the connection, read-only statements are answered from the cache without being stepped
+		 * (keyed by the sql with bound parameters expanded), only use it for deterministic sql (no random(), 'now'...)
+		 * @return The result is returned, or nullptr on failure with errorCode() telling why
+		 */
+		SQLiteResultSet_sptr fetchAll();
+		/**
+		 * Evaluates the statement by up to batch_size rows and returns them as typed columns (see SQLiteColumnBatch)
+		 * Call it again for the next rows until the batch returned is last(), the statement is reset by then. The buffers
+		 * of a batch are reused by the next call if the caller no longer holds it.
+		 * @return The batch is returned, or nullptr on failure with errorCode() telling why
+		 */
+		SQLiteColumnBatch_sptr fetchColumns(size_t batch_size = 4096);
 		/**
 		 * Bind functions for adding/changing data to/of the prepared statement
+		 * A statement that was evaluated, or still stands on a row, is reset first (the rows left are dropped and the
+		 * next index restarts at 1), binding it used to fail with SQLITE_MISUSE and keep the old parameters
 		 */
 		//bind by index ?NNN | ?
-		SQLiteStatement& bind(double value, int32_t index = NEXT_INDEX);
-		SQLiteStatement& bind(int32_t value, int32_t index = NEXT_INDEX);
-		SQLiteStatement& bind(int64_t value, int32_t index = NEXT_INDEX);
-		SQLiteStatement& bind(const std::string& value, int32_t index = NEXT_INDEX);
-		SQLiteStatement& bindNull(int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bind(double value, int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bind(int32_t value, int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bind(int64_t value, int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bind(const std::string& value, int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bindNull(int32_t index = NEXT_INDEX);
+		/**
+		 * Binds text or a blob without copying it (SQLITE_STATIC), the bytes must stay unchanged until the statement is
+		 * bound again, reset or destroyed
+		 */
+		inline SQLiteStatement& bindStatic(std::string_view value, int32_t index = NEXT_INDEX);
+		inline SQLiteStatement& bindStaticBlob(const void* data, size_t size, int32_t index = NEXT_INDEX);
 		//bind by name ?AAAA
 		SQLiteStatement& bind(double value, const std::string& name);
 		SQLiteStatement& bind(int32_t value, const std::string& name);
@@ -97,14 +183,170 @@ namespace database
 		SQLiteStatement& bindNull(const std::string& name);
 	};
 
+	double SQLiteColumn::asDouble() { return sqlite3_column_double(mStatement->native(), mCol); }
+
+	int32_t SQLiteColumn::asInt() { return sqlite3_column_int(mStatement->native(), mCol); }
+
+	int64_t SQLiteColumn::asInt64() { return sqlite3_column_int64(mStatement->native(), mCol); }
+
+	std::string SQLiteColumn::asString()
+	{
+		const unsigned char* data = sqlite3_column_text(mStatement->native(), mCol);
+		if(data == nullptr) { return std::string(); }
+		return std::string(reinterpret_cast<const char*>(data), sqlite3_column_bytes(mStatement->native(), mCol));
+	}
+
+	std::string_view SQLiteColumn::asStringView()
+	{
+		const unsigned char* data = sqlite3_column_text(mStatement->native(), mCol);
+		if(data == nullptr) { return std::string_view(); }
+		return std::string_view(reinterpret_cast<const char*>(data), sqlite3_column_bytes(mStatement->native(), mCol));
+	}
+
+	SQLiteColumn& SQLiteRow::operator[]( const size_t index ) noexcept
+	{
+		mColumn = SQLiteColumn(mStatement, index);
+		return mColumn;
+	}
+
+	void SQLiteStatement::resetIfStepped()
+	{
+		//parameters of a statement that ran, or stopped on a row, can only be bound after a reset
+		if(mIsEvaluated || sqlite3_stmt_busy(mStatement)) { reset(); }
+	}
+
+	int32_t SQLiteStatement::bindIndex(int32_t index)
+	{
+		resetIfStepped();
+		return (index == NEXT_INDEX) ? mNextIndex++ : index;
+	}
+
+	SQLiteStatement& SQLiteStatement::bind(double value, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_double(mStatement, index, value));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::FLOAT; traced->real = value; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bind(int32_t value, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_int(mStatement, index, value));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::INTEGER; traced->integer = value; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bind(int64_t value, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_int64(mStatement, index, value));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::INTEGER; traced->integer = value; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bind(const std::string& value, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_text(mStatement, index, value.c_str(), value.size(), SQLITE_TRANSIENT));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::TEXT; traced->bytes = value; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bindNull(int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_null(mStatement, index));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::NULL_VALUE; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bindStatic(std::string_view value, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_text64(mStatement, index, value.data(), value.size(), SQLITE_STATIC, SQLITE_UTF8));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index)) { traced->type = SQLiteValueType::TEXT; traced->bytes = value; }
+		}
+		return *this;
+	}
+
+	SQLiteStatement& SQLiteStatement::bindStaticBlob(const void* data, size_t size, int32_t index)
+	{
+		if(mStatement == nullptr) { return *this; }
+		index = bindIndex(index);
+		mErrorCode = static_cast<SQLiteCode::Enum>(sqlite3_bind_blob64(mStatement, index, data, size, SQLITE_STATIC));
+		if(mTraceRecorder)
+		{
+			if(SQLiteTraceValue* traced = traceParameter(index))
+			{
+				traced->type = SQLiteValueType::BLOB;
+				traced->bytes.assign(static_cast<const char*>(data), size);
+			}
+		}
+		return *this;
+	}
+
+	struct SQLiteWarmUp
+	{
+		enum Enum
+		{
+			NONE,
+			ADVISE,		//posix_fadvise(WILLNEED), the kernel loads the file in the background
+			POPULATE	//the file is mapped with MAP_POPULATE once, the constructor returns when it is in the page cache
+		};
+	};
+
+	struct SQLiteOpenOptions
+	{
+		bool				readOnly = false;
+		bool				create = true;
+		std::string			vfs;//name of a registered VFS (e.g. SQLiteIoStatsVfs::NAME), the default VFS when empty
+		/**
+		 * For files that never change while open: opened read-only with immutable=1 (no locking, no change detection)
+		 * and SQLITE_OPEN_NOMUTEX, so the connection must not be used by several threads at once
+		 * The file is memory-mapped (mmapSize, the whole file when 0), processes mapping it share the page cache
+		 */
+		bool				immutable = false;
+		int64_t				mmapSize = 0;
+		SQLiteWarmUp::Enum	warmUp = SQLiteWarmUp::NONE;
+	};
+
 	class SQLite
 	{
 	public:
 		SQLite(const std::string& path);
+		SQLite(const std::string& path, const SQLiteOpenOptions& options);
 		virtual ~SQLite();
 		//checkers
 		bool isOpen() const noexcept;
 		explicit operator bool() const noexcept { return isOpen(); }
+		/**
+		 * Returns the native connection handler
+		 */
+		inline sqlite3* native() const { return mHandle; }
 		//members functions
 		/**
 		 * Prepare an sql statement for further use
@@ -132,11 +374,126 @@ namespace database
 		 * @return An SQLiteCode is returned
 		 */	 
 		SQLiteCode::Enum dropTable(const std::string& table_name);
+		/**
+		 * Returns the name as a backtick quoted identifier, backticks in the name are doubled
+		 */
+		static std::string quoteIdentifier(const std::string& name);
+		//diagnostics
+		static constexpr size_t MAX_QUERY_PLANS = 4096;
+		/**
+		 * Enables running EXPLAIN QUERY PLAN on the first prepare of each distinct sql
+		 * The plan is cached and shared with every statement prepared from the same sql. Cached plans are dropped when
+		 * the schema version changes (an index dropped or added, by any connection) and once MAX_QUERY_PLANS are cached,
+		 * so the sql is explained and flagged again on its next prepare
+		 * Plans scanning a table of at least large_table_rows rows (or of unknown size) or using a temp b-tree
+		 * are reported through on_flagged together with the sql
+		 */
+		void captureQueryPlans(bool enabled, const SQLiteQueryPlanCallback& on_flagged = nullptr, int64_t large_table_rows = 0);
+		/**
+		 * Logs every step/execute/evaluate cycle spending at least threshold inside sqlite3_step through an asynchronous
+		 * logger, time the caller spends between steps is reported as wallTime only
+		 * Applies to statements prepared afterwards, passing a nullptr sink disables logging
+		 */
+		void setSlowQueryThreshold(std::chrono::microseconds threshold, const SQLiteSlowQueryCallback& sink = SQLiteSlowQueryLog::writeTo(stderr));
+		inline SQLiteSlowQueryLog_sptr slowQueryLog() const { return mSlowQueryLog; }
+		/**
+		 * Records every step/execute/evaluate cycle with its sql, bound parameters and timing into the recorder
+		 * Applies to statements prepared afterwards, several connections can share a recorder, nullptr stops recording
+		 */
+		void setTraceRecorder(const SQLiteTraceRecorder_sptr& recorder);
+		inline SQLiteTraceRecorder_sptr traceRecorder() const { return mTraceRecorder; }
+		/**
+		 * Returns the I/O counters of the database file, its rollback journal and its WAL
+		 * Only files opened through SQLiteIoStatsVfs are counted
+		 */
+		std::vector<SQLiteIoCounters> ioStats() const;
+		//caching
+		/**
+		 * Enables caching the results of SQLiteStatement::fetchAll for statements prepared afterwards
+		 * Disabling drops the cache. The cache relies on the update, commit and rollback hooks and the authorizer of
+		 * the connection, see addUpdateListener.
+		 */
+		void cacheResults(bool enabled, const SQLiteResultCacheConfig& config = SQLiteResultCacheConfig());
+		inline SQLiteResultCache_sptr resultCache() const { return mResultCache; }
+		//hooks
+		/**
+		 * The connection owns sqlite3_update_hook, sqlite3_commit_hook, sqlite3_rollback_hook and sqlite3_set_authorizer
+		 * and dispatches them to the callbacks registered below. Setting them through native() replaces those of the
+		 * connection and breaks the result cache.
+		 */
+		/**
+		 * Registers a callback for every row inserted, updated or deleted through this connection (sqlite3_update_hook)
+		 * @return An id for removeUpdateListener is returned
+		 */
+		int32_t addUpdateListener(const SQLiteUpdateCallback& listener);
+		void removeUpdateListener(int32_t id);
+		/**
+		 * Registers a callback for every commit of this connection (sqlite3_commit_hook)
+		 * @return An id for removeCommitListener is returned
+		 */
+		int32_t addCommitListener(const SQLiteCommitCallback& listener);
+		void removeCommitListener(int32_t id);
+		/**
+		 * Registers a callback for every rollback of this connection (sqlite3_rollback_hook)
+		 * @return An id for removeRollbackListener is returned
+		 */
+		int32_t addRollbackListener(const SQLiteRollbackCallback& listener);
+		void removeRollbackListener(int32_t id);
+		/**
+		 * Sets the authorizer consulted when statements are prepared, nullptr removes it
+		 */
+		void setAuthorizer(const SQLiteAuthorizer& authorizer);
+		//in-memory images
+		/**
+		 * Opens an in-memory database attached to an image of the given file with sqlite3_deserialize
+		 * Queries never go through the VFS, the whole file is loaded up front
+		 * read_only: the file is memory-mapped with MAP_POPULATE and used in place, sharing the OS page cache
+		 * otherwise: the file is bulk-read into SQLite memory, changes are kept in memory only (see serialize())
+		 * The content of a -wal file is not part of the image, checkpoint the database before
+		 * @return A SQLite object is always returned, isOpen() is false on failure
+		 */
+		static std::unique_ptr<SQLite> openInMemoryFrom(const std::string& path, bool read_only = true);
+		/**
+		 * Returns the image of the given schema, the same bytes a database file with its content would hold
+		 * @return An empty vector is returned on failure
+		 */
+		std::vector<uint8_t> serialize(const std::string& schema = "main") const;
 
-		
 	private:
 		sqlite3 * mHandle;
-		const SQLiteCode::Enum mErrorCode;
+		SQLiteCode::Enum mErrorCode;
+		bool mCaptureQueryPlans;
+		int64_t mLargeTableRows;
+		SQLiteQueryPlanCallback mOnFlaggedQueryPlan;
+		std::unordered_map<std::string, SQLiteQueryPlan_sptr> mQueryPlans;
+		int64_t mQueryPlansSchemaVersion;//schema version the cached plans were explained with
+		sqlite3_stmt* mSchemaVersion;//PRAGMA schema_version, prepared on first use
+		SQLiteSlowQueryLog_sptr mSlowQueryLog;
+		SQLiteTraceRecorder_sptr mTraceRecorder;
+		uint32_t mTraceConnection;
+		void* mImage;//memory-mapped database image, owned by the connection
+		size_t mImageSize;
+		SQLiteResultCache_sptr mResultCache;
+		int32_t mResultCacheListener;
+		int32_t mResultCacheCommitListener;
+		int32_t mResultCacheRollbackListener;
+		std::vector<std::pair<int32_t, SQLiteUpdateCallback>> mUpdateListeners;
+		std::vector<std::pair<int32_t, SQLiteCommitCallback>> mCommitListeners;
+		std::vector<std::pair<int32_t, SQLiteRollbackCallback>> mRollbackListeners;
+		SQLiteAuthorizer mAuthorizer;
+		int32_t mNextListenerId;
+		bool mCollectTables;//set while preparing, tables read are collected by the authorizer
+		std::vector<std::string> mPreparedTables;
+		bool mPreparedDdl;
+
+		SQLiteQueryPlan_sptr explainQueryPlan(const std::string& sql);
+		int64_t schemaVersion();
+		int64_t estimateTableRows(const std::string& table_name);
+		void updateAuthorizer();
+		static void onUpdate(void* context, int operation, const char* schema, const char* table, long long rowid);
+		static int onCommit(void* context);
+		static void onRollback(void* context);
+		static int onAuthorize(void* context, int action, const char* arg1, const char* arg2, const char* schema, const char* trigger);
 	};
 }
 
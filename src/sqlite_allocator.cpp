@@ -0,0 +1,277 @@
+#include "sqlite_allocator.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+namespace database
+{
+
+namespace
+{
+	constexpr size_t	HEADER_SIZE = 8;
+	constexpr size_t	LARGE_HEADER_SIZE = 16;
+	constexpr uint32_t	LARGE_CLASS = 0xFFFFFFFFu;
+	constexpr size_t	MAX_CLASSES = 64;
+	constexpr size_t	SMALL_LIMIT = 1024;
+	constexpr size_t	THREAD_CACHE_BYTES = 128 * 1024;
+	constexpr size_t	SPAN_BYTES = 64 * 1024;
+
+	struct Block
+	{
+		Block* next;
+	};
+
+	struct SizeClasses
+	{
+		size_t	sizes[MAX_CLASSES];
+		size_t	count;
+		uint8_t	small[SMALL_LIMIT / 16 + 1];//class index by (size + 15) / 16
+
+		SizeClasses() : sizes(), count(0), small()
+		{
+			//16 byte steps for tiny objects, then four classes per doubling
+			for(size_t size = 16; size <= 128; size += 16) { sizes[count++] = size; }
+			for(size_t base = 128; base < 65536; base *= 2)
+			{
+				for(size_t step = 1; step <= 4; ++step) { sizes[count++] = base + base * step / 4; }
+			}
+			//page buffers are page size plus the pager's and page cache's per-page headers
+			for(size_t page = 1024; page <= 65536; page *= 2) { sizes[count++] = page + 512; }
+			std::sort(sizes, sizes + count);
+			count = std::unique(sizes, sizes + count) - sizes;
+			for(size_t i = 0; i <= SMALL_LIMIT / 16; ++i)
+			{ small[i] = static_cast<uint8_t>(std::lower_bound(sizes, sizes + count, i * 16) - sizes); }
+		}
+
+		inline size_t lookup(size_t size) const
+		{
+			if(size <= SMALL_LIMIT) { return small[(size + 15) >> 4]; }
+			return std::lower_bound(sizes, sizes + count, size) - sizes;
+		}
+
+		inline size_t largest() const { return sizes[count - 1]; }
+	};
+
+	struct CentralList
+	{
+		std::mutex	mutex;
+		Block*		head = nullptr;
+	};
+
+	struct ThreadCache
+	{
+		Block*	heads[MAX_CLASSES] = {};
+		size_t	counts[MAX_CLASSES] = {};
+		~ThreadCache();
+	};
+
+	const SizeClasses			gClasses;
+	std::atomic<uint64_t>		gSystemAllocations(0);
+	std::atomic<uint64_t>		gSystemBytes(0);
+	std::atomic<uint64_t>		gLargeAllocations(0);
+	thread_local bool			tCacheDestroyed = false;
+
+	CentralList* central()
+	{
+		//never destroyed, threads may still free while static destructors run
+		static CentralList* lists = new CentralList[MAX_CLASSES];
+		return lists;
+	}
+
+	inline size_t block_size(size_t class_index) { return gClasses.sizes[class_index] + HEADER_SIZE; }
+
+	inline size_t thread_cache_limit(size_t class_index)
+	{ return std::max<size_t>(8, THREAD_CACHE_BYTES / block_size(class_index)); }
+
+	void release_to_central(size_t class_index, Block* head, Block* tail)
+	{
+		CentralList& list = central()[class_index];
+		std::lock_guard<std::mutex> lock(list.mutex);
+		tail->next = list.head;
+		list.head = head;
+	}
+
+	/**
+	 * Moves up to count blocks from the central list to the returned chain, carving a new span if it is empty
+	 */
+	Block* acquire_from_central(size_t class_index, size_t count, size_t& acquired)
+	{
+		CentralList& list = central()[class_index];
+		{
+			std::lock_guard<std::mutex> lock(list.mutex);
+			if(list.head != nullptr)
+			{
+				Block* head = list.head;
+				Block* tail = head;
+				acquired = 1;
+				while( (acquired < count) && (tail->next != nullptr) ) { tail = tail->next; ++acquired; }
+				list.head = tail->next;
+				tail->next = nullptr;
+				return head;
+			}
+		}
+		const size_t size = block_size(class_index);
+		const size_t blocks = std::max<size_t>(count, SPAN_BYTES / size);
+		char* span = static_cast<char*>(malloc(blocks * size));
+		if(span == nullptr) { acquired = 0; return nullptr; }
+		gSystemAllocations.fetch_add(1, std::memory_order_relaxed);
+		gSystemBytes.fetch_add(blocks * size, std::memory_order_relaxed);
+		for(size_t i = 0; i < blocks; ++i)
+		{
+			reinterpret_cast<uint32_t*>(span + i * size)[0] = static_cast<uint32_t>(class_index);
+			reinterpret_cast<Block*>(span + i * size + HEADER_SIZE)->next = (i + 1 < blocks) ? reinterpret_cast<Block*>(span + (i + 1) * size + HEADER_SIZE) : nullptr;
+		}
+		Block* head = reinterpret_cast<Block*>(span + HEADER_SIZE);
+		if(blocks > count)
+		{
+			Block* rest = reinterpret_cast<Block*>(span + count * size + HEADER_SIZE);
+			reinterpret_cast<Block*>(span + (count - 1) * size + HEADER_SIZE)->next = nullptr;
+			release_to_central(class_index, rest, reinterpret_cast<Block*>(span + (blocks - 1) * size + HEADER_SIZE));
+		}
+		acquired = count;
+		return head;
+	}
+
+	ThreadCache::~ThreadCache()
+	{
+		for(size_t i = 0; i < gClasses.count; ++i)
+		{
+			if(heads[i] == nullptr) { continue; }
+			Block* tail = heads[i];
+			while(tail->next != nullptr) { tail = tail->next; }
+			release_to_central(i, heads[i], tail);
+		}
+		tCacheDestroyed = true;
+	}
+
+	ThreadCache& thread_cache()
+	{
+		static thread_local ThreadCache cache;
+		return cache;
+	}
+
+	inline uint32_t class_of(void* ptr)
+	{ return reinterpret_cast<uint32_t*>(static_cast<char*>(ptr) - HEADER_SIZE)[0]; }
+
+	void* pool_malloc(int size)
+	{
+		if(size <= 0) { size = 1; }
+		if(static_cast<size_t>(size) > gClasses.largest())
+		{
+			const size_t rounded = SQLiteAllocator::roundUp(size);
+			char* raw = static_cast<char*>(malloc(rounded + LARGE_HEADER_SIZE));
+			if(raw == nullptr) { return nullptr; }
+			gSystemAllocations.fetch_add(1, std::memory_order_relaxed);
+			gSystemBytes.fetch_add(rounded + LARGE_HEADER_SIZE, std::memory_order_relaxed);
+			gLargeAllocations.fetch_add(1, std::memory_order_relaxed);
+			reinterpret_cast<uint64_t*>(raw)[0] = static_cast<uint64_t>(rounded);
+			reinterpret_cast<uint32_t*>(raw + LARGE_HEADER_SIZE - HEADER_SIZE)[0] = LARGE_CLASS;
+			return raw + LARGE_HEADER_SIZE;
+		}
+		size_t class_index = gClasses.lookup(size);
+		if(tCacheDestroyed)
+		{
+			size_t acquired = 0;
+			return acquire_from_central(class_index, 1, acquired);
+		}
+		ThreadCache& cache = thread_cache();
+		Block* block = cache.heads[class_index];
+		if(block == nullptr)
+		{
+			size_t acquired = 0;
+			block = acquire_from_central(class_index, thread_cache_limit(class_index) / 2, acquired);
+			if(block == nullptr) { return nullptr; }
+			cache.counts[class_index] += acquired;
+		}
+		cache.heads[class_index] = block->next;
+		--cache.counts[class_index];
+		return block;
+	}
+
+	void pool_free(void* ptr)
+	{
+		if(ptr == nullptr) { return; }
+		uint32_t class_index = class_of(ptr);
+		if(class_index == LARGE_CLASS)
+		{
+			free(static_cast<char*>(ptr) - LARGE_HEADER_SIZE);
+			return;
+		}
+		Block* block = static_cast<Block*>(ptr);
+		if(tCacheDestroyed)
+		{
+			release_to_central(class_index, block, block);
+			return;
+		}
+		ThreadCache& cache = thread_cache();
+		block->next = cache.heads[class_index];
+		cache.heads[class_index] = block;
+		const size_t limit = thread_cache_limit(class_index);
+		if(++cache.counts[class_index] > limit)
+		{
+			//hand half of the cached blocks back so other threads can reuse them
+			Block* tail = block;
+			for(size_t i = 1; i < limit / 2; ++i) { tail = tail->next; }
+			cache.heads[class_index] = tail->next;
+			tail->next = nullptr;
+			cache.counts[class_index] -= limit / 2;
+			release_to_central(class_index, block, tail);
+		}
+	}
+
+	int pool_size(void* ptr)
+	{
+		if(ptr == nullptr) { return 0; }
+		uint32_t class_index = class_of(ptr);
+		if(class_index == LARGE_CLASS)
+		{ return static_cast<int>(reinterpret_cast<uint64_t*>(static_cast<char*>(ptr) - LARGE_HEADER_SIZE)[0]); }
+		return static_cast<int>(gClasses.sizes[class_index]);
+	}
+
+	void* pool_realloc(void* ptr, int size)
+	{
+		int usable = pool_size(ptr);
+		if( (size <= usable) && (static_cast<int>(SQLiteAllocator::roundUp(size)) == usable) ) { return ptr; }
+		void* result = pool_malloc(size);
+		if(result != nullptr)
+		{
+			memcpy(result, ptr, std::min(usable, size));
+			pool_free(ptr);
+		}
+		return result;
+	}
+
+	int pool_roundup(int size)
+	{ return static_cast<int>(SQLiteAllocator::roundUp(size)); }
+
+	int pool_init(void*) { return SQLITE_OK; }
+
+	void pool_shutdown(void*) {}
+}
+
+SQLiteCode::Enum SQLiteAllocator::install(bool disable_memstatus)
+{
+	static const sqlite3_mem_methods methods = { &pool_malloc, &pool_free, &pool_realloc, &pool_size, &pool_roundup, &pool_init, &pool_shutdown, nullptr };
+	int error_code = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+	if( (error_code == SQLITE_OK) && disable_memstatus )
+	{ error_code = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0); }
+	return static_cast<SQLiteCode::Enum>(error_code);
+}
+
+SQLiteAllocator::Stats SQLiteAllocator::stats()
+{
+	return { gSystemAllocations.load(std::memory_order_relaxed)
+		   , gSystemBytes.load(std::memory_order_relaxed)
+		   , gLargeAllocations.load(std::memory_order_relaxed) };
+}
+
+size_t SQLiteAllocator::roundUp(size_t size)
+{
+	if(size > gClasses.largest()) { return (size + 7) & ~static_cast<size_t>(7); }
+	return gClasses.sizes[gClasses.lookup(size)];
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_ALLOCATOR_H_
+#define COMPONENTS_DATABASE_SQLITE_ALLOCATOR_H_
+
+#include <cstdint>
+#include <cstddef>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	/**
+	 * Thread-caching size-class pool installed as SQLite's memory allocator (SQLITE_CONFIG_MALLOC)
+	 * Small objects and page-sized buffers are served from per-thread free lists, which are refilled
+	 * from per-class central lists in batches, so the global allocator is only reached to carve new spans
+	 * Memory is kept in the pool once allocated, only blocks larger than the biggest class go back to the system
+	 */
+	class SQLiteAllocator
+	{
+	public:
+		struct Stats
+		{
+			uint64_t systemAllocations;	//spans and large blocks requested from the system allocator
+			uint64_t systemBytes;		//bytes requested from the system allocator
+			uint64_t largeAllocations;	//allocations bigger than the largest size class
+		};
+		/**
+		 * Installs the allocator, must be called before the first connection is opened (or after sqlite3_shutdown)
+		 * @param disable_memstatus Also turns off SQLITE_CONFIG_MEMSTATUS, which serializes every allocation on a global mutex
+		 * @return An SQLiteCode is returned, MISUSE if SQLite is already initialized
+		 */
+		static SQLiteCode::Enum install(bool disable_memstatus = false);
+		static Stats stats();
+		/**
+		 * Returns the usable size of the class serving an allocation of size bytes
+		 */
+		static size_t roundUp(size_t size);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_ALLOCATOR_H_ */
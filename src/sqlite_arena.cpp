@@ -0,0 +1,89 @@
+#include "sqlite_arena.h"
+#include <sqlite3.h>
+#include <sys/mman.h>
+#include <climits>
+
+namespace database
+{
+
+static SQLiteArenaConfig	gArenaConfig;
+static bool					gArenaInstalled = false;
+
+/**
+ * Maps size bytes of prefaulted anonymous memory, on huge pages if requested and available
+ * @param mapped Set to the length mapped, the one to unmap, a whole number of huge pages when they are used
+ */
+static void* map_arena(size_t size, bool huge_pages, size_t& mapped)
+{
+	void* memory = MAP_FAILED;
+	if(huge_pages)
+	{
+		const size_t huge_page = 2 * 1024 * 1024;
+		mapped = (size + huge_page - 1) & ~(huge_page - 1);
+		memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	}
+	if(memory == MAP_FAILED)
+	{
+		mapped = size;
+		memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if( huge_pages && (memory != MAP_FAILED) ) { madvise(memory, size, MADV_HUGEPAGE); }
+#endif
+	}
+	return (memory == MAP_FAILED) ? nullptr : memory;
+}
+
+SQLiteCode::Enum SQLiteArena::install(const SQLiteArenaConfig& config)
+{
+	if(gArenaInstalled) { return SQLiteCode::MISUSE; }
+	if( (config.heapSize == 0) || (config.heapSize > static_cast<size_t>(INT_MAX)) ) { return SQLiteCode::RANGE; }
+
+	int header_size = 0;
+	sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header_size);
+	const size_t slot_size = (config.pageCount > 0) ? static_cast<size_t>(config.pageSize + header_size) : 0;
+	const size_t page_cache_size = slot_size * config.pageCount;
+
+	size_t mapped = 0;
+	char* arena = static_cast<char*>(map_arena(config.heapSize + page_cache_size, config.hugePages, mapped));
+	if(arena == nullptr) { return SQLiteCode::NOMEM; }
+
+	//SQLITE_STATUS_* counters are only maintained with memstatus enabled
+	int error_code = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 1);
+	if(error_code == SQLITE_OK)
+	{ error_code = sqlite3_config(SQLITE_CONFIG_HEAP, arena, static_cast<int>(config.heapSize), config.minAllocation); }
+	const bool heap_installed = (error_code == SQLITE_OK);
+	if( (error_code == SQLITE_OK) && (config.pageCount > 0) )
+	{ error_code = sqlite3_config(SQLITE_CONFIG_PAGECACHE, arena + config.heapSize, static_cast<int>(slot_size), config.pageCount); }
+	if(error_code != SQLITE_OK)
+	{
+		//SQLite must not keep allocating from the arena once it is unmapped, a null heap restores the system allocator
+		if(heap_installed) { sqlite3_config(SQLITE_CONFIG_HEAP, nullptr, 0, 0); }
+		munmap(arena, mapped);
+		return static_cast<SQLiteCode::Enum>(error_code);
+	}
+	gArenaConfig = config;
+	gArenaInstalled = true;
+	return SQLiteCode::OK;
+}
+
+bool SQLiteArena::installed()
+{ return gArenaInstalled; }
+
+const SQLiteArenaConfig& SQLiteArena::config()
+{ return gArenaConfig; }
+
+SQLiteMemoryStatus SQLiteArena::status(bool reset_highwater)
+{
+	auto read = [reset_highwater](int op)
+	{
+		SQLiteMemoryStatus::Value value = { 0, 0 };
+		sqlite3_int64 current = 0, highwater = 0;
+		if(sqlite3_status64(op, &current, &highwater, reset_highwater ? 1 : 0) == SQLITE_OK)
+		{ value = { current, highwater }; }
+		return value;
+	};
+	return { read(SQLITE_STATUS_MEMORY_USED), read(SQLITE_STATUS_MALLOC_COUNT), read(SQLITE_STATUS_MALLOC_SIZE)
+		   , read(SQLITE_STATUS_PAGECACHE_USED), read(SQLITE_STATUS_PAGECACHE_OVERFLOW), read(SQLITE_STATUS_PAGECACHE_SIZE) };
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_ARENA_H_
+#define COMPONENTS_DATABASE_SQLITE_ARENA_H_
+
+#include <cstdint>
+#include <cstddef>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	struct SQLiteArenaConfig
+	{
+		size_t	heapSize = 64 * 1024 * 1024;//SQLITE_CONFIG_HEAP arena, at most 2 GiB
+		int32_t	minAllocation = 64;			//smallest heap allocation, a power of two
+		int32_t	pageSize = 4096;			//largest page size used by the databases
+		int32_t	pageCount = 2048;			//SQLITE_CONFIG_PAGECACHE slots, 0 to serve pages from the heap arena
+		int32_t	lookasideSlotSize = 1200;	//per connection SQLITE_DBCONFIG_LOOKASIDE, 0 slots to disable
+		int32_t	lookasideSlots = 128;
+		bool	hugePages = false;			//back the arena with MAP_HUGETLB, falls back to MADV_HUGEPAGE
+	};
+
+	struct SQLiteMemoryStatus
+	{
+		struct Value
+		{
+			int64_t current;
+			int64_t highwater;
+		};
+		Value memoryUsed;		//SQLITE_STATUS_MEMORY_USED
+		Value mallocCount;		//SQLITE_STATUS_MALLOC_COUNT
+		Value mallocSize;		//SQLITE_STATUS_MALLOC_SIZE, highwater is the largest request
+		Value pageCacheUsed;	//SQLITE_STATUS_PAGECACHE_USED, in pages
+		Value pageCacheOverflow;//SQLITE_STATUS_PAGECACHE_OVERFLOW, bytes not fitting into the page cache buffer
+		Value pageCacheSize;	//SQLITE_STATUS_PAGECACHE_SIZE, highwater is the largest page request
+	};
+
+	/**
+	 * Zero-malloc mode: SQLite is handed one preallocated, prefaulted arena for its heap (SQLITE_CONFIG_HEAP)
+	 * and its page cache (SQLITE_CONFIG_PAGECACHE), every connection opened afterwards gets its lookaside from the heap
+	 * SQLITE_CONFIG_HEAP requires the amalgamation to be built with SQLITE_ENABLE_MEMSYS5
+	 */
+	class SQLiteArena
+	{
+	public:
+		/**
+		 * Maps the arena and installs it, must be called before the first connection is opened
+		 * Excludes SQLiteAllocator, only one of them can be installed
+		 * @return An SQLiteCode is returned, MISUSE if SQLite is already initialized, NOMEM if the arena can not be mapped
+		 */
+		static SQLiteCode::Enum install(const SQLiteArenaConfig& config = SQLiteArenaConfig());
+		static bool installed();
+		static const SQLiteArenaConfig& config();
+		/**
+		 * Reads the global counters through sqlite3_status64
+		 * @param reset_highwater Resets the high-water marks to the current values after reading them
+		 */
+		static SQLiteMemoryStatus status(bool reset_highwater = false);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_ARENA_H_ */
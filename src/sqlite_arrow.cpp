@@ -0,0 +1,505 @@
+#include "sqlite_arrow.h"
+#include "sqlite_bulk_insert.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace database
+{
+
+static const int64_t EMPTY_BUFFER[2] = { 0, 0 };//arrays of no rows still point their buffers somewhere
+
+static const char* arrow_format(SQLiteValueType::Enum type)
+{
+	switch(type)
+	{
+		case SQLiteValueType::INTEGER: return "l";
+		case SQLiteValueType::FLOAT: return "g";
+		case SQLiteValueType::BLOB: return "Z";
+		default: return "U";
+	}
+}
+
+template<typename T>
+static const void* buffer_of(const std::vector<T>& values)
+{ return values.empty() ? static_cast<const void*>(EMPTY_BUFFER) : static_cast<const void*>(values.data()); }
+
+/**
+ * Everything an exported record batch points to, shared by the struct array and its children so a consumer may
+ * release them in any order
+ */
+struct ArrowBatchHolder
+{
+	SQLiteColumnBatch_sptr					batch;
+	const void*								buffers[1] = { nullptr };
+	std::vector<ArrowArray>					children;
+	std::vector<ArrowArray*>				childPointers;
+	std::vector<std::array<const void*, 3>>	childBuffers;
+	std::vector<std::vector<int64_t>>		integers;//columns converted to the schema type
+	std::vector<std::vector<double>>		reals;
+	std::vector<std::vector<char>>			bytes;
+};
+using ArrowBatchHolder_sptr = std::shared_ptr<ArrowBatchHolder>;
+
+struct ArrowSchemaHolder
+{
+	std::vector<std::string>	names;
+	std::vector<ArrowSchema>	children;
+	std::vector<ArrowSchema*>	childPointers;
+};
+using ArrowSchemaHolder_sptr = std::shared_ptr<ArrowSchemaHolder>;
+
+struct ArrowStreamState
+{
+	SQLiteStmt_sptr						stmt;
+	size_t								batchSize;
+	SQLiteColumnBatch_sptr				pending;//the first batch, fetched to infer the schema
+	std::vector<std::string>			names;
+	std::vector<SQLiteValueType::Enum>	types;
+	bool								done;
+	std::string							error;
+};
+
+static void release_array(ArrowArray* array)
+{
+	if(array->release == nullptr) { return; }
+	for(int64_t i = 0; i < array->n_children; ++i)
+	{
+		ArrowArray* child = array->children[i];
+		if( (child != nullptr) && (child->release != nullptr) ) { child->release(child); }
+	}
+	delete static_cast<ArrowBatchHolder_sptr*>(array->private_data);
+	array->release = nullptr;
+}
+
+static void release_schema(ArrowSchema* schema)
+{
+	if(schema->release == nullptr) { return; }
+	for(int64_t i = 0; i < schema->n_children; ++i)
+	{
+		ArrowSchema* child = schema->children[i];
+		if( (child != nullptr) && (child->release != nullptr) ) { child->release(child); }
+	}
+	delete static_cast<ArrowSchemaHolder_sptr*>(schema->private_data);
+	schema->release = nullptr;
+}
+
+static int64_t text_to_int64(std::string_view text) { return strtoll(std::string(text).c_str(), nullptr, 10); }
+static double text_to_double(std::string_view text) { return strtod(std::string(text).c_str(), nullptr); }
+
+static int64_t real_to_int64(double value)
+{
+	if(std::isnan(value)) { return 0; }
+	if(value >= 9223372036854775807.0) { return std::numeric_limits<int64_t>::max(); }
+	if(value <= -9223372036854775808.0) { return std::numeric_limits<int64_t>::min(); }
+	return static_cast<int64_t>(value);
+}
+
+/**
+ * Points the buffers of a child array at the column, columns of another type than the schema are converted first
+ */
+static void export_column(ArrowBatchHolder& holder, size_t index, SQLiteValueType::Enum type)
+{
+	const SQLiteColumnBatch::Column& column = (*holder.batch)[index];
+	const size_t rows = holder.batch->rows();
+	auto& buffers = holder.childBuffers[index];
+	buffers[0] = (column.nullCount > 0) ? column.validity.data() : nullptr;
+	const bool column_bytes = (column.type == SQLiteValueType::TEXT) || (column.type == SQLiteValueType::BLOB);
+	if(type == SQLiteValueType::INTEGER)
+	{
+		if(column.type == SQLiteValueType::INTEGER)
+		{
+			buffers[1] = buffer_of(column.integers);
+			return;
+		}
+		holder.integers.emplace_back(rows, 0);
+		auto& values = holder.integers.back();
+		for(size_t row = 0; row < rows; ++row)
+		{
+			if(column.type == SQLiteValueType::FLOAT) { values[row] = real_to_int64(column.reals[row]); }
+			else if(column_bytes) { values[row] = text_to_int64(column.asStringView(row)); }
+		}
+		buffers[1] = buffer_of(values);
+	}
+	else if(type == SQLiteValueType::FLOAT)
+	{
+		if(column.type == SQLiteValueType::FLOAT)
+		{
+			buffers[1] = buffer_of(column.reals);
+			return;
+		}
+		holder.reals.emplace_back(rows, 0.0);
+		auto& values = holder.reals.back();
+		for(size_t row = 0; row < rows; ++row)
+		{
+			if(column.type == SQLiteValueType::INTEGER) { values[row] = static_cast<double>(column.integers[row]); }
+			else if(column_bytes) { values[row] = text_to_double(column.asStringView(row)); }
+		}
+		buffers[1] = buffer_of(values);
+	}
+	else
+	{
+		//text and blob share their layout
+		if(column_bytes)
+		{
+			buffers[1] = buffer_of(column.offsets);
+			buffers[2] = buffer_of(column.bytes);
+			return;
+		}
+		holder.integers.emplace_back(1, 0);
+		auto& offsets = holder.integers.back();
+		holder.bytes.emplace_back();
+		auto& text = holder.bytes.back();
+		offsets.reserve(rows + 1);
+		char number[32];
+		for(size_t row = 0; row < rows; ++row)
+		{
+			if( (column.type != SQLiteValueType::NULL_VALUE) && !column.isNull(row) )
+			{
+				//formatted the way SQLite turns numbers into text
+				if(column.type == SQLiteValueType::INTEGER) { sqlite3_snprintf(sizeof(number), number, "%lld", static_cast<long long>(column.integers[row])); }
+				else { sqlite3_snprintf(sizeof(number), number, "%!.15g", column.reals[row]); }
+				text.insert(text.end(), number, number + strlen(number));
+			}
+			offsets.push_back(static_cast<int64_t>(text.size()));
+		}
+		buffers[1] = buffer_of(offsets);
+		buffers[2] = buffer_of(text);
+	}
+}
+
+static void export_batch(const SQLiteColumnBatch_sptr& batch, const std::vector<SQLiteValueType::Enum>& types, ArrowArray* out)
+{
+	auto holder = std::make_shared<ArrowBatchHolder>();
+	holder->batch = batch;
+	const size_t columns = types.size();
+	holder->children.resize(columns);
+	holder->childPointers.resize(columns);
+	holder->childBuffers.resize(columns);
+	//converted columns are few, reserving keeps the buffers already handed out in place
+	holder->integers.reserve(columns);
+	holder->reals.reserve(columns);
+	holder->bytes.reserve(columns);
+	for(size_t i = 0; i < columns; ++i)
+	{
+		export_column(*holder, i, types[i]);
+		ArrowArray& child = holder->children[i];
+		const SQLiteColumnBatch::Column& column = (*batch)[i];
+		child.length = static_cast<int64_t>(batch->rows());
+		child.null_count = static_cast<int64_t>(column.nullCount);
+		child.offset = 0;
+		child.n_buffers = ( (types[i] == SQLiteValueType::INTEGER) || (types[i] == SQLiteValueType::FLOAT) ) ? 2 : 3;
+		child.n_children = 0;
+		child.buffers = holder->childBuffers[i].data();
+		child.children = nullptr;
+		child.dictionary = nullptr;
+		child.release = release_array;
+		child.private_data = new ArrowBatchHolder_sptr(holder);
+		holder->childPointers[i] = &child;
+	}
+	out->length = static_cast<int64_t>(batch->rows());
+	out->null_count = 0;
+	out->offset = 0;
+	out->n_buffers = 1;
+	out->n_children = static_cast<int64_t>(columns);
+	out->buffers = holder->buffers;
+	out->children = holder->childPointers.data();
+	out->dictionary = nullptr;
+	out->release = release_array;
+	out->private_data = new ArrowBatchHolder_sptr(holder);
+}
+
+static int stream_get_schema(ArrowArrayStream* stream, ArrowSchema* out)
+{
+	const auto* state = static_cast<ArrowStreamState*>(stream->private_data);
+	auto holder = std::make_shared<ArrowSchemaHolder>();
+	const size_t columns = state->types.size();
+	holder->names = state->names;
+	holder->children.resize(columns);
+	holder->childPointers.resize(columns);
+	for(size_t i = 0; i < columns; ++i)
+	{
+		ArrowSchema& child = holder->children[i];
+		child.format = arrow_format(state->types[i]);
+		child.name = holder->names[i].c_str();
+		child.metadata = nullptr;
+		child.flags = ARROW_FLAG_NULLABLE;
+		child.n_children = 0;
+		child.children = nullptr;
+		child.dictionary = nullptr;
+		child.release = release_schema;
+		child.private_data = new ArrowSchemaHolder_sptr(holder);
+		holder->childPointers[i] = &child;
+	}
+	out->format = "+s";
+	out->name = "";
+	out->metadata = nullptr;
+	out->flags = 0;
+	out->n_children = static_cast<int64_t>(columns);
+	out->children = holder->childPointers.data();
+	out->dictionary = nullptr;
+	out->release = release_schema;
+	out->private_data = new ArrowSchemaHolder_sptr(holder);
+	return 0;
+}
+
+static int stream_get_next(ArrowArrayStream* stream, ArrowArray* out)
+{
+	auto* state = static_cast<ArrowStreamState*>(stream->private_data);
+	SQLiteColumnBatch_sptr batch = std::move(state->pending);
+	if( !batch && !state->done )
+	{
+		batch = state->stmt->fetchColumns(state->batchSize);
+		if(!batch)
+		{
+			state->error = sqlite3_errmsg(sqlite3_db_handle(state->stmt->native()));
+			state->done = true;
+			return EIO;
+		}
+	}
+	if(batch) { state->done = batch->last(); }
+	if( !batch || (batch->rows() == 0) )
+	{
+		//end of the stream
+		memset(out, 0, sizeof(*out));
+		return 0;
+	}
+	export_batch(batch, state->types, out);
+	return 0;
+}
+
+static const char* stream_get_last_error(ArrowArrayStream* stream)
+{
+	const auto* state = static_cast<ArrowStreamState*>(stream->private_data);
+	return state->error.empty() ? nullptr : state->error.c_str();
+}
+
+static void stream_release(ArrowArrayStream* stream)
+{
+	if(stream->release == nullptr) { return; }
+	delete static_cast<ArrowStreamState*>(stream->private_data);
+	stream->release = nullptr;
+}
+
+SQLiteCode::Enum SQLiteArrow::exportStream(const SQLiteStmt_sptr& stmt, ArrowArrayStream* out, size_t batch_size)
+{
+	if( !stmt || (out == nullptr) ) { return SQLiteCode::MISUSE; }
+	if(stmt->native() == nullptr) { return stmt->errorCode(); }
+	auto first = stmt->fetchColumns(batch_size);
+	if(!first) { return stmt->errorCode(); }
+	auto* state = new ArrowStreamState{ stmt, batch_size, first, {}, {}, false, {} };
+	for(size_t i = 0; i < first->columns(); ++i)
+	{
+		const SQLiteColumnBatch::Column& column = (*first)[i];
+		state->names.push_back(column.name);
+		//NULL throughout the first batch, later values of any type can become text
+		state->types.push_back( (column.type == SQLiteValueType::NULL_VALUE) ? SQLiteValueType::TEXT : column.type );
+	}
+	out->get_schema = stream_get_schema;
+	out->get_next = stream_get_next;
+	out->get_last_error = stream_get_last_error;
+	out->release = stream_release;
+	out->private_data = state;
+	return SQLiteCode::OK;
+}
+
+struct ArrowImportKind
+{
+	enum Enum
+	{
+		UNSUPPORTED,
+		NULL_VALUE,
+		INT8,
+		UINT8,
+		INT16,
+		UINT16,
+		INT32,
+		UINT32,
+		INT64,
+		UINT64,
+		BOOL,
+		FLOAT32,
+		FLOAT64,
+		UTF8,
+		LARGE_UTF8,
+		BINARY,
+		LARGE_BINARY
+	};
+};
+
+static ArrowImportKind::Enum import_kind(const char* format)
+{
+	if( (format == nullptr) || (format[0] == '\0') || (format[1] != '\0') ) { return ArrowImportKind::UNSUPPORTED; }
+	switch(format[0])
+	{
+		case 'n': return ArrowImportKind::NULL_VALUE;
+		case 'c': return ArrowImportKind::INT8;
+		case 'C': return ArrowImportKind::UINT8;
+		case 's': return ArrowImportKind::INT16;
+		case 'S': return ArrowImportKind::UINT16;
+		case 'i': return ArrowImportKind::INT32;
+		case 'I': return ArrowImportKind::UINT32;
+		case 'l': return ArrowImportKind::INT64;
+		case 'L': return ArrowImportKind::UINT64;
+		case 'b': return ArrowImportKind::BOOL;
+		case 'f': return ArrowImportKind::FLOAT32;
+		case 'g': return ArrowImportKind::FLOAT64;
+		case 'u': return ArrowImportKind::UTF8;
+		case 'U': return ArrowImportKind::LARGE_UTF8;
+		case 'z': return ArrowImportKind::BINARY;
+		case 'Z': return ArrowImportKind::LARGE_BINARY;
+		default: return ArrowImportKind::UNSUPPORTED;
+	}
+}
+
+static inline bool bit_set(const void* bitmap, int64_t index) { return (static_cast<const uint8_t*>(bitmap)[index >> 3] >> (index & 7)) & 1; }
+
+template<typename T>
+static inline T value_at(const ArrowArray& array, int64_t index) { return static_cast<const T*>(array.buffers[1])[index]; }
+
+template<typename Offset>
+static inline std::string_view bytes_at(const ArrowArray& array, int64_t index)
+{
+	const Offset* offsets = static_cast<const Offset*>(array.buffers[1]);
+	const char* bytes = (array.buffers[2] != nullptr) ? static_cast<const char*>(array.buffers[2]) : reinterpret_cast<const char*>(EMPTY_BUFFER);
+	return std::string_view(bytes + offsets[index], static_cast<size_t>(offsets[index + 1] - offsets[index]));
+}
+
+/**
+ * Binds the value at index of the array, text and blobs point into the Arrow buffers
+ */
+static void bind_arrow_value(SQLiteStatement& stmt, const ArrowArray& array, ArrowImportKind::Enum kind, int64_t index, int32_t parameter)
+{
+	if( (kind == ArrowImportKind::NULL_VALUE) || ( (array.null_count != 0) && (array.buffers[0] != nullptr) && !bit_set(array.buffers[0], index) ) )
+	{
+		stmt.bindNull(parameter);
+		return;
+	}
+	switch(kind)
+	{
+		case ArrowImportKind::INT8: stmt.bind(static_cast<int32_t>(value_at<int8_t>(array, index)), parameter); break;
+		case ArrowImportKind::UINT8: stmt.bind(static_cast<int32_t>(value_at<uint8_t>(array, index)), parameter); break;
+		case ArrowImportKind::INT16: stmt.bind(static_cast<int32_t>(value_at<int16_t>(array, index)), parameter); break;
+		case ArrowImportKind::UINT16: stmt.bind(static_cast<int32_t>(value_at<uint16_t>(array, index)), parameter); break;
+		case ArrowImportKind::INT32: stmt.bind(value_at<int32_t>(array, index), parameter); break;
+		case ArrowImportKind::UINT32: stmt.bind(static_cast<int64_t>(value_at<uint32_t>(array, index)), parameter); break;
+		case ArrowImportKind::INT64: stmt.bind(value_at<int64_t>(array, index), parameter); break;
+		case ArrowImportKind::UINT64:
+		{
+			//like SQLite does with unsigned literals out of range
+			const uint64_t value = value_at<uint64_t>(array, index);
+			if(value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) { stmt.bind(static_cast<double>(value), parameter); }
+			else { stmt.bind(static_cast<int64_t>(value), parameter); }
+			break;
+		}
+		case ArrowImportKind::BOOL: stmt.bind(static_cast<int32_t>(bit_set(array.buffers[1], index)), parameter); break;
+		case ArrowImportKind::FLOAT32: stmt.bind(static_cast<double>(value_at<float>(array, index)), parameter); break;
+		case ArrowImportKind::FLOAT64: stmt.bind(value_at<double>(array, index), parameter); break;
+		case ArrowImportKind::UTF8: stmt.bindStatic(bytes_at<int32_t>(array, index), parameter); break;
+		case ArrowImportKind::LARGE_UTF8: stmt.bindStatic(bytes_at<int64_t>(array, index), parameter); break;
+		case ArrowImportKind::BINARY:
+		{
+			const std::string_view value = bytes_at<int32_t>(array, index);
+			stmt.bindStaticBlob(value.data(), value.size(), parameter);
+			break;
+		}
+		case ArrowImportKind::LARGE_BINARY:
+		{
+			const std::string_view value = bytes_at<int64_t>(array, index);
+			stmt.bindStaticBlob(value.data(), value.size(), parameter);
+			break;
+		}
+		default: stmt.bindNull(parameter); break;
+	}
+}
+
+SQLiteCode::Enum SQLiteArrow::importStream(SQLite& db, const std::string& table, ArrowArrayStream* stream,
+	const SQLiteArrowImportConfig& config, int64_t* rows_imported)
+{
+	if(rows_imported != nullptr) { *rows_imported = 0; }
+	if( (stream == nullptr) || (stream->release == nullptr) ) { return SQLiteCode::MISUSE; }
+	if(!db.isOpen())
+	{
+		stream->release(stream);
+		return SQLiteCode::MISUSE;
+	}
+	ArrowSchema schema;
+	if(stream->get_schema(stream, &schema) != 0)
+	{
+		stream->release(stream);
+		return SQLiteCode::ERROR;
+	}
+	std::vector<ArrowImportKind::Enum> kinds;
+	std::vector<std::string> columns;
+	bool supported = (schema.format != nullptr) && (strcmp(schema.format, "+s") == 0) && (schema.n_children > 0);
+	for(int64_t i = 0; supported && (i < schema.n_children); ++i)
+	{
+		const ArrowSchema* field = schema.children[i];
+		kinds.push_back(import_kind(field->format));
+		supported = (kinds.back() != ArrowImportKind::UNSUPPORTED) && (field->name != nullptr) && (field->dictionary == nullptr);
+		if(supported) { columns.emplace_back(field->name); }
+	}
+	schema.release(&schema);
+	if(!supported)
+	{
+		stream->release(stream);
+		return SQLiteCode::MISMATCH;
+	}
+
+	SQLiteBulkInsert insert(db, table, columns, config.rowsPerInsert, config.rowsPerTransaction, config.orReplace);
+	SQLiteCode::Enum error_code = insert.errorCode();
+	while(error_code == SQLiteCode::OK)
+	{
+		ArrowArray batch;
+		if(stream->get_next(stream, &batch) != 0)
+		{
+			error_code = SQLiteCode::ERROR;
+			break;
+		}
+		if(batch.release == nullptr) { break; }
+		if(batch.n_children != static_cast<int64_t>(kinds.size()))
+		{
+			batch.release(&batch);
+			error_code = SQLiteCode::MISMATCH;
+			break;
+		}
+		const bool struct_nulls = (batch.null_count != 0) && (batch.buffers != nullptr) && (batch.buffers[0] != nullptr);
+		int64_t row = 0;
+		while( (row < batch.length) && (error_code == SQLiteCode::OK) )
+		{
+			const size_t count = std::min(insert.rowsPerInsert(), static_cast<size_t>(batch.length - row));
+			SQLiteStatement* stmt = insert.statement(count);
+			if(stmt == nullptr)
+			{
+				error_code = insert.errorCode();
+				break;
+			}
+			int32_t parameter = 1;
+			for(size_t r = 0; r < count; ++r)
+			{
+				const int64_t index = batch.offset + row + static_cast<int64_t>(r);
+				const bool row_null = struct_nulls && !bit_set(batch.buffers[0], index);
+				for(size_t c = 0; c < kinds.size(); ++c)
+				{
+					const ArrowArray& field = *batch.children[c];
+					bind_arrow_value(*stmt, field, row_null ? ArrowImportKind::NULL_VALUE : kinds[c], field.offset + index, parameter++);
+				}
+			}
+			error_code = insert.execute(count);
+			row += static_cast<int64_t>(count);
+		}
+		batch.release(&batch);
+	}
+	error_code = insert.finish(error_code);
+	const int64_t imported = insert.rows();
+	stream->release(stream);
+	if(rows_imported != nullptr) { *rows_imported = imported; }
+	return error_code;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_ARROW_H_
+#define COMPONENTS_DATABASE_SQLITE_ARROW_H_
+
+#include <cstdint>
+#include "sqlite.h"
+
+//Arrow C data and stream interfaces (https://arrow.apache.org/docs/format/CDataInterface.html), ABI stable plain C structs
+extern "C"
+{
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+	// Array type description
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowSchema*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+struct ArrowArray
+{
+	// Array data description
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowArray*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream
+{
+	// Callbacks providing stream functionality
+	int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+	int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+	const char* (*get_last_error)(struct ArrowArrayStream*);
+
+	// Release callback
+	void (*release)(struct ArrowArrayStream*);
+
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+#endif  // ARROW_C_STREAM_INTERFACE
+}
+
+namespace database
+{
+	struct SQLiteArrowImportConfig
+	{
+		size_t	rowsPerInsert = 256;			//rows of one multi-row INSERT, lowered to fit the bound parameter limit
+		size_t	rowsPerTransaction = 100000;	//rows committed together when the connection is not in a transaction
+		bool	orReplace = false;				//INSERT OR REPLACE
+	};
+
+	/**
+	 * Moves query results to and from Apache Arrow through the C data interface, without an Arrow dependency
+	 */
+	class SQLiteArrow
+	{
+	public:
+		/**
+		 * Exports the rows of the statement as a stream of struct arrays, one per record batch of up to batch_size rows
+		 * The schema is inferred from the first batch (see SQLiteColumnBatch for how column types are determined):
+		 * INTEGER as int64 (l), FLOAT as float64 (g), TEXT as large utf8 (U), BLOB as large binary (Z), columns without
+		 * a declared type that are NULL throughout the first batch as large utf8. Later values that do not fit the
+		 * schema are converted (reals truncated to int64, numbers formatted as text).
+		 * Batches are exported without copying, every array holds the batch of the statement until released. The
+		 * stream holds the statement, it must be bound beforehand and not be used elsewhere while streaming.
+		 * @return SQLiteCode::OK is returned and out is set, or the error fetching the first batch
+		 */
+		static SQLiteCode::Enum exportStream(const SQLiteStmt_sptr& stmt, ArrowArrayStream* out, size_t batch_size = 65536);
+		/**
+		 * Inserts every record batch of the stream into the table, the stream is consumed and released
+		 * The batches must be struct arrays whose fields are named after columns of the table. Supported field types are
+		 * integers (c C s S i I l L, uint64 values above the int64 range become reals), bool (b), floats (f g),
+		 * utf8 (u U) and binary (z Z), as well as null (n). Values are bound straight from the Arrow buffers.
+		 * Rows are inserted through a cached multi-row INSERT. A connection outside a transaction commits every
+		 * rowsPerTransaction rows, a failure rolls back the rows since the last commit only. Within a transaction of
+		 * the caller nothing is committed nor rolled back.
+		 * @param rows_imported If given, set to the number of rows inserted
+		 * @return An SQLiteCode is returned, MISMATCH for a schema that cannot be imported
+		 */
+		static SQLiteCode::Enum importStream(SQLite& db, const std::string& table, ArrowArrayStream* stream,
+			const SQLiteArrowImportConfig& config = SQLiteArrowImportConfig(), int64_t* rows_imported = nullptr);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_ARROW_H_ */
@@ -0,0 +1,110 @@
+#include "sqlite_bulk_insert.h"
+#include <algorithm>
+
+namespace database
+{
+
+SQLiteBulkInsert::SQLiteBulkInsert(SQLite& db, const std::string& table, const std::vector<std::string>& columns, size_t rows_per_insert,
+	size_t rows_per_transaction, bool or_replace)
+	: mDb(db)
+	, mInsert(or_replace ? "INSERT OR REPLACE INTO " : "INSERT INTO ")
+	, mRowValues("(")
+	, mRowsPerInsert(1)
+	, mRowsPerTransaction(std::max<size_t>(rows_per_transaction, 1))
+	, mStatements()
+	, mOwnTransaction( db.isOpen() && (sqlite3_get_autocommit(db.native()) != 0) )
+	, mFinished(false)
+	, mUncommitted(0)
+	, mRows(0)
+	, mErrorCode(SQLiteCode::OK)
+{
+	if( !db.isOpen() || columns.empty() )
+	{
+		mErrorCode = SQLiteCode::MISUSE;
+		mFinished = true;
+		return;
+	}
+	mInsert += SQLite::quoteIdentifier(table) + " (";
+	for(size_t i = 0; i < columns.size(); ++i)
+	{
+		mInsert += ( (i > 0) ? ", " : "" ) + SQLite::quoteIdentifier(columns[i]);
+		mRowValues += (i > 0) ? ",?" : "?";
+	}
+	mInsert += ") VALUES ";
+	mRowValues += ")";
+	const size_t variables = static_cast<size_t>(sqlite3_limit(db.native(), SQLITE_LIMIT_VARIABLE_NUMBER, -1));
+	mRowsPerInsert = std::max<size_t>(1, std::min(rows_per_insert, variables / columns.size()));
+	if(mOwnTransaction) { mErrorCode = exec("BEGIN IMMEDIATE"); }
+	mFinished = (mErrorCode != SQLiteCode::OK);
+}
+
+SQLiteBulkInsert::~SQLiteBulkInsert()
+{
+	if(!mFinished) { finish(SQLiteCode::ABORT); }
+}
+
+SQLiteCode::Enum SQLiteBulkInsert::exec(const char* sql)
+{ return static_cast<SQLiteCode::Enum>(sqlite3_exec(mDb.native(), sql, nullptr, nullptr, nullptr)); }
+
+SQLiteStatement* SQLiteBulkInsert::statement(size_t rows)
+{
+	if( (rows == 0) || (rows > mRowsPerInsert) )
+	{
+		mErrorCode = SQLiteCode::RANGE;
+		return nullptr;
+	}
+	auto& stmt = mStatements[rows];
+	if(!stmt)
+	{
+		std::string sql = mInsert;
+		sql.reserve(sql.size() + rows * (mRowValues.size() + 1));
+		for(size_t i = 0; i < rows; ++i)
+		{
+			if(i > 0) { sql += ','; }
+			sql += mRowValues;
+		}
+		stmt = mDb.prepare(sql);
+	}
+	if(stmt->native() == nullptr)
+	{
+		mErrorCode = stmt->errorCode();
+		return nullptr;
+	}
+	return stmt.get();
+}
+
+SQLiteCode::Enum SQLiteBulkInsert::execute(size_t rows)
+{
+	SQLiteStatement* stmt = statement(rows);
+	if(stmt == nullptr) { return mErrorCode; }
+	const SQLiteCode::Enum result = stmt->execute();
+	if(result != SQLiteCode::DONE) { return mErrorCode = result; }
+	mRows += static_cast<int64_t>(rows);
+	mUncommitted += rows;
+	if( mOwnTransaction && (mUncommitted >= mRowsPerTransaction) )
+	{
+		mErrorCode = exec("COMMIT");
+		if(mErrorCode != SQLiteCode::OK) { return mErrorCode; }
+		mUncommitted = 0;
+		mErrorCode = exec("BEGIN IMMEDIATE");
+	}
+	return mErrorCode;
+}
+
+SQLiteCode::Enum SQLiteBulkInsert::finish(SQLiteCode::Enum error_code)
+{
+	if(mErrorCode != SQLiteCode::OK) { error_code = mErrorCode; }
+	if(mFinished) { return error_code; }
+	mFinished = true;
+	if(!mOwnTransaction) { return mErrorCode = error_code; }
+	if(error_code == SQLiteCode::OK) { error_code = exec("COMMIT"); }
+	if( (error_code != SQLiteCode::OK) && (sqlite3_get_autocommit(mDb.native()) == 0) )
+	{
+		exec("ROLLBACK");
+		mRows -= static_cast<int64_t>(mUncommitted);
+	}
+	mUncommitted = 0;
+	return mErrorCode = error_code;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_BULK_INSERT_H_
+#define COMPONENTS_DATABASE_SQLITE_BULK_INSERT_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sqlite.h"
+
+namespace database
+{
+	/**
+	 * Inserts rows into a table through cached multi-row INSERT statements and commits them in large transactions
+	 * rowsPerInsert is lowered to fit the bound parameter limit of the connection. A connection outside a transaction
+	 * commits every rows_per_transaction rows, a failure rolls back the rows since the last commit only. Within a
+	 * transaction of the caller nothing is committed nor rolled back.
+	 * Usage: bind the parameters of statement(n) for n rows (row after row, column after column), then execute(n)
+	 */
+	class SQLiteBulkInsert
+	{
+	public:
+		SQLiteBulkInsert(SQLite& db, const std::string& table, const std::vector<std::string>& columns, size_t rows_per_insert,
+			size_t rows_per_transaction, bool or_replace = false);
+		SQLiteBulkInsert(const SQLiteBulkInsert& other) = delete;
+		SQLiteBulkInsert& operator=(const SQLiteBulkInsert& other) = delete;
+		/**
+		 * Rolls back the rows since the last commit unless finish() was called
+		 */
+		~SQLiteBulkInsert();
+		/**
+		 * Returns the error of the last operation, BEGIN IMMEDIATE failing for a start
+		 */
+		inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+		inline bool valid() const { return mErrorCode == SQLiteCode::OK; }
+		explicit operator bool() const noexcept { return valid(); }
+		inline size_t rowsPerInsert() const { return mRowsPerInsert; }
+		/**
+		 * Returns the statement inserting the given number of rows (at most rowsPerInsert()), prepared on first use
+		 * @return The statement is returned, nullptr if it does not prepare with errorCode() telling why
+		 */
+		SQLiteStatement* statement(size_t rows);
+		/**
+		 * Executes the statement of the given number of rows and commits if the transaction is full
+		 */
+		SQLiteCode::Enum execute(size_t rows);
+		/**
+		 * Commits the rows inserted, or rolls them back if error_code or a previous failure is not SQLiteCode::OK
+		 * @return The first error is returned
+		 */
+		SQLiteCode::Enum finish(SQLiteCode::Enum error_code = SQLiteCode::OK);
+		/**
+		 * Returns the number of rows inserted, rows rolled back are not counted
+		 */
+		inline int64_t rows() const { return mRows; }
+	private:
+		SQLite&										mDb;
+		std::string									mInsert;//"INSERT INTO `table` (`a`, `b`) VALUES "
+		std::string									mRowValues;//"(?,?)"
+		size_t										mRowsPerInsert;
+		const size_t								mRowsPerTransaction;
+		std::unordered_map<size_t, SQLiteStmt_sptr>	mStatements;
+		const bool									mOwnTransaction;
+		bool										mFinished;
+		size_t										mUncommitted;
+		int64_t										mRows;
+		SQLiteCode::Enum							mErrorCode;
+
+		SQLiteCode::Enum exec(const char* sql);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_BULK_INSERT_H_ */
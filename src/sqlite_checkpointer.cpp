@@ -0,0 +1,189 @@
+#include "sqlite_checkpointer.h"
+#include "sqlite_snapshot.h"
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+
+namespace database
+{
+
+static int64_t steady_nanos()
+{ return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+static SQLiteOpenOptions existing_database()
+{
+	SQLiteOpenOptions options;
+	options.create = false;
+	return options;
+}
+
+SQLiteCheckpointer::SQLiteCheckpointer(const std::string& path, const SQLiteCheckpointerConfig& config)
+	: mPath(path)
+	, mConfig(config)
+	, mConnection(path, existing_database())
+	, mConnectionMutex()
+	, mMutex()
+	, mWakeUp()
+	, mRunning(true)
+	, mWalFrames(0)
+	, mLastCommit(steady_nanos())
+	, mPageSize(4096)
+	, mStats()
+	, mAttached()
+	, mThread()
+{
+	if(!mConnection.isOpen()) { return; }
+	sqlite3_busy_timeout(mConnection.native(), static_cast<int>(mConfig.busyTimeout.count()));
+	if(auto row = mConnection.prepare("PRAGMA page_size")->step()) { mPageSize = (*row)[0].asInt64(); }
+	mThread = std::thread(&SQLiteCheckpointer::run, this);
+}
+
+SQLiteCheckpointer::~SQLiteCheckpointer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+	mWakeUp.notify_one();
+	if(mThread.joinable()) { mThread.join(); }
+	//their WAL hooks point at this object
+	std::vector<SQLite*> attached;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		attached.swap(mAttached);
+	}
+	for(SQLite* db : attached) { detach(*db); }
+}
+
+SQLiteCode::Enum SQLiteCheckpointer::attach(SQLite& db)
+{
+	if(!db.isOpen()) { return SQLiteCode::CANTOPEN; }
+	//setting a WAL hook replaces the one installed by wal_autocheckpoint
+	sqlite3_wal_autocheckpoint(db.native(), 0);
+	sqlite3_wal_hook(db.native(), &SQLiteCheckpointer::onCommit, this);
+	std::lock_guard<std::mutex> lock(mMutex);
+	if(std::find(mAttached.begin(), mAttached.end(), &db) == mAttached.end()) { mAttached.push_back(&db); }
+	return SQLiteCode::OK;
+}
+
+void SQLiteCheckpointer::detach(SQLite& db)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mAttached.erase(std::remove(mAttached.begin(), mAttached.end(), &db), mAttached.end());
+	}
+	if(db.isOpen()) { sqlite3_wal_autocheckpoint(db.native(), 1000); }
+}
+
+int SQLiteCheckpointer::onCommit(void* context, sqlite3*, const char* schema, int frames)
+{
+	//runs on the committing thread, it only records the WAL size
+	SQLiteCheckpointer* self = static_cast<SQLiteCheckpointer*>(context);
+	if(strcmp(schema, "main") != 0) { return SQLITE_OK; }
+	int64_t previous = self->mWalFrames.exchange(frames, std::memory_order_relaxed);
+	self->mLastCommit.store(steady_nanos(), std::memory_order_relaxed);
+	if( (previous < self->mConfig.walFrames) && (frames >= self->mConfig.walFrames) ) { self->mWakeUp.notify_one(); }
+	return SQLITE_OK;
+}
+
+SQLiteCode::Enum SQLiteCheckpointer::checkpoint(int mode)
+{
+	int log_frames = -1;
+	int checkpointed_frames = -1;
+	return runCheckpoint(mode, log_frames, checkpointed_frames);
+}
+
+SQLiteCode::Enum SQLiteCheckpointer::runCheckpoint(int mode, int& log_frames, int& checkpointed_frames)
+{
+	if(!mConnection.isOpen()) { return SQLiteCode::CANTOPEN; }
+	int error_code = SQLITE_OK;
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mConnectionMutex);
+		error_code = sqlite3_wal_checkpoint_v2(mConnection.native(), nullptr, mode, &log_frames, &checkpointed_frames);
+		if( (error_code == SQLITE_OK) && (log_frames < 0) )
+		{
+			//the connection only opens the WAL once it read the database, until then checkpoints are no-ops
+			sqlite3_exec(mConnection.native(), "SELECT 1 FROM sqlite_master LIMIT 1", nullptr, nullptr, nullptr);
+			error_code = sqlite3_wal_checkpoint_v2(mConnection.native(), nullptr, mode, &log_frames, &checkpointed_frames);
+		}
+	}
+	auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	switch(mode)
+	{
+		case SQLITE_CHECKPOINT_PASSIVE: ++mStats.passive; break;
+		case SQLITE_CHECKPOINT_RESTART: ++mStats.restart; break;
+		case SQLITE_CHECKPOINT_TRUNCATE: ++mStats.truncate; break;
+		default: break;
+	}
+	//PASSIVE never waits, frames still used by readers are left behind without an error
+	if( (error_code == SQLITE_BUSY) || ( (error_code == SQLITE_OK) && (checkpointed_frames < log_frames) ) ) { ++mStats.busy; }
+	mStats.lastLatency = latency;
+	mStats.totalLatency += latency;
+	if(latency > mStats.maxLatency) { mStats.maxLatency = latency; }
+	return static_cast<SQLiteCode::Enum>(error_code);
+}
+
+int64_t SQLiteCheckpointer::walBytes() const
+{
+	const char* filename = mConnection.isOpen() ? sqlite3_db_filename(mConnection.native(), "main") : nullptr;
+	struct stat info;
+	if( (filename == nullptr) || (stat((std::string(filename) + "-wal").c_str(), &info) != 0) ) { return 0; }
+	return info.st_size;
+}
+
+SQLiteCheckpointStats SQLiteCheckpointer::stats() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	SQLiteCheckpointStats result = mStats;
+	result.walFrames = mWalFrames.load(std::memory_order_relaxed);
+	result.walBytes = walBytes();
+	return result;
+}
+
+void SQLiteCheckpointer::run()
+{
+	int64_t checkpointed = 0;//frames of the WAL already copied into the database
+	int64_t escalation_blocked_until = 0;
+	std::unique_lock<std::mutex> lock(mMutex);
+	while(mRunning)
+	{
+		mWakeUp.wait_for(lock, mConfig.poll);
+		if(!mRunning) { break; }
+
+		int64_t frames = mWalFrames.load(std::memory_order_relaxed);
+		//a smaller WAL than checkpointed means a writer restarted it from the beginning
+		if(frames < checkpointed) { checkpointed = 0; }
+		if(frames == checkpointed) { continue; }
+		const bool idle = (steady_nanos() - mLastCommit.load(std::memory_order_relaxed)) >= std::chrono::nanoseconds(mConfig.idle).count();
+		if( (frames - checkpointed < mConfig.walFrames) && !idle ) { continue; }
+
+		//frames pile up while readers keep the WAL from being restarted, the file itself only shrinks with TRUNCATE
+		const int64_t used_bytes = frames * (mPageSize + 24);
+		//a pinned snapshot keeps the WAL from being restarted, waiting for it would only stall writers
+		const bool escalate = (steady_nanos() >= escalation_blocked_until) && !SQLiteReadSnapshot::pinned(sqlite3_db_filename(mConnection.native(), "main"));
+		int mode = SQLITE_CHECKPOINT_PASSIVE;
+		if( escalate && (walBytes() >= mConfig.truncateBytes) ) { mode = SQLITE_CHECKPOINT_TRUNCATE; }
+		else if( escalate && (used_bytes >= mConfig.restartBytes) ) { mode = SQLITE_CHECKPOINT_RESTART; }
+
+		lock.unlock();
+		int log_frames = -1;
+		int checkpointed_frames = -1;
+		SQLiteCode::Enum error_code = runCheckpoint(mode, log_frames, checkpointed_frames);
+		lock.lock();
+		//a reader pinning the WAL would otherwise stall writers for busyTimeout on every poll
+		if( (mode != SQLITE_CHECKPOINT_PASSIVE) && (error_code == SQLiteCode::BUSY) )
+		{ escalation_blocked_until = steady_nanos() + std::chrono::nanoseconds(mConfig.escalationBackoff).count(); }
+		if( (error_code == SQLiteCode::OK) || (error_code == SQLiteCode::BUSY) )
+		{
+			//frames left behind are retried with the next commit, not on every poll
+			if(log_frames >= 0) { mWalFrames.compare_exchange_strong(frames, log_frames, std::memory_order_relaxed); }
+			checkpointed = (log_frames >= 0) ? log_frames : frames;
+		}
+	}
+}
+
+}
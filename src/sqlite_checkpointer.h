@@ -0,0 +1,98 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_CHECKPOINTER_H_
+#define COMPONENTS_DATABASE_SQLITE_CHECKPOINTER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sqlite.h"
+
+namespace database
+{
+	struct SQLiteCheckpointerConfig
+	{
+		int32_t						walFrames = 1000;				//WAL frames that trigger a PASSIVE checkpoint
+		std::chrono::milliseconds	idle{200};						//a smaller WAL is checkpointed after writes paused this long
+		int64_t						restartBytes = 64ll << 20;		//WAL size from which RESTART is used
+		int64_t						truncateBytes = 256ll << 20;	//WAL size from which TRUNCATE is used
+		std::chrono::milliseconds	busyTimeout{100};				//how long RESTART/TRUNCATE wait for readers, new writers wait meanwhile
+		std::chrono::milliseconds	escalationBackoff{1000};		//PASSIVE only for this long after RESTART/TRUNCATE did not complete
+		std::chrono::milliseconds	poll{50};						//how often idle writes are looked for
+	};
+
+	struct SQLiteCheckpointStats
+	{
+		int64_t						walFrames;		//frames in the WAL after the last checkpoint or commit seen
+		int64_t						walBytes;		//size of the -wal file
+		uint64_t					passive;
+		uint64_t					restart;
+		uint64_t					truncate;
+		uint64_t					busy;			//checkpoints that could not complete
+		std::chrono::nanoseconds	lastLatency;
+		std::chrono::nanoseconds	maxLatency;
+		std::chrono::nanoseconds	totalLatency;
+	};
+
+	/**
+	 * Background WAL checkpoint scheduler
+	 * Attached connections stop checkpointing inline on commit (wal_autocheckpoint), their commits are reported through
+	 * the WAL hook instead. A background thread with a connection of its own runs PASSIVE checkpoints once the WAL holds
+	 * enough frames or writes went idle, RESTART and TRUNCATE are only used when the WAL grew past the limits and no
+	 * SQLiteReadSnapshot of the database is alive.
+	 * A connection has to be detached before it closes, unless the checkpointer is destroyed first: the destructor
+	 * detaches the connections still attached.
+	 */
+	class SQLiteCheckpointer
+	{
+	public:
+		SQLiteCheckpointer(const std::string& path, const SQLiteCheckpointerConfig& config = SQLiteCheckpointerConfig());
+		SQLiteCheckpointer(const SQLiteCheckpointer& other) = delete;
+		SQLiteCheckpointer& operator=(const SQLiteCheckpointer& other) = delete;
+		/**
+		 * Stops the background thread and detaches the connections still attached, they checkpoint inline again
+		 */
+		~SQLiteCheckpointer();
+		inline bool isRunning() const { return mThread.joinable(); }
+		/**
+		 * Disables inline checkpoints of the connection and routes its commits to the scheduler
+		 * The connection has to be opened on the same database file and detached before it closes
+		 * @return An SQLiteCode is returned
+		 */
+		SQLiteCode::Enum attach(SQLite& db);
+		/**
+		 * Restores the default inline checkpoints (wal_autocheckpoint=1000) of the connection, which replace its WAL hook
+		 */
+		void detach(SQLite& db);
+		/**
+		 * Runs a checkpoint of the given mode (SQLITE_CHECKPOINT_*) now, on the calling thread
+		 * @return An SQLiteCode is returned, BUSY if readers or writers kept it from completing
+		 */
+		SQLiteCode::Enum checkpoint(int mode);
+		SQLiteCheckpointStats stats() const;
+	private:
+		const std::string					mPath;
+		const SQLiteCheckpointerConfig		mConfig;
+		SQLite								mConnection;
+		std::mutex							mConnectionMutex;//checkpoints of the thread and of checkpoint()
+		mutable std::mutex					mMutex;
+		std::condition_variable				mWakeUp;
+		bool								mRunning;
+		std::atomic<int64_t>				mWalFrames;
+		std::atomic<int64_t>				mLastCommit;//steady clock nanoseconds
+		std::atomic<int64_t>				mPageSize;
+		SQLiteCheckpointStats				mStats;//guarded by mMutex
+		std::vector<SQLite*>				mAttached;//guarded by mMutex
+		std::thread							mThread;
+
+		static int onCommit(void* context, sqlite3* db, const char* schema, int frames);
+		SQLiteCode::Enum runCheckpoint(int mode, int& log_frames, int& checkpointed_frames);
+		int64_t walBytes() const;
+		void run();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_CHECKPOINTER_H_ */
@@ -0,0 +1,139 @@
+#include "sqlite_column_batch.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <cctype>
+
+namespace database
+{
+
+//column affinity of a declared type (https://www.sqlite.org/datatype3.html#determination_of_column_affinity)
+static SQLiteValueType::Enum declared_type(const char* declared)
+{
+	if(declared == nullptr) { return SQLiteValueType::NULL_VALUE; }
+	std::string upper(declared);
+	std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+	auto contains = [&upper](const char* part) { return upper.find(part) != std::string::npos; };
+	if(contains("INT")) { return SQLiteValueType::INTEGER; }
+	if(contains("CHAR") || contains("CLOB") || contains("TEXT")) { return SQLiteValueType::TEXT; }
+	if(contains("BLOB")) { return SQLiteValueType::BLOB; }
+	if(contains("REAL") || contains("FLOA") || contains("DOUB")) { return SQLiteValueType::FLOAT; }
+	//NUMERIC affinity or no declared type, sampled from the values
+	return SQLiteValueType::NULL_VALUE;
+}
+
+size_t SQLiteColumnBatch::bytes() const
+{
+	size_t total = 0;
+	for(const auto& column : mColumns)
+	{
+		total += column.integers.capacity() * sizeof(int64_t) + column.reals.capacity() * sizeof(double)
+			+ column.offsets.capacity() * sizeof(int64_t) + column.bytes.capacity() + column.validity.capacity();
+	}
+	return total;
+}
+
+void SQLiteColumnBatch::begin(sqlite3_stmt* stmt, const SQLiteColumnBatch* previous, bool new_evaluation, size_t batch_size)
+{
+	const size_t count = static_cast<size_t>(sqlite3_column_count(stmt));
+	if(previous == this) { previous = nullptr; }
+	if( (previous != nullptr) && (previous->mColumns.size() != count) ) { new_evaluation = true; }
+	mColumns.resize(count);
+	mRows = 0;
+	mLast = false;
+	for(size_t i = 0; i < count; ++i)
+	{
+		Column& column = mColumns[i];
+		if(new_evaluation)
+		{
+			const char* name = sqlite3_column_name(stmt, static_cast<int>(i));
+			column.name = (name != nullptr) ? name : "";
+			column.type = declared_type(sqlite3_column_decltype(stmt, static_cast<int>(i)));
+		}
+		else if(previous != nullptr)
+		{
+			column.name = previous->mColumns[i].name;
+			column.type = previous->mColumns[i].type;
+		}
+		column.integers.clear();
+		column.reals.clear();
+		column.offsets.clear();
+		column.bytes.clear();
+		column.validity.clear();
+		column.nullCount = 0;
+		column.validity.reserve((batch_size + 7) / 8);
+		switch(column.type)
+		{
+			case SQLiteValueType::INTEGER: column.integers.reserve(batch_size); break;
+			case SQLiteValueType::FLOAT: column.reals.reserve(batch_size); break;
+			case SQLiteValueType::TEXT:
+			case SQLiteValueType::BLOB:
+				column.offsets.reserve(batch_size + 1);
+				column.offsets.push_back(0);
+				break;
+			default: break;
+		}
+	}
+}
+
+void SQLiteColumnBatch::widen(Column& column, SQLiteValueType::Enum type)
+{
+	//the values of the batch so far are all NULL unless an INTEGER column becomes FLOAT
+	if(column.type == SQLiteValueType::INTEGER)
+	{
+		column.reals.assign(column.integers.begin(), column.integers.end());
+		column.integers.clear();
+	}
+	else if(type == SQLiteValueType::INTEGER) { column.integers.assign(mRows, 0); }
+	else if(type == SQLiteValueType::FLOAT) { column.reals.assign(mRows, 0.0); }
+	else { column.offsets.assign(mRows + 1, 0); }
+	column.type = type;
+}
+
+void SQLiteColumnBatch::appendRow(sqlite3_stmt* stmt)
+{
+	const size_t byte = mRows >> 3;
+	const uint8_t bit = static_cast<uint8_t>(1u << (mRows & 7));
+	const int count = static_cast<int>(mColumns.size());
+	for(int i = 0; i < count; ++i)
+	{
+		Column& column = mColumns[i];
+		if(bit == 1) { column.validity.push_back(0); }
+		const int value_type = sqlite3_column_type(stmt, i);
+		if(value_type == SQLITE_NULL)
+		{
+			++column.nullCount;
+			switch(column.type)
+			{
+				case SQLiteValueType::INTEGER: column.integers.push_back(0); break;
+				case SQLiteValueType::FLOAT: column.reals.push_back(0.0); break;
+				case SQLiteValueType::TEXT:
+				case SQLiteValueType::BLOB: column.offsets.push_back(column.offsets.back()); break;
+				default: break;
+			}
+			continue;
+		}
+		if(column.type == SQLiteValueType::NULL_VALUE) { widen(column, static_cast<SQLiteValueType::Enum>(value_type)); }
+		else if( (column.type == SQLiteValueType::INTEGER) && (value_type == SQLITE_FLOAT) ) { widen(column, SQLiteValueType::FLOAT); }
+		column.validity[byte] |= bit;
+		switch(column.type)
+		{
+			case SQLiteValueType::INTEGER: column.integers.push_back(sqlite3_column_int64(stmt, i)); break;
+			case SQLiteValueType::FLOAT: column.reals.push_back(sqlite3_column_double(stmt, i)); break;
+			case SQLiteValueType::TEXT:
+			case SQLiteValueType::BLOB:
+			{
+				const char* data = (column.type == SQLiteValueType::TEXT)
+					? reinterpret_cast<const char*>(sqlite3_column_text(stmt, i))
+					: static_cast<const char*>(sqlite3_column_blob(stmt, i));
+				const int size = sqlite3_column_bytes(stmt, i);
+				if( (data != nullptr) && (size > 0) ) { column.bytes.insert(column.bytes.end(), data, data + size); }
+				column.offsets.push_back(static_cast<int64_t>(column.bytes.size()));
+				break;
+			}
+			default: break;
+		}
+	}
+	++mRows;
+}
+
+}
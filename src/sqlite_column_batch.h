@@ -0,0 +1,72 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_COLUMN_BATCH_H_
+#define COMPONENTS_DATABASE_SQLITE_COLUMN_BATCH_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "sqlite_result_cache.h"
+//pre-declarations
+struct sqlite3_stmt;
+
+namespace database
+{
+	/**
+	 * Rows of a statement turned into columns, see SQLiteStatement::fetchColumns
+	 * Each column is one contiguous array of its type: int64 for INTEGER, double for FLOAT, rows + 1 offsets into a byte
+	 * array for TEXT and BLOB (text is not zero terminated). The validity bitmap has bit (row % 8) of byte (row / 8) set
+	 * for every value that is not NULL, the layout Arrow uses. NULL values hold 0 or an empty string.
+	 * A column takes its type from the declared type of the column (INT, CHAR/CLOB/TEXT, BLOB, REAL/FLOA/DOUB as in
+	 * SQLite affinity rules), other columns take the type of their first value that is not NULL. Within one evaluation
+	 * a type only widens, from NULL_VALUE to the first type seen and from INTEGER to FLOAT when a real arrives, values of
+	 * other types are converted like sqlite3_column_int64/double/text convert them.
+	 */
+	class SQLiteColumnBatch
+	{
+		friend class SQLiteStatement;
+	public:
+		struct Column
+		{
+			std::string				name;
+			SQLiteValueType::Enum	type = SQLiteValueType::NULL_VALUE;//NULL_VALUE while every value was NULL
+			std::vector<int64_t>	integers;
+			std::vector<double>		reals;
+			std::vector<int64_t>	offsets;
+			std::vector<char>		bytes;
+			std::vector<uint8_t>	validity;
+			size_t					nullCount = 0;
+
+			inline bool isNull(size_t row) const { return (validity[row >> 3] & (1u << (row & 7))) == 0; }
+			inline std::string_view asStringView(size_t row) const
+			{ return std::string_view(bytes.data() + offsets[row], static_cast<size_t>(offsets[row + 1] - offsets[row])); }
+		};
+		inline size_t rows() const { return mRows; }
+		inline size_t columns() const { return mColumns.size(); }
+		inline const Column& column(size_t index) const { return mColumns[index]; }
+		inline const Column& operator[](size_t index) const { return mColumns[index]; }
+		/**
+		 * Returns true if the batch ends the result, the statement was reset and the next fetch starts over
+		 */
+		inline bool last() const { return mLast; }
+		/**
+		 * Returns the memory held by the batch
+		 */
+		size_t bytes() const;
+	private:
+		std::vector<Column>	mColumns;
+		size_t				mRows = 0;
+		bool				mLast = false;
+
+		/**
+		 * Clears the values keeping the buffers, column types are taken from the declared types on a new evaluation and
+		 * from the previous batch otherwise
+		 */
+		void begin(sqlite3_stmt* stmt, const SQLiteColumnBatch* previous, bool new_evaluation, size_t batch_size);
+		void appendRow(sqlite3_stmt* stmt);
+		void widen(Column& column, SQLiteValueType::Enum type);
+	};
+	using SQLiteColumnBatch_sptr = std::shared_ptr<const SQLiteColumnBatch>;
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_COLUMN_BATCH_H_ */
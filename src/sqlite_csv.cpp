@@ -0,0 +1,491 @@
+#include "sqlite_csv.h"
+#include "sqlite_bulk_insert.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace database
+{
+
+static const size_t BLOCK = 64;
+
+/**
+ * Bitmasks of the quotes, delimiters and line feeds of a 64 byte block, bit i stands for byte i
+ */
+struct CsvMasks
+{
+	uint64_t	quote;
+	uint64_t	delimiter;
+	uint64_t	newline;
+};
+
+static inline void classify(const char* block, char quote, char delimiter, CsvMasks& masks)
+{
+#if defined(__AVX2__)
+	const __m256i quotes = _mm256_set1_epi8(quote);
+	const __m256i delimiters = _mm256_set1_epi8(delimiter);
+	const __m256i newlines = _mm256_set1_epi8('\n');
+	masks = { 0, 0, 0 };
+	for(size_t i = 0; i < BLOCK; i += 32)
+	{
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+		masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quotes)))) << i;
+		masks.delimiter |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, delimiters)))) << i;
+		masks.newline |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newlines)))) << i;
+	}
+#elif defined(__SSE2__)
+	const __m128i quotes = _mm_set1_epi8(quote);
+	const __m128i delimiters = _mm_set1_epi8(delimiter);
+	const __m128i newlines = _mm_set1_epi8('\n');
+	masks = { 0, 0, 0 };
+	for(size_t i = 0; i < BLOCK; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+		masks.quote |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quotes)))) << i;
+		masks.delimiter |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, delimiters)))) << i;
+		masks.newline |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)))) << i;
+	}
+#else
+	masks = { 0, 0, 0 };
+	for(size_t i = 0; i < BLOCK; ++i)
+	{
+		masks.quote |= static_cast<uint64_t>(block[i] == quote) << i;
+		masks.delimiter |= static_cast<uint64_t>(block[i] == delimiter) << i;
+		masks.newline |= static_cast<uint64_t>(block[i] == '\n') << i;
+	}
+#endif
+}
+
+//bit i is set when an odd number of quotes precedes or is at byte i, i.e. byte i is inside quotes
+static inline uint64_t prefix_xor(uint64_t bits)
+{
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	bits ^= bits << 16;
+	bits ^= bits << 32;
+	return bits;
+}
+
+static size_t count_quotes(const char* begin, const char* end, char quote)
+{
+	size_t count = 0;
+	CsvMasks masks;
+	for(; begin + BLOCK <= end; begin += BLOCK)
+	{
+		classify(begin, quote, quote, masks);
+		count += static_cast<size_t>(__builtin_popcountll(masks.quote));
+	}
+	for(; begin < end; ++begin) { count += (*begin == quote); }
+	return count;
+}
+
+/**
+ * Returns the offset following the first line feed outside quotes at or after from, size if there is none
+ */
+static size_t record_start(const char* data, size_t size, size_t from, bool inside, char quote)
+{
+	for(size_t i = from; i < size; ++i)
+	{
+		if(data[i] == quote) { inside = !inside; }
+		else if( (data[i] == '\n') && !inside ) { return i + 1; }
+	}
+	return size;
+}
+
+struct CsvField
+{
+	const char*				data;
+	uint32_t				size;
+	SQLiteValueType::Enum	type;
+	union
+	{
+		int64_t				integer;
+		double				real;
+	};
+};
+
+struct CsvChunk
+{
+	std::vector<CsvField>	fields;//columns fields per record
+	std::deque<std::string>	unescaped;//quoted fields holding doubled quotes, a deque keeps them in place
+	size_t					records = 0;
+	size_t					malformed = 0;
+};
+
+static bool parse_number(const char* data, size_t size, CsvField& field)
+{
+	//SQLite takes neither leading spaces, nor inf/nan nor hex floats as numbers
+	if( (size == 0) || (size > 64) || ( !isdigit(static_cast<unsigned char>(data[0])) && (data[0] != '-') && (data[0] != '.') ) ) { return false; }
+	const char* end = data + size;
+	int64_t integer = 0;
+	auto parsed = std::from_chars(data, end, integer);
+	if( (parsed.ec == std::errc()) && (parsed.ptr == end) )
+	{
+		field.type = SQLiteValueType::INTEGER;
+		field.integer = integer;
+		return true;
+	}
+	double real = 0.0;
+#if defined(__cpp_lib_to_chars)
+	auto parsed_real = std::from_chars(data, end, real);
+	if( (parsed_real.ec != std::errc()) || (parsed_real.ptr != end) ) { return false; }
+#else
+	//floating point from_chars is missing before GCC 11
+	char buffer[65];
+	memcpy(buffer, data, size);
+	buffer[size] = '\0';
+	char* parsed_end = nullptr;
+	real = strtod(buffer, &parsed_end);
+	if( (parsed_end != buffer + size) || (strpbrk(buffer, "xXnN") != nullptr) ) { return false; }
+#endif
+	field.type = SQLiteValueType::FLOAT;
+	field.real = real;
+	return true;
+}
+
+/**
+ * Parses the records of [begin, end), which starts at a record boundary
+ */
+class CsvParser
+{
+public:
+	CsvParser(const SQLiteCsvImportConfig& config, const std::vector<bool>& numeric, CsvChunk& chunk)
+		: mConfig(config)
+		, mNumeric(numeric)
+		, mChunk(chunk)
+		, mFields(0)
+	{}
+
+	void parse(const char* begin, const char* end)
+	{
+		mChunk.fields.reserve(static_cast<size_t>(end - begin) / 8);
+		const char* field_start = begin;
+		uint64_t inside_carry = 0;
+		CsvMasks masks;
+		char tail[BLOCK];
+		for(const char* base = begin; base < end; base += BLOCK)
+		{
+			const char* block = base;
+			if(base + BLOCK > end)
+			{
+				//bytes past the end are zeros, never structural
+				memset(tail, 0, BLOCK);
+				memcpy(tail, base, static_cast<size_t>(end - base));
+				block = tail;
+			}
+			classify(block, mConfig.quote, mConfig.delimiter, masks);
+			const uint64_t inside = prefix_xor(masks.quote) ^ inside_carry;
+			inside_carry = static_cast<uint64_t>(static_cast<int64_t>(inside) >> 63);
+			uint64_t structural = (masks.delimiter | masks.newline) & ~inside;
+			while(structural != 0)
+			{
+				const int bit = __builtin_ctzll(structural);
+				field(field_start, base + bit, ((masks.newline >> bit) & 1) != 0);
+				field_start = base + bit + 1;
+				structural &= structural - 1;
+			}
+		}
+		//last record without a line feed
+		if( (field_start < end) || (mFields > 0) ) { field(field_start, end, true); }
+	}
+
+private:
+	const SQLiteCsvImportConfig&	mConfig;
+	const std::vector<bool>&		mNumeric;
+	CsvChunk&						mChunk;
+	size_t							mFields;//fields of the current record so far
+
+	void field(const char* begin, const char* end, bool end_of_record)
+	{
+		if( end_of_record && (end > begin) && (end[-1] == '\r') ) { --end; }
+		if( end_of_record && (mFields == 0) && (begin == end) ) { return; }//blank line
+		const size_t columns = mNumeric.size();
+		if(mFields < columns) { mChunk.fields.push_back(value(begin, end, mNumeric[mFields])); }
+		++mFields;
+		if(!end_of_record) { return; }
+		if(mFields != columns)
+		{
+			++mChunk.malformed;
+			for(; mFields < columns; ++mFields) { mChunk.fields.push_back({ nullptr, 0, SQLiteValueType::NULL_VALUE, { 0 } }); }
+		}
+		++mChunk.records;
+		mFields = 0;
+	}
+
+	CsvField value(const char* begin, const char* end, bool numeric)
+	{
+		CsvField result = { begin, static_cast<uint32_t>(end - begin), SQLiteValueType::TEXT, { 0 } };
+		if( (begin < end) && (*begin == mConfig.quote) )
+		{
+			const char* content = begin + 1;
+			const char* content_end = ( (end - 1 > begin) && (end[-1] == mConfig.quote) ) ? end - 1 : end;
+			result.data = content;
+			result.size = static_cast<uint32_t>(content_end - content);
+			if(memchr(content, mConfig.quote, result.size) != nullptr)
+			{
+				std::string text;
+				text.reserve(result.size);
+				for(const char* c = content; c < content_end; ++c)
+				{
+					text += *c;
+					if( (*c == mConfig.quote) && (c + 1 < content_end) && (c[1] == mConfig.quote) ) { ++c; }
+				}
+				mChunk.unescaped.push_back(std::move(text));
+				result.data = mChunk.unescaped.back().data();
+				result.size = static_cast<uint32_t>(mChunk.unescaped.back().size());
+			}
+			return result;
+		}
+		if( (begin == end) && mConfig.emptyIsNull ) { result.type = SQLiteValueType::NULL_VALUE; }
+		else if(numeric) { parse_number(begin, static_cast<size_t>(end - begin), result); }
+		return result;
+	}
+};
+
+/**
+ * Splits the record starting at data into fields
+ * @return The offset of the next record is returned
+ */
+static size_t parse_header(const char* data, size_t size, const SQLiteCsvImportConfig& config, std::vector<std::string>& names)
+{
+	std::string name;
+	bool inside = false;
+	size_t i = 0;
+	for(; i < size; ++i)
+	{
+		const char c = data[i];
+		if(c == config.quote)
+		{
+			if( inside && (i + 1 < size) && (data[i + 1] == config.quote) )
+			{
+				name += c;
+				++i;
+			}
+			else { inside = !inside; }
+		}
+		else if( !inside && (c == config.delimiter) )
+		{
+			names.push_back(name);
+			name.clear();
+		}
+		else if( !inside && (c == '\n') ) { break; }
+		else { name += c; }
+	}
+	if( !name.empty() && (name.back() == '\r') ) { name.pop_back(); }
+	names.push_back(name);
+	return std::min(i + 1, size);
+}
+
+//INTEGER, REAL and NUMERIC affinity (https://www.sqlite.org/datatype3.html#determination_of_column_affinity)
+static bool numeric_affinity(std::string declared)
+{
+	std::transform(declared.begin(), declared.end(), declared.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+	auto contains = [&declared](const char* part) { return declared.find(part) != std::string::npos; };
+	if(contains("INT")) { return true; }
+	if( contains("CHAR") || contains("CLOB") || contains("TEXT") || contains("BLOB") || declared.empty() ) { return false; }
+	return true;
+}
+
+struct CsvMapping
+{
+	int			file = -1;
+	const char*	data = nullptr;
+	size_t		size = 0;
+
+	~CsvMapping()
+	{
+		if(data != nullptr) { munmap(const_cast<char*>(data), size); }
+		if(file >= 0) { close(file); }
+	}
+};
+
+static void bind_field(SQLiteStatement& stmt, const CsvField& field, int32_t parameter)
+{
+	switch(field.type)
+	{
+		case SQLiteValueType::INTEGER: stmt.bind(field.integer, parameter); break;
+		case SQLiteValueType::FLOAT: stmt.bind(field.real, parameter); break;
+		case SQLiteValueType::TEXT: stmt.bindStatic(std::string_view(field.data, field.size), parameter); break;
+		default: stmt.bindNull(parameter); break;
+	}
+}
+
+SQLiteCode::Enum SQLiteCsv::importFile(SQLite& db, const std::string& table, const std::string& path,
+	const SQLiteCsvImportConfig& config, SQLiteCsvImportStats* stats)
+{
+	if(stats != nullptr) { *stats = { 0, 0, 0 }; }
+	if(!db.isOpen()) { return SQLiteCode::MISUSE; }
+	CsvMapping mapping;
+	struct stat info;
+	mapping.file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if( (mapping.file < 0) || (fstat(mapping.file, &info) != 0) ) { return SQLiteCode::CANTOPEN; }
+	mapping.size = static_cast<size_t>(info.st_size);
+	if(mapping.size > 0)
+	{
+		void* data = mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, mapping.file, 0);
+		if(data == MAP_FAILED) { return SQLiteCode::CANTOPEN; }
+		mapping.data = static_cast<const char*>(data);
+		madvise(data, mapping.size, MADV_SEQUENTIAL);
+	}
+	if(stats != nullptr) { stats->bytes = static_cast<int64_t>(mapping.size); }
+
+	//columns of the table and of the file
+	std::vector<std::pair<std::string, std::string>> table_columns;
+	auto table_info = db.prepare("SELECT name, type FROM pragma_table_info(?1)");
+	if(!*table_info) { return table_info->errorCode(); }
+	table_info->bind(table, 1).evaluate([&table_columns](SQLiteRow& row)
+	{
+		table_columns.emplace_back(row[0].asString(), row[1].asString());
+		return true;
+	});
+	std::vector<std::string> columns;
+	size_t body = 0;
+	if(config.header && (mapping.size > 0)) { body = parse_header(mapping.data, mapping.size, config, columns); }
+	if(columns.empty())
+	{
+		if(table_columns.empty()) { return SQLiteCode::ERROR; }
+		for(const auto& column : table_columns) { columns.push_back(column.first); }
+	}
+	else if(table_columns.empty())
+	{
+		std::string create = "CREATE TABLE " + SQLite::quoteIdentifier(table) + " (";
+		for(size_t i = 0; i < columns.size(); ++i) { create += ( (i > 0) ? " TEXT, " : "" ) + SQLite::quoteIdentifier(columns[i]); }
+		const SQLiteCode::Enum created = db.execute(create + " TEXT)");
+		if(created != SQLiteCode::DONE) { return created; }
+		for(const auto& column : columns) { table_columns.emplace_back(column, "TEXT"); }
+	}
+	std::vector<bool> numeric;
+	for(const auto& column : columns)
+	{
+		auto it = std::find_if(table_columns.begin(), table_columns.end(), [&column](const std::pair<std::string, std::string>& candidate)
+		{ return sqlite3_stricmp(candidate.first.c_str(), column.c_str()) == 0; });
+		if(it == table_columns.end()) { return SQLiteCode::MISMATCH; }
+		numeric.push_back(numeric_affinity(it->second));
+	}
+
+	//chunks start at the first record boundary after their offset, found with the quote parity before it
+	const size_t chunk_size = std::max<size_t>(config.chunkSize, BLOCK);
+	const size_t chunks = (mapping.size - body + chunk_size - 1) / chunk_size;
+	const size_t threads = std::max<size_t>(1, std::min<size_t>(chunks, (config.threads > 0) ? config.threads : std::thread::hardware_concurrency()));
+	std::vector<size_t> starts(chunks + 1, mapping.size);
+	{
+		std::vector<size_t> quotes(chunks, 0);
+		std::atomic<size_t> next(0);
+		auto count = [&]()
+		{
+			for(size_t k = next++; k < chunks; k = next++)
+			{
+				const char* begin = mapping.data + body + k * chunk_size;
+				quotes[k] = count_quotes(begin, std::min(begin + chunk_size, mapping.data + mapping.size), config.quote);
+			}
+		};
+		std::vector<std::thread> workers;
+		for(size_t i = 1; i < threads; ++i) { workers.emplace_back(count); }
+		count();
+		for(auto& worker : workers) { worker.join(); }
+		size_t parity = 0;
+		if(chunks > 0) { starts[0] = body; }
+		for(size_t k = 1; k < chunks; ++k)
+		{
+			parity += quotes[k - 1];
+			starts[k] = record_start(mapping.data, mapping.size, body + k * chunk_size, (parity & 1) != 0, config.quote);
+			starts[k] = std::max(starts[k], starts[k - 1]);
+		}
+	}
+
+	//threads parse chunks ahead of the writer, at most window of them wait to be inserted
+	SQLiteBulkInsert insert(db, table, columns, config.rowsPerInsert, config.rowsPerTransaction);
+	SQLiteCode::Enum error_code = insert.errorCode();
+	const size_t window = 2 * threads;
+	std::mutex mutex;
+	std::condition_variable parsed;
+	std::condition_variable consumed;
+	std::vector<std::unique_ptr<CsvChunk>> results(chunks);
+	size_t next_chunk = 0;
+	size_t written = 0;
+	bool stop = (error_code != SQLiteCode::OK);
+	auto parse = [&]()
+	{
+		for(;;)
+		{
+			size_t k = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				consumed.wait(lock, [&]() { return stop || (next_chunk >= chunks) || (next_chunk < written + window); });
+				if( stop || (next_chunk >= chunks) ) { return; }
+				k = next_chunk++;
+			}
+			auto chunk = std::make_unique<CsvChunk>();
+			CsvParser(config, numeric, *chunk).parse(mapping.data + starts[k], mapping.data + starts[k + 1]);
+			std::lock_guard<std::mutex> lock(mutex);
+			results[k] = std::move(chunk);
+			parsed.notify_all();
+		}
+	};
+	std::vector<std::thread> workers;
+	for(size_t i = 0; i < threads; ++i) { workers.emplace_back(parse); }
+	int64_t malformed = 0;
+	const size_t width = columns.size();
+	for(size_t k = 0; (k < chunks) && (error_code == SQLiteCode::OK); ++k)
+	{
+		std::unique_ptr<CsvChunk> chunk;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			parsed.wait(lock, [&]() { return results[k] != nullptr; });
+			chunk = std::move(results[k]);
+		}
+		malformed += static_cast<int64_t>(chunk->malformed);
+		for(size_t row = 0; (row < chunk->records) && (error_code == SQLiteCode::OK); )
+		{
+			const size_t count = std::min(insert.rowsPerInsert(), chunk->records - row);
+			SQLiteStatement* stmt = insert.statement(count);
+			if(stmt == nullptr)
+			{
+				error_code = insert.errorCode();
+				break;
+			}
+			const CsvField* field = chunk->fields.data() + row * width;
+			for(size_t i = 0; i < count * width; ++i) { bind_field(*stmt, field[i], static_cast<int32_t>(i + 1)); }
+			error_code = insert.execute(count);
+			row += count;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		written = k + 1;
+		consumed.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		consumed.notify_all();
+	}
+	for(auto& worker : workers) { worker.join(); }
+	error_code = insert.finish(error_code);
+	if(stats != nullptr)
+	{
+		stats->rows = insert.rows();
+		stats->malformedRows = malformed;
+	}
+	return error_code;
+}
+
+}
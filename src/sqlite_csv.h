@@ -0,0 +1,51 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_CSV_H_
+#define COMPONENTS_DATABASE_SQLITE_CSV_H_
+
+#include <cstdint>
+#include <string>
+#include "sqlite.h"
+
+namespace database
+{
+	struct SQLiteCsvImportConfig
+	{
+		char	delimiter = ',';				//'\t' for TSV
+		char	quote = '"';					//quotes in quoted fields are doubled
+		bool	header = true;					//the first record names the columns
+		bool	emptyIsNull = true;				//unquoted empty fields are NULL, empty text otherwise
+		size_t	threads = 0;					//parsing threads, the hardware concurrency when 0
+		size_t	chunkSize = 8 << 20;			//bytes parsed by a thread at once
+		size_t	rowsPerInsert = 256;
+		size_t	rowsPerTransaction = 500000;
+	};
+
+	struct SQLiteCsvImportStats
+	{
+		int64_t	rows;
+		int64_t	malformedRows;	//records with another number of fields than columns, padded with NULL or cut
+		int64_t	bytes;
+	};
+
+	/**
+	 * Bulk import of CSV and TSV files
+	 */
+	class SQLiteCsv
+	{
+	public:
+		/**
+		 * Imports a CSV file (RFC 4180: quoted fields may hold delimiters, line breaks and doubled quotes) into the table
+		 * With a header the fields are inserted into the columns it names, a table that does not exist is created with
+		 * TEXT columns. Without a header the table must exist and its columns are filled in order.
+		 * The file is memory-mapped and split into chunks parsed on several threads, the quote and delimiter structure
+		 * of 64 bytes at a time is found with SIMD compares. Fields of columns with INTEGER, REAL or NUMERIC affinity
+		 * are parsed into numbers by the threads, other fields are bound as text straight from the mapping. A single
+		 * writer inserts the rows in order through SQLiteBulkInsert, a failure keeps the rows committed before it.
+		 * @return An SQLiteCode is returned, CANTOPEN if the file cannot be read, MISMATCH for a header naming a column
+		 * the table does not have
+		 */
+		static SQLiteCode::Enum importFile(SQLite& db, const std::string& table, const std::string& path,
+			const SQLiteCsvImportConfig& config = SQLiteCsvImportConfig(), SQLiteCsvImportStats* stats = nullptr);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_CSV_H_ */
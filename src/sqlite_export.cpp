@@ -0,0 +1,576 @@
+#include "sqlite_export.h"
+#include "sqlite_uring.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace database
+{
+
+static const size_t ALIGNMENT = 4096;
+static const size_t MAX_RESERVE = 64;//longest piece formatted in place, a number or 32 bytes of hex
+
+static bool pwrite_all(int fd, const char* data, size_t size, uint64_t offset)
+{
+	while(size > 0)
+	{
+		const ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+		if(written < 0)
+		{
+			if(errno == EINTR) { continue; }
+			return false;
+		}
+		data += written;
+		size -= static_cast<size_t>(written);
+		offset += static_cast<uint64_t>(written);
+	}
+	return true;
+}
+
+static bool writev_all(int fd, iovec* iov, size_t count)
+{
+	while(count > 0)
+	{
+		const ssize_t written = writev(fd, iov, static_cast<int>(std::min<size_t>(count, IOV_MAX)));
+		if(written < 0)
+		{
+			if(errno == EINTR) { continue; }
+			return false;
+		}
+		size_t left = static_cast<size_t>(written);
+		while( (count > 0) && (left >= iov->iov_len) )
+		{
+			left -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+			iov->iov_len -= left;
+		}
+	}
+	return true;
+}
+
+/**
+ * Page aligned output buffers handed to the kernel as they fill up
+ * A regular file gets every full buffer written at its offset through io_uring while the next ones are filled, other
+ * descriptors gather the full buffers and write them with one writev once all of them are full.
+ * After a failure writing, output is discarded and errorCode() tells why.
+ */
+class ExportWriter
+{
+public:
+	ExportWriter(int fd, const SQLiteExportConfig& config)
+		: mFd(fd)
+		, mCapacity((std::max<size_t>(config.bufferSize, ALIGNMENT) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+		, mBuffers(std::max<size_t>(config.buffers, 2))
+		, mCurrent(0)
+		, mPos(nullptr)
+		, mEnd(nullptr)
+		, mRing()
+		, mUseRing(false)
+		, mInFlight(0)
+		, mOffset(0)
+		, mPending()
+		, mBytes(0)
+		, mErrorCode(SQLiteCode::OK)
+	{
+		for(auto& buffer : mBuffers)
+		{
+			if(posix_memalign(reinterpret_cast<void**>(&buffer.data), ALIGNMENT, mCapacity) != 0)
+			{
+				buffer.data = nullptr;
+				mErrorCode = SQLiteCode::NOMEM;
+				return;
+			}
+		}
+		mPos = mBuffers[0].data;
+		mEnd = mPos + mCapacity;
+		//offsets of O_APPEND files are ignored, their writes have to be issued in order
+		struct stat info;
+		const off_t position = lseek(fd, 0, SEEK_CUR);
+		if( config.useUring && (position >= 0) && (fstat(fd, &info) == 0) && S_ISREG(info.st_mode) && ((fcntl(fd, F_GETFL) & O_APPEND) == 0) )
+		{
+			mOffset = static_cast<uint64_t>(position);
+			mUseRing = mRing.init(static_cast<uint32_t>(mBuffers.size()));
+		}
+	}
+
+	ExportWriter(const ExportWriter& other) = delete;
+	ExportWriter& operator=(const ExportWriter& other) = delete;
+
+	~ExportWriter()
+	{
+		while( (mInFlight > 0) && reap() ) {}
+		//buffers the kernel may still read from are leaked rather than freed
+		for(auto& buffer : mBuffers)
+		{
+			if(!buffer.inFlight) { free(buffer.data); }
+		}
+	}
+
+	inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+	inline bool valid() const { return mErrorCode == SQLiteCode::OK; }
+	inline int64_t bytes() const { return mBytes + (mPos - mBuffers[mCurrent].data); }
+
+	/**
+	 * Returns room for size bytes (at most MAX_RESERVE), commit() the end of what was written
+	 */
+	inline char* reserve(size_t size)
+	{
+		if(static_cast<size_t>(mEnd - mPos) < size) { next(); }
+		return mPos;
+	}
+
+	inline void commit(char* end) { mPos = end; }
+
+	inline void put(char c)
+	{
+		if(mPos == mEnd) { next(); }
+		*mPos++ = c;
+	}
+
+	void append(const char* data, size_t size)
+	{
+		while(size > 0)
+		{
+			if(mPos == mEnd) { next(); }
+			const size_t count = std::min(size, static_cast<size_t>(mEnd - mPos));
+			memcpy(mPos, data, count);
+			mPos += count;
+			data += count;
+			size -= count;
+		}
+	}
+
+	/**
+	 * Writes what is buffered and waits for every write, the position of a file is moved past the output
+	 */
+	SQLiteCode::Enum finish()
+	{
+		if(mPos == nullptr) { return mErrorCode; }
+		flush();
+		while( (mInFlight > 0) && reap() ) {}
+		if( (mErrorCode == SQLiteCode::OK) && !mPending.empty() && !writev_all(mFd, mPending.data(), mPending.size()) )
+		{ mErrorCode = SQLiteCode::IOERR; }
+		mPending.clear();
+		if( mUseRing && (mErrorCode == SQLiteCode::OK) && (lseek(mFd, static_cast<off_t>(mOffset), SEEK_SET) < 0) )
+		{ mErrorCode = SQLiteCode::IOERR; }
+		mPos = mBuffers[mCurrent].data;
+		return mErrorCode;
+	}
+
+private:
+	struct Buffer
+	{
+		char*		data = nullptr;
+		size_t		size = 0;
+		uint64_t	offset = 0;
+		bool		inFlight = false;
+		iovec		iov;
+	};
+
+	const int				mFd;
+	const size_t			mCapacity;
+	std::vector<Buffer>		mBuffers;
+	size_t					mCurrent;
+	char*					mPos;
+	char*					mEnd;
+	SQLiteUring				mRing;
+	bool					mUseRing;
+	size_t					mInFlight;
+	uint64_t				mOffset;//file offset of the next buffer written through the ring
+	std::vector<iovec>		mPending;//full buffers waiting for writev
+	int64_t					mBytes;//bytes of the buffers handed off
+	SQLiteCode::Enum		mErrorCode;
+
+	/**
+	 * Hands the current buffer off
+	 */
+	void flush()
+	{
+		Buffer& buffer = mBuffers[mCurrent];
+		buffer.size = static_cast<size_t>(mPos - buffer.data);
+		mBytes += static_cast<int64_t>(buffer.size);
+		if( (buffer.size == 0) || (mErrorCode != SQLiteCode::OK) ) { return; }
+		if(mUseRing)
+		{
+			buffer.iov.iov_base = buffer.data;
+			buffer.iov.iov_len = buffer.size;
+			buffer.offset = mOffset;
+			mOffset += buffer.size;
+			if( !mRing.writev(mFd, &buffer.iov, 1, buffer.offset, mCurrent) || (mRing.submit(0) != 1) )
+			{
+				mErrorCode = SQLiteCode::IOERR;
+				return;
+			}
+			buffer.inFlight = true;
+			++mInFlight;
+		}
+		else
+		{
+			mPending.push_back({ buffer.data, buffer.size });
+			if(mPending.size() == mBuffers.size())
+			{
+				if(!writev_all(mFd, mPending.data(), mPending.size())) { mErrorCode = SQLiteCode::IOERR; }
+				mPending.clear();
+			}
+		}
+	}
+
+	/**
+	 * Hands the current buffer off and continues in the next one, once its previous write completed
+	 */
+	void next()
+	{
+		flush();
+		mCurrent = (mCurrent + 1) % mBuffers.size();
+		while( mBuffers[mCurrent].inFlight && reap() ) {}
+		if(mBuffers[mCurrent].inFlight) { mErrorCode = SQLiteCode::IOERR; }
+		mPos = mBuffers[mCurrent].data;
+		mEnd = mPos + mCapacity;
+	}
+
+	/**
+	 * Waits for one write of the ring, a short write is completed with pwrite
+	 */
+	bool reap()
+	{
+		uint64_t index = 0;
+		int32_t result = 0;
+		if(!mRing.complete(index, result, true))
+		{
+			mErrorCode = SQLiteCode::IOERR;
+			return false;
+		}
+		Buffer& buffer = mBuffers[index];
+		buffer.inFlight = false;
+		--mInFlight;
+		if( (result < 0) || ( (static_cast<size_t>(result) < buffer.size) &&
+			!pwrite_all(mFd, buffer.data + result, buffer.size - static_cast<size_t>(result), buffer.offset + static_cast<uint64_t>(result)) ) )
+		{ mErrorCode = SQLiteCode::IOERR; }
+		return true;
+	}
+};
+
+/**
+ * Characters a text scan stops at, control characters are those below 0x20
+ */
+struct EscapeSet
+{
+	char	first;
+	char	second;
+	char	third;
+	char	fourth;
+	bool	controls;
+};
+
+/**
+ * Returns the offset of the first character of the set, size if there is none
+ */
+static inline size_t find_escape(const char* data, size_t size, const EscapeSet& set)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i first = _mm256_set1_epi8(set.first);
+	const __m256i second = _mm256_set1_epi8(set.second);
+	const __m256i third = _mm256_set1_epi8(set.third);
+	const __m256i fourth = _mm256_set1_epi8(set.fourth);
+	const __m256i control = _mm256_set1_epi8(0x1F);
+	for(; i + 32 <= size; i += 32)
+	{
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, first), _mm256_cmpeq_epi8(bytes, second)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(bytes, third), _mm256_cmpeq_epi8(bytes, fourth)));
+		if(set.controls) { hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, control), control)); }
+		const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+		if(mask != 0) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+	}
+#elif defined(__SSE2__)
+	const __m128i first = _mm_set1_epi8(set.first);
+	const __m128i second = _mm_set1_epi8(set.second);
+	const __m128i third = _mm_set1_epi8(set.third);
+	const __m128i fourth = _mm_set1_epi8(set.fourth);
+	const __m128i control = _mm_set1_epi8(0x1F);
+	for(; i + 16 <= size; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second)),
+			_mm_or_si128(_mm_cmpeq_epi8(bytes, third), _mm_cmpeq_epi8(bytes, fourth)));
+		if(set.controls) { hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control)); }
+		const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+		if(mask != 0) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+	}
+#endif
+	for(; i < size; ++i)
+	{
+		const char c = data[i];
+		if( (c == set.first) || (c == set.second) || (c == set.third) || (c == set.fourth) ||
+			(set.controls && (static_cast<unsigned char>(c) < 0x20)) )
+		{ return i; }
+	}
+	return size;
+}
+
+static char* format_real(char* out, double value, bool json)
+{
+	if(!std::isfinite(value))
+	{
+		const char* text = json ? "null" : ( (value < 0) ? "-Inf" : "Inf" );
+		const size_t size = strlen(text);
+		memcpy(out, text, size);
+		return out + size;
+	}
+#if defined(__cpp_lib_to_chars)
+	char* end = std::to_chars(out, out + 32, value).ptr;
+#else
+	//floating point to_chars is missing before GCC 11, the shortest of 15 and 17 digits that round trips
+	int size = snprintf(out, 32, "%.15g", value);
+	if(strtod(out, nullptr) != value) { size = snprintf(out, 32, "%.17g", value); }
+	char* end = out + size;
+#endif
+	//a real keeps a fraction so it reads back as a real, as SQLite formats it
+	if(std::find_if(out, end, [](char c) { return (c == '.') || (c == 'e') || (c == 'E'); }) == end)
+	{
+		*end++ = '.';
+		*end++ = '0';
+	}
+	return end;
+}
+
+static void write_hex(ExportWriter& writer, const unsigned char* data, size_t size)
+{
+	static const char DIGITS[] = "0123456789abcdef";
+	while(size > 0)
+	{
+		const size_t count = std::min(size, MAX_RESERVE / 2);
+		char* out = writer.reserve(count * 2);
+		for(size_t i = 0; i < count; ++i)
+		{
+			*out++ = DIGITS[data[i] >> 4];
+			*out++ = DIGITS[data[i] & 0x0F];
+		}
+		writer.commit(out);
+		data += count;
+		size -= count;
+	}
+}
+
+static void write_csv_text(ExportWriter& writer, const char* data, size_t size, const EscapeSet& set)
+{
+	//empty text is quoted, an empty field is NULL
+	if( (size > 0) && (find_escape(data, size, set) == size) )
+	{
+		writer.append(data, size);
+		return;
+	}
+	writer.put('"');
+	while(const char* quote = static_cast<const char*>(memchr(data, '"', size)))
+	{
+		const size_t count = static_cast<size_t>(quote - data) + 1;
+		writer.append(data, count);
+		writer.put('"');
+		data += count;
+		size -= count;
+	}
+	writer.append(data, size);
+	writer.put('"');
+}
+
+static void write_json_text(ExportWriter& writer, const char* data, size_t size, const EscapeSet& set)
+{
+	static const char DIGITS[] = "0123456789abcdef";
+	writer.put('"');
+	for(;;)
+	{
+		const size_t count = find_escape(data, size, set);
+		writer.append(data, count);
+		if(count == size) { break; }
+		const unsigned char c = static_cast<unsigned char>(data[count]);
+		char* out = writer.reserve(6);
+		*out++ = '\\';
+		switch(c)
+		{
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '\n': *out++ = 'n'; break;
+			case '\r': *out++ = 'r'; break;
+			case '\t': *out++ = 't'; break;
+			case '\b': *out++ = 'b'; break;
+			case '\f': *out++ = 'f'; break;
+			default:
+				memcpy(out, "u00", 3);
+				out[3] = DIGITS[c >> 4];
+				out[4] = DIGITS[c & 0x0F];
+				out += 5;
+				break;
+		}
+		writer.commit(out);
+		data += count + 1;
+		size -= count + 1;
+	}
+	writer.put('"');
+}
+
+static void write_csv_rows(SQLiteStatement& stmt, ExportWriter& writer, const SQLiteExportConfig& config, int64_t& rows)
+{
+	const EscapeSet set = { config.delimiter, '"', '\r', '\n', false };
+	sqlite3_stmt* native = stmt.native();
+	const int32_t columns = sqlite3_column_count(native);
+	if(config.header)
+	{
+		for(int32_t col = 0; col < columns; ++col)
+		{
+			if(col > 0) { writer.put(config.delimiter); }
+			const char* name = sqlite3_column_name(native, col);
+			write_csv_text(writer, name, strlen(name), set);
+		}
+		writer.put('\n');
+	}
+	while( writer.valid() && stmt.step() )
+	{
+		for(int32_t col = 0; col < columns; ++col)
+		{
+			if(col > 0) { writer.put(config.delimiter); }
+			switch(sqlite3_column_type(native, col))
+			{
+				case SQLITE_INTEGER:
+				{
+					char* out = writer.reserve(MAX_RESERVE);
+					writer.commit(std::to_chars(out, out + MAX_RESERVE, static_cast<int64_t>(sqlite3_column_int64(native, col))).ptr);
+					break;
+				}
+				case SQLITE_FLOAT: writer.commit(format_real(writer.reserve(MAX_RESERVE), sqlite3_column_double(native, col), false)); break;
+				case SQLITE_TEXT:
+				{
+					const char* text = reinterpret_cast<const char*>(sqlite3_column_text(native, col));
+					write_csv_text(writer, text, static_cast<size_t>(sqlite3_column_bytes(native, col)), set);
+					break;
+				}
+				case SQLITE_BLOB:
+				{
+					const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(native, col));
+					write_hex(writer, blob, static_cast<size_t>(sqlite3_column_bytes(native, col)));
+					break;
+				}
+				default: break;
+			}
+		}
+		writer.put('\n');
+		++rows;
+	}
+}
+
+static void write_json_rows(SQLiteStatement& stmt, ExportWriter& writer, int64_t& rows)
+{
+	const EscapeSet set = { '"', '\\', '"', '"', true };
+	sqlite3_stmt* native = stmt.native();
+	const int32_t columns = sqlite3_column_count(native);
+	//{"a": and ,"b": written ahead of the values, escaped once
+	std::vector<std::string> keys(static_cast<size_t>(columns));
+	for(int32_t col = 0; col < columns; ++col)
+	{
+		const char* name = sqlite3_column_name(native, col);
+		std::string& key = keys[static_cast<size_t>(col)];
+		key = (col > 0) ? ",\"" : "{\"";
+		for(const char* c = name; *c != '\0'; ++c)
+		{
+			const unsigned char u = static_cast<unsigned char>(*c);
+			if( (u == '"') || (u == '\\') ) { key += '\\'; }
+			if(u < 0x20)
+			{
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", u);
+				key += escaped;
+			}
+			else { key += *c; }
+		}
+		key += "\":";
+	}
+	while( writer.valid() && stmt.step() )
+	{
+		if(columns == 0) { writer.put('{'); }
+		for(int32_t col = 0; col < columns; ++col)
+		{
+			const std::string& key = keys[static_cast<size_t>(col)];
+			writer.append(key.data(), key.size());
+			switch(sqlite3_column_type(native, col))
+			{
+				case SQLITE_INTEGER:
+				{
+					char* out = writer.reserve(MAX_RESERVE);
+					writer.commit(std::to_chars(out, out + MAX_RESERVE, static_cast<int64_t>(sqlite3_column_int64(native, col))).ptr);
+					break;
+				}
+				case SQLITE_FLOAT: writer.commit(format_real(writer.reserve(MAX_RESERVE), sqlite3_column_double(native, col), true)); break;
+				case SQLITE_TEXT:
+				{
+					const char* text = reinterpret_cast<const char*>(sqlite3_column_text(native, col));
+					write_json_text(writer, text, static_cast<size_t>(sqlite3_column_bytes(native, col)), set);
+					break;
+				}
+				case SQLITE_BLOB:
+				{
+					const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(native, col));
+					writer.put('"');
+					write_hex(writer, blob, static_cast<size_t>(sqlite3_column_bytes(native, col)));
+					writer.put('"');
+					break;
+				}
+				default: writer.append("null", 4); break;
+			}
+		}
+		writer.append("}\n", 2);
+		++rows;
+	}
+}
+
+SQLiteCode::Enum SQLiteExport::write(const SQLiteStmt_sptr& stmt, int fd, const SQLiteExportConfig& config, SQLiteExportStats* stats)
+{
+	if(stats != nullptr) { *stats = { 0, 0 }; }
+	if(!stmt) { return SQLiteCode::MISUSE; }
+	if(stmt->native() == nullptr) { return stmt->errorCode(); }
+	ExportWriter writer(fd, config);
+	if(!writer.valid()) { return writer.errorCode(); }
+	int64_t rows = 0;
+	if(config.format == SQLiteExportFormat::JSON_LINES) { write_json_rows(*stmt, writer, rows); }
+	else { write_csv_rows(*stmt, writer, config, rows); }
+	SQLiteCode::Enum error_code = writer.finish();
+	if(error_code == SQLiteCode::OK) { error_code = stmt->errorCode(); }
+	if(stats != nullptr)
+	{
+		stats->rows = rows;
+		stats->bytes = writer.bytes();
+	}
+	return error_code;
+}
+
+SQLiteCode::Enum SQLiteExport::writeFile(const SQLiteStmt_sptr& stmt, const std::string& path, const SQLiteExportConfig& config,
+	SQLiteExportStats* stats)
+{
+	if(stats != nullptr) { *stats = { 0, 0 }; }
+	const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0) { return SQLiteCode::CANTOPEN; }
+	SQLiteCode::Enum error_code = write(stmt, fd, config, stats);
+	if( (close(fd) != 0) && (error_code == SQLiteCode::OK) ) { error_code = SQLiteCode::IOERR; }
+	return error_code;
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_EXPORT_H_
+#define COMPONENTS_DATABASE_SQLITE_EXPORT_H_
+
+#include <cstdint>
+#include <string>
+#include "sqlite.h"
+
+namespace database
+{
+	struct SQLiteExportFormat
+	{
+		enum Enum
+		{
+			CSV			= 1,	//RFC 4180, a header record with the column names
+			JSON_LINES	= 2		//one JSON object per row keyed by the column names
+		};
+	};
+
+	struct SQLiteExportConfig
+	{
+		SQLiteExportFormat::Enum	format = SQLiteExportFormat::CSV;
+		char						delimiter = ',';		//CSV: '\t' for TSV
+		bool						header = true;			//CSV: first record names the columns
+		size_t						bufferSize = 1 << 20;	//bytes of an output buffer, at least 4096
+		size_t						buffers = 4;			//buffers filled while others are being written
+		bool						useUring = true;		//write files through io_uring when available
+	};
+
+	struct SQLiteExportStats
+	{
+		int64_t	rows;
+		int64_t	bytes;
+	};
+
+	/**
+	 * Streams the rows of a statement out as CSV or JSON Lines
+	 */
+	class SQLiteExport
+	{
+	public:
+		/**
+		 * Writes the rows of the statement to the file descriptor (a file, pipe or socket), starting at its position
+		 * Values are formatted straight from the statement into page aligned buffers: integers and reals with
+		 * std::to_chars (reals round trip, 2.0 keeps its fraction), text is scanned 16 or 32 bytes at a time for the
+		 * characters that need quoting or escaping, blobs are written as hex digits. CSV writes NULL as an empty field
+		 * and empty text as "", so SQLiteCsv reads both back. JSON writes non-finite reals as null; text is expected to
+		 * be UTF-8 and is not validated.
+		 * Full buffers of a regular file are written at their offset through io_uring while the next ones are filled,
+		 * other descriptors (or without io_uring) gather the buffers into one writev.
+		 * A write error stops the export on the current row, the statement is left on that row until its next bind.
+		 * @return An SQLiteCode is returned, the error of the statement or IOERR if writing failed
+		 */
+		static SQLiteCode::Enum write(const SQLiteStmt_sptr& stmt, int fd, const SQLiteExportConfig& config = SQLiteExportConfig(),
+			SQLiteExportStats* stats = nullptr);
+		/**
+		 * Writes the rows of the statement into the file at path, created or truncated
+		 * @return An SQLiteCode is returned, CANTOPEN if the file cannot be created
+		 */
+		static SQLiteCode::Enum writeFile(const SQLiteStmt_sptr& stmt, const std::string& path,
+			const SQLiteExportConfig& config = SQLiteExportConfig(), SQLiteExportStats* stats = nullptr);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_EXPORT_H_ */
@@ -0,0 +1,108 @@
+#include "sqlite_hot_key_cache.h"
+#include <sqlite3.h>
+
+namespace database
+{
+
+static_assert( (SQLITE_INSERT == 18) && (SQLITE_UPDATE == 23) && (SQLITE_DELETE == 9), "update hook operation codes changed");
+
+SQLiteHotKeyCacheBase::SQLiteHotKeyCacheBase(SQLite& db, const std::string& table, const std::string& key_column, const std::string& columns, const SQLiteHotKeyCacheConfig& config)
+	: mDb(db)
+	, mTable(table)
+	, mConfig(config)
+	, mErrorCode(SQLiteCode::OK)
+	, mLoad()
+	, mRowidColumn(0)
+	, mKeyOf()
+	, mKeyIsRowid(false)
+	, mPendingRowids()
+	, mStats()
+	, mListener(0)
+	, mTotalChanges(0)
+	, mHookedChanges(0)
+	, mDataVersion()
+	, mLastDataVersion(-1)
+	, mLastCheck()
+{
+	if(!db.isOpen())
+	{
+		mErrorCode = SQLiteCode::CANTOPEN;
+		return;
+	}
+	//selecting the rowid fails for WITHOUT ROWID tables, the update hook does not report their changes
+	mLoad = db.prepare("SELECT " + columns + ", `rowid` FROM " + SQLite::quoteIdentifier(table) + " WHERE " + SQLite::quoteIdentifier(key_column) + " = ?1");
+	mKeyOf = db.prepare("SELECT " + SQLite::quoteIdentifier(key_column) + " FROM " + SQLite::quoteIdentifier(table) + " WHERE `rowid` = ?1");
+	mErrorCode = !mLoad->valid() ? mLoad->errorCode() : mKeyOf->errorCode();
+	if(!valid()) { return; }
+	mRowidColumn = sqlite3_column_count(mLoad->native()) - 1;
+
+	//an INTEGER PRIMARY KEY column is an alias of the rowid
+	auto info = db.prepare("SELECT SUM(`pk` > 0), MAX(`pk` = 1 AND upper(`type`) = 'INTEGER' AND `name` = ?1 COLLATE NOCASE) FROM pragma_table_info(?2)");
+	if(*info)
+	{
+		info->bind(key_column, 1).bind(table, 2);
+		if(auto row = info->step())
+		{ mKeyIsRowid = (row.value()[0].asInt64() == 1) && (row.value()[1].asInt64() == 1); }
+		finish(*info);
+	}
+	if( (sqlite3_stricmp(key_column.c_str(), "rowid") == 0) || (sqlite3_stricmp(key_column.c_str(), "oid") == 0) ||
+		(sqlite3_stricmp(key_column.c_str(), "_rowid_") == 0) )
+	{ mKeyIsRowid = true; }
+
+	if(config.externalWriters) { mDataVersion = db.prepare("PRAGMA data_version"); }
+	mTotalChanges = sqlite3_total_changes(db.native());
+	mListener = db.addUpdateListener([this](int operation, const char*, const char* changed_table, int64_t rowid)
+	{
+		++mHookedChanges;
+		if(sqlite3_stricmp(changed_table, mTable.c_str()) == 0) { onRowChanged(operation, rowid); }
+	});
+}
+
+SQLiteHotKeyCacheBase::~SQLiteHotKeyCacheBase()
+{
+	if(mListener != 0) { mDb.removeUpdateListener(mListener); }
+}
+
+SQLiteHotKeyCacheStats SQLiteHotKeyCacheBase::stats() const
+{
+	SQLiteHotKeyCacheStats result = mStats;
+	result.entries = size();
+	return result;
+}
+
+bool SQLiteHotKeyCacheBase::fillable() const
+{ return sqlite3_get_autocommit(mDb.native()) != 0; }
+
+void SQLiteHotKeyCacheBase::revalidate()
+{
+	auto now = std::chrono::steady_clock::now();
+	if( (mLastDataVersion >= 0) && (now - mLastCheck < mConfig.revalidate) ) { return; }
+	mLastCheck = now;
+	int64_t data_version = -1;
+	if(mDataVersion && *mDataVersion)
+	{
+		if(auto row = mDataVersion->step()) { data_version = row.value()[0].asInt64(); }
+		finish(*mDataVersion);
+	}
+	//another connection committed since the last check, or the version is unknown
+	if( (data_version < 0) || (data_version != mLastDataVersion) ) { clear(); }
+	mLastDataVersion = data_version;
+}
+
+void SQLiteHotKeyCacheBase::checkChanges()
+{
+	//truncation and WITHOUT ROWID tables change rows without passing the update hook, the rows are unknown
+	const int64_t total_changes = sqlite3_total_changes(mDb.native());
+	if(total_changes - mTotalChanges > mHookedChanges) { clear(); }
+	mTotalChanges = total_changes;
+	mHookedChanges = 0;
+}
+
+void SQLiteHotKeyCacheBase::finish(SQLiteStatement& stmt)
+{
+	//stepping a statement left on a row to its end closes the timed cycle, binding again needs a reset in any case
+	if(sqlite3_stmt_busy(stmt.native())) { stmt.step(); }
+	sqlite3_reset(stmt.native());
+}
+
+}
@@ -0,0 +1,382 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_HOT_KEY_CACHE_H_
+#define COMPONENTS_DATABASE_SQLITE_HOT_KEY_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "sqlite.h"
+
+namespace database
+{
+	struct SQLiteHotKeyCacheConfig
+	{
+		size_t						capacity = 1 << 16;		//cached keys, found and missing ones together
+		bool						negative = true;		//also cache keys without a row
+		bool						externalWriters = false;//other connections or processes write the table
+		std::chrono::milliseconds	revalidate{100};		//with external writers, PRAGMA data_version is checked at most this often
+	};
+
+	struct SQLiteHotKeyCacheStats
+	{
+		uint64_t	hits;
+		uint64_t	negativeHits;	//lookups answered by a cached missing key
+		uint64_t	misses;
+		uint64_t	invalidations;	//entries dropped because of changes
+		uint64_t	evictions;		//entries dropped for capacity
+		size_t		entries;
+	};
+
+	/**
+	 * Connection side of SQLiteHotKeyCache: statements, update listener and change tracking, independent of the key and row types
+	 */
+	class SQLiteHotKeyCacheBase
+	{
+	public:
+		SQLiteHotKeyCacheBase(const SQLiteHotKeyCacheBase& other) = delete;
+		SQLiteHotKeyCacheBase& operator=(const SQLiteHotKeyCacheBase& other) = delete;
+		virtual ~SQLiteHotKeyCacheBase();
+		/**
+		 * Returns the actual error code, the cache answers nothing when the table or columns could not be prepared
+		 * (e.g. WITHOUT ROWID tables, their changes are not reported by the update hook)
+		 */
+		inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+		inline bool valid() const { return errorCode() == SQLiteCode::OK; }
+		explicit operator bool() const noexcept { return valid(); }
+		/**
+		 * Returns true if the key column is the rowid (INTEGER PRIMARY KEY), changes are then mapped to keys directly
+		 */
+		inline bool keyIsRowid() const { return mKeyIsRowid; }
+		virtual void clear() = 0;
+		virtual size_t size() const = 0;
+		SQLiteHotKeyCacheStats stats() const;
+	protected:
+		//operations reported by the update hook (SQLITE_INSERT, SQLITE_UPDATE, SQLITE_DELETE)
+		static constexpr int ROW_INSERT = 18;
+		static constexpr int ROW_UPDATE = 23;
+		static constexpr int ROW_DELETE = 9;
+		SQLite&						mDb;
+		const std::string			mTable;
+		const SQLiteHotKeyCacheConfig mConfig;
+		SQLiteCode::Enum			mErrorCode;
+		SQLiteStmt_sptr				mLoad;//SELECT <columns>, rowid ... WHERE <key> = ?1
+		int32_t						mRowidColumn;
+		SQLiteStmt_sptr				mKeyOf;//SELECT <key> ... WHERE rowid = ?1
+		bool						mKeyIsRowid;
+		std::vector<int64_t>		mPendingRowids;//inserted or updated rows whose key is looked up before the next lookup
+		SQLiteHotKeyCacheStats		mStats;
+
+		SQLiteHotKeyCacheBase(SQLite& db, const std::string& table, const std::string& key_column, const std::string& columns, const SQLiteHotKeyCacheConfig& config);
+		/**
+		 * Returns false inside a transaction, rows read there may still be rolled back and are not cached
+		 */
+		bool fillable() const;
+		/**
+		 * Clears the cache if another connection committed since the last check
+		 */
+		void revalidate();
+		/**
+		 * Clears the cache if the connection changed rows the update hook did not report
+		 */
+		void checkChanges();
+		/**
+		 * Ends the evaluation of a statement stepped by hand, so it can be bound again and releases its read transaction
+		 */
+		static void finish(SQLiteStatement& stmt);
+		/**
+		 * Called from the update hook, the connection must not be used here
+		 */
+		virtual void onRowChanged(int operation, int64_t rowid) = 0;
+	private:
+		int32_t						mListener;
+		int64_t						mTotalChanges;//sqlite3_total_changes at the last lookup
+		int64_t						mHookedChanges;//rows of any table reported by the update hook since
+		SQLiteStmt_sptr				mDataVersion;
+		int64_t						mLastDataVersion;
+		std::chrono::steady_clock::time_point mLastCheck;
+	};
+
+	/**
+	 * Point lookup cache over one table, filled on read-through: key -> Row, or key -> missing
+	 * Entries live in an open-addressing table sized once from the capacity, probes scan a separate array of one byte
+	 * tags (64 slots per cache line) and only touch the slot whose tag matches. Full tables evict with a CLOCK hand.
+	 *
+	 * Changes through the connection are applied through its update hook: deleted and updated rows drop their key,
+	 * inserted and updated rows are looked up by rowid before the next lookup and drop the entry of their (new) key,
+	 * which also covers rows replaced by INSERT OR REPLACE on the key. Rows removed by REPLACE on another unique column
+	 * are not reported by SQLite and stay cached. A DELETE without WHERE truncates the table without reporting its rows
+	 * either, the next lookup finds sqlite3_total_changes ahead of the reported rows and clears the whole cache, as do
+	 * changes of WITHOUT ROWID tables of the connection. Rows read inside a transaction are returned but not cached.
+	 * With externalWriters, commits of other connections clear the whole cache within the revalidate interval.
+	 *
+	 * K is an integral, floating point or string type, Row has to be default constructible and copyable.
+	 * Not thread safe, like the connection it belongs to.
+	 */
+	template <typename K, typename Row>
+	class SQLiteHotKeyCache : public SQLiteHotKeyCacheBase
+	{
+	public:
+		/**
+		 * Builds the cached value out of a row of the selected columns, rowid follows as last column
+		 */
+		using Converter = std::function<Row (SQLiteRow& row)>;
+
+		/**
+		 * @param columns The column list selected for the converter, e.g. "`name`, `email`"
+		 */
+		SQLiteHotKeyCache(SQLite& db, const std::string& table, const std::string& key_column, const std::string& columns,
+			const Converter& convert, const SQLiteHotKeyCacheConfig& config = SQLiteHotKeyCacheConfig())
+			: SQLiteHotKeyCacheBase(db, table, key_column, columns, config)
+			, mConvert(convert)
+			, mShift(64)
+			, mMask(0)
+			, mMaxLoad(0)
+			, mUsed(0)
+			, mDeleted(0)
+			, mHand(0)
+		{
+			size_t slots = 16;
+			while(slots < config.capacity + config.capacity / 7 + 1) { slots <<= 1; }
+			for(size_t bits = slots; bits > 1; bits >>= 1) { --mShift; }
+			mMask = slots - 1;
+			mMaxLoad = slots - slots / 8;
+			mTags.assign(slots, EMPTY);
+			mSlots.resize(slots);
+		}
+
+		/**
+		 * Returns the row of the key, or nullopt if the table has no such key (or the cache is invalid)
+		 */
+		std::optional<Row> find(const K& key)
+		{
+			if(mConfig.externalWriters) { revalidate(); }
+			checkChanges();
+			if(!mPendingRowids.empty()) { resolvePending(); }
+			const uint64_t hash = hashOf(key);
+			const size_t index = lookup(key, hash);
+			if(index != NPOS)
+			{
+				Slot& slot = mSlots[index];
+				slot.referenced = true;
+				if(!slot.missing)
+				{
+					++mStats.hits;
+					return slot.row;
+				}
+				++mStats.negativeHits;
+				return std::nullopt;
+			}
+			return load(key, hash);
+		}
+		/**
+		 * Drops the entry of the key
+		 */
+		void invalidate(const K& key)
+		{
+			const size_t index = lookup(key, hashOf(key));
+			if(index != NPOS)
+			{
+				release(index);
+				++mStats.invalidations;
+			}
+		}
+		void clear() override
+		{
+			if(mUsed > 0) { mStats.invalidations += mUsed; }
+			for(size_t i = 0; i < mSlots.size(); ++i)
+			{
+				if(mTags[i] != EMPTY) { mSlots[i] = Slot(); }
+			}
+			mTags.assign(mTags.size(), EMPTY);
+			mRowKeys.clear();
+			mPendingRowids.clear();
+			mUsed = mDeleted = 0;
+		}
+		size_t size() const override { return mUsed; }
+	private:
+		static constexpr uint8_t EMPTY = 0;
+		static constexpr uint8_t DELETED = 1;
+		static constexpr size_t NPOS = ~size_t(0);
+		struct Slot
+		{
+			K		key{};
+			Row		row{};
+			int64_t	rowid = 0;
+			bool	missing = false;
+			bool	referenced = false;
+		};
+		Converter					mConvert;
+		std::vector<uint8_t>		mTags;//EMPTY, DELETED or 0x80 | 7 bits of the hash
+		std::vector<Slot>			mSlots;
+		uint32_t					mShift;//the top bits of the hash select the home slot
+		size_t						mMask;
+		size_t						mMaxLoad;//used and deleted slots before the table is rebuilt
+		size_t						mUsed;
+		size_t						mDeleted;
+		size_t						mHand;//CLOCK eviction position
+		std::unordered_map<int64_t, K> mRowKeys;//rowid -> key of the cached rows, unless the key is the rowid
+
+		static inline uint64_t hashOf(const K& key)
+		{ return static_cast<uint64_t>(std::hash<K>()(key)) * 0x9E3779B97F4A7C15ull; }
+		static inline uint8_t tagOf(uint64_t hash)
+		{ return static_cast<uint8_t>(0x80 | (hash & 0x7F)); }
+
+		size_t lookup(const K& key, uint64_t hash) const
+		{
+			const uint8_t tag = tagOf(hash);
+			for(size_t index = hash >> mShift; ; index = (index + 1) & mMask)
+			{
+				const uint8_t current = mTags[index];
+				if(current == EMPTY) { return NPOS; }
+				if( (current == tag) && (mSlots[index].key == key) ) { return index; }
+			}
+		}
+
+		std::optional<Row> load(const K& key, uint64_t hash)
+		{
+			++mStats.misses;
+			if(!valid()) { return std::nullopt; }
+			bind(*mLoad, key);
+			std::optional<Row> result;
+			int64_t rowid = 0;
+			if(auto row = mLoad->step())
+			{
+				rowid = row.value()[mRowidColumn].asInt64();
+				result = mConvert(row.value());
+			}
+			finish(*mLoad);
+			if( (mConfig.capacity > 0) && fillable() && (result || mConfig.negative) )
+			{ insert(key, hash, rowid, result); }
+			return result;
+		}
+
+		void insert(const K& key, uint64_t hash, int64_t rowid, const std::optional<Row>& row)
+		{
+			if(mUsed >= mConfig.capacity) { evict(); }
+			if(mUsed + mDeleted >= mMaxLoad) { rebuild(); }
+			size_t index = hash >> mShift;
+			while(mTags[index] > DELETED) { index = (index + 1) & mMask; }
+			if(mTags[index] == DELETED) { --mDeleted; }
+			mTags[index] = tagOf(hash);
+			Slot& slot = mSlots[index];
+			slot.key = key;
+			slot.rowid = rowid;
+			slot.missing = !row;
+			slot.referenced = false;
+			if(row)
+			{
+				slot.row = row.value();
+				if(!mKeyIsRowid) { mRowKeys[rowid] = key; }
+			}
+			++mUsed;
+		}
+
+		void release(size_t index)
+		{
+			Slot& slot = mSlots[index];
+			if( !slot.missing && !mKeyIsRowid ) { mRowKeys.erase(slot.rowid); }
+			slot = Slot();
+			//a slot followed by an empty one ends no probe sequence and can be emptied instead of marked
+			if(mTags[(index + 1) & mMask] == EMPTY) { mTags[index] = EMPTY; }
+			else
+			{
+				mTags[index] = DELETED;
+				++mDeleted;
+			}
+			--mUsed;
+		}
+
+		void evict()
+		{
+			//every used slot is passed at most twice: once clearing its reference bit, once evicting it
+			for(;;)
+			{
+				const size_t index = mHand;
+				mHand = (mHand + 1) & mMask;
+				if(mTags[index] <= DELETED) { continue; }
+				if(mSlots[index].referenced)
+				{
+					mSlots[index].referenced = false;
+					continue;
+				}
+				release(index);
+				++mStats.evictions;
+				return;
+			}
+		}
+
+		void rebuild()
+		{
+			std::vector<uint8_t> tags(mTags.size(), EMPTY);
+			std::vector<Slot> slots(mSlots.size());
+			for(size_t i = 0; i < mSlots.size(); ++i)
+			{
+				if(mTags[i] <= DELETED) { continue; }
+				size_t index = hashOf(mSlots[i].key) >> mShift;
+				while(tags[index] != EMPTY) { index = (index + 1) & mMask; }
+				tags[index] = mTags[i];
+				slots[index] = std::move(mSlots[i]);
+			}
+			mTags.swap(tags);
+			mSlots.swap(slots);
+			mDeleted = 0;
+		}
+
+		void onRowChanged(int operation, int64_t rowid) override
+		{
+			if constexpr (std::is_integral_v<K>)
+			{
+				if(mKeyIsRowid)
+				{
+					invalidate(static_cast<K>(rowid));
+					return;
+				}
+			}
+			if(operation != ROW_INSERT)
+			{
+				auto it = mRowKeys.find(rowid);
+				if(it != mRowKeys.end())
+				{
+					const K key = it->second;
+					invalidate(key);
+				}
+			}
+			if(operation != ROW_DELETE) { mPendingRowids.push_back(rowid); }
+		}
+
+		/**
+		 * Drops the entries of the current keys of rows inserted or updated since the last lookup
+		 */
+		void resolvePending()
+		{
+			for(int64_t rowid : mPendingRowids)
+			{
+				mKeyOf->bind(rowid, 1);
+				if(auto row = mKeyOf->step()) { invalidate(keyOf(row.value()[0])); }
+				finish(*mKeyOf);
+			}
+			mPendingRowids.clear();
+		}
+
+		static void bind(SQLiteStatement& stmt, const K& key)
+		{
+			if constexpr (std::is_integral_v<K>) { stmt.bind(static_cast<int64_t>(key), 1); }
+			else if constexpr (std::is_floating_point_v<K>) { stmt.bind(static_cast<double>(key), 1); }
+			else { stmt.bind(std::string(key), 1); }
+		}
+
+		static K keyOf(SQLiteColumn& column)
+		{
+			if constexpr (std::is_integral_v<K>) { return static_cast<K>(column.asInt64()); }
+			else if constexpr (std::is_floating_point_v<K>) { return static_cast<K>(column.asDouble()); }
+			else { return K(column.asString()); }
+		}
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_HOT_KEY_CACHE_H_ */
@@ -0,0 +1,143 @@
+#include "sqlite_io_stats.h"
+#include "sqlite_vfs.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace database
+{
+
+namespace
+{
+	struct FileCounters
+	{
+		std::atomic<uint64_t> reads{0};
+		std::atomic<uint64_t> writes{0};
+		std::atomic<uint64_t> syncs{0};
+		std::atomic<uint64_t> bytesRead{0};
+		std::atomic<uint64_t> bytesWritten{0};
+		std::atomic<int64_t> readNanos{0};
+		std::atomic<int64_t> writeNanos{0};
+		std::atomic<int64_t> syncNanos{0};
+	};
+
+	inline int64_t elapsed_nanos(std::chrono::steady_clock::time_point start)
+	{ return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(); }
+
+	class IoStatsShim : public SQLiteVfsShim
+	{
+	public:
+		std::mutex										mMutex;
+		std::map<std::string, std::unique_ptr<FileCounters>>	mFiles;
+
+		FileCounters& find(const std::string& path)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto& counters = mFiles[path];
+			if(!counters) { counters.reset(new FileCounters()); }
+			return *counters;
+		}
+	protected:
+		int onOpen(File* file, const char* name, int) override
+		{
+			//temporary files have no name, they are accounted together under an empty path
+			file->state = &find((name != nullptr) ? name : "");
+			return SQLITE_OK;
+		}
+
+		int read(File* file, void* buffer, int amount, sqlite3_int64 offset) override
+		{
+			auto start = std::chrono::steady_clock::now();
+			int error_code = SQLiteVfsShim::read(file, buffer, amount, offset);
+			FileCounters& counters = *static_cast<FileCounters*>(file->state);
+			counters.readNanos.fetch_add(elapsed_nanos(start), std::memory_order_relaxed);
+			counters.reads.fetch_add(1, std::memory_order_relaxed);
+			counters.bytesRead.fetch_add(amount, std::memory_order_relaxed);
+			return error_code;
+		}
+
+		int write(File* file, const void* buffer, int amount, sqlite3_int64 offset) override
+		{
+			auto start = std::chrono::steady_clock::now();
+			int error_code = SQLiteVfsShim::write(file, buffer, amount, offset);
+			FileCounters& counters = *static_cast<FileCounters*>(file->state);
+			counters.writeNanos.fetch_add(elapsed_nanos(start), std::memory_order_relaxed);
+			counters.writes.fetch_add(1, std::memory_order_relaxed);
+			counters.bytesWritten.fetch_add(amount, std::memory_order_relaxed);
+			return error_code;
+		}
+
+		int sync(File* file, int flags) override
+		{
+			auto start = std::chrono::steady_clock::now();
+			int error_code = SQLiteVfsShim::sync(file, flags);
+			FileCounters& counters = *static_cast<FileCounters*>(file->state);
+			counters.syncNanos.fetch_add(elapsed_nanos(start), std::memory_order_relaxed);
+			counters.syncs.fetch_add(1, std::memory_order_relaxed);
+			return error_code;
+		}
+	};
+
+	IoStatsShim& shim()
+	{
+		static IoStatsShim instance;
+		return instance;
+	}
+
+	SQLiteIoCounters snapshot(const std::string& path, const FileCounters& counters)
+	{
+		return { path
+			   , counters.reads.load(std::memory_order_relaxed)
+			   , counters.writes.load(std::memory_order_relaxed)
+			   , counters.syncs.load(std::memory_order_relaxed)
+			   , counters.bytesRead.load(std::memory_order_relaxed)
+			   , counters.bytesWritten.load(std::memory_order_relaxed)
+			   , std::chrono::nanoseconds(counters.readNanos.load(std::memory_order_relaxed))
+			   , std::chrono::nanoseconds(counters.writeNanos.load(std::memory_order_relaxed))
+			   , std::chrono::nanoseconds(counters.syncNanos.load(std::memory_order_relaxed)) };
+	}
+}
+
+SQLiteCode::Enum SQLiteIoStatsVfs::install(bool make_default)
+{
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+	if(shim().registered()) { return SQLiteCode::OK; }
+	return shim().registerVfs(NAME, std::string(), make_default);
+}
+
+SQLiteIoCounters SQLiteIoStatsVfs::counters(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(shim().mMutex);
+	auto it = shim().mFiles.find(path);
+	return (it != shim().mFiles.end()) ? snapshot(path, *it->second) : snapshot(path, FileCounters());
+}
+
+std::vector<SQLiteIoCounters> SQLiteIoStatsVfs::counters()
+{
+	std::vector<SQLiteIoCounters> result;
+	std::lock_guard<std::mutex> lock(shim().mMutex);
+	for(const auto& entry : shim().mFiles) { result.emplace_back(snapshot(entry.first, *entry.second)); }
+	return result;
+}
+
+void SQLiteIoStatsVfs::reset()
+{
+	//open files keep pointing at their counters, so they are zeroed instead of erased
+	std::lock_guard<std::mutex> lock(shim().mMutex);
+	for(auto& entry : shim().mFiles)
+	{
+		FileCounters& counters = *entry.second;
+		counters.reads = 0;
+		counters.writes = 0;
+		counters.syncs = 0;
+		counters.bytesRead = 0;
+		counters.bytesWritten = 0;
+		counters.readNanos = 0;
+		counters.writeNanos = 0;
+		counters.syncNanos = 0;
+	}
+}
+
+}
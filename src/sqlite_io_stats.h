@@ -0,0 +1,49 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_IO_STATS_H_
+#define COMPONENTS_DATABASE_SQLITE_IO_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	struct SQLiteIoCounters
+	{
+		std::string					file;
+		uint64_t					reads;
+		uint64_t					writes;
+		uint64_t					syncs;
+		uint64_t					bytesRead;
+		uint64_t					bytesWritten;
+		std::chrono::nanoseconds	readTime;
+		std::chrono::nanoseconds	writeTime;
+		std::chrono::nanoseconds	syncTime;
+	};
+
+	/**
+	 * I/O accounting VFS shim, counts reads, writes, syncs, bytes and time spent per file
+	 * Counters are kept per path, so they add up over every connection and survive closing the file
+	 * Reads served through memory mapping (PRAGMA mmap_size) do not reach the VFS and are not counted
+	 */
+	class SQLiteIoStatsVfs
+	{
+	public:
+		static constexpr const char* NAME = "iostats";
+		/**
+		 * Registers the shim over the current default VFS
+		 * @param make_default Routes connections opened without naming a VFS through the shim as well
+		 * @return An SQLiteCode is returned, registering again is a no-op
+		 */
+		static SQLiteCode::Enum install(bool make_default = false);
+		/**
+		 * Returns the counters of the given file, every counter is zero if it was not opened through the shim
+		 */
+		static SQLiteIoCounters counters(const std::string& path);
+		static std::vector<SQLiteIoCounters> counters();
+		static void reset();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_IO_STATS_H_ */
@@ -0,0 +1,313 @@
+#include "sqlite_page_cache.h"
+#include <sqlite3.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace database
+{
+
+namespace
+{
+	struct Page
+	{
+		sqlite3_pcache_page	base;//must be the first member, SQLite only sees this part
+		unsigned			key;
+		size_t				ringIndex;
+		bool				pinned;
+		bool				referenced;
+	};
+
+	struct Cache
+	{
+		std::mutex							mutex;
+		const int							pageSize;
+		const int							extraSize;
+		const bool							purgeable;
+		unsigned							maxPages;
+		std::unordered_map<unsigned, Page*>	pages;
+		std::vector<Page*>					ring;//CLOCK order
+		size_t								hand;
+		size_t								unpinned;
+
+		Cache(int page_size, int extra_size, bool is_purgeable)
+			: mutex(), pageSize(page_size), extraSize(extra_size), purgeable(is_purgeable)
+			, maxPages(100), pages(), ring(), hand(0), unpinned(0)
+		{}
+
+		inline size_t pageBytes() const { return sizeof(Page) + pageSize + extraSize; }
+	};
+
+	struct Pool
+	{
+		size_t					budget = 0;
+		std::atomic<size_t>		bytes{0};
+		std::atomic<uint64_t>	hits{0};
+		std::atomic<uint64_t>	misses{0};
+		std::atomic<uint64_t>	evictions{0};
+		std::mutex				registryMutex;
+		std::vector<Cache*>		caches;
+		size_t					victim = 0;
+	};
+
+	Pool gPool;
+
+	Page* allocate_page(Cache& cache)
+	{
+		char* memory = static_cast<char*>(malloc(cache.pageBytes()));
+		if(memory == nullptr) { return nullptr; }
+		gPool.bytes.fetch_add(cache.pageBytes(), std::memory_order_relaxed);
+		Page* page = reinterpret_cast<Page*>(memory);
+		page->base.pBuf = memory + sizeof(Page);
+		page->base.pExtra = memory + sizeof(Page) + cache.pageSize;
+		return page;
+	}
+
+	void free_page(Cache& cache, Page* page)
+	{
+		gPool.bytes.fetch_sub(cache.pageBytes(), std::memory_order_relaxed);
+		free(page);
+	}
+
+	/**
+	 * Removes the page from the lookup structures of its cache, the cache must be locked
+	 */
+	void detach_page(Cache& cache, Page* page)
+	{
+		cache.pages.erase(page->key);
+		Page* last = cache.ring.back();
+		cache.ring[page->ringIndex] = last;
+		last->ringIndex = page->ringIndex;
+		cache.ring.pop_back();
+		if(!page->pinned) { --cache.unpinned; }
+	}
+
+	void attach_page(Cache& cache, Page* page, unsigned key)
+	{
+		page->key = key;
+		page->pinned = true;
+		page->referenced = true;
+		page->ringIndex = cache.ring.size();
+		cache.ring.push_back(page);
+		cache.pages[key] = page;
+	}
+
+	/**
+	 * Runs the CLOCK hand over the cache and detaches the first unpinned, unreferenced page
+	 * @return The detached page or nullptr if every page is pinned, the cache must be locked
+	 */
+	Page* clock_evict(Cache& cache)
+	{
+		if( !cache.purgeable || (cache.unpinned == 0) ) { return nullptr; }
+		for(size_t i = 0; i < 2 * cache.ring.size(); ++i)
+		{
+			if(cache.hand >= cache.ring.size()) { cache.hand = 0; }
+			Page* page = cache.ring[cache.hand];
+			if(!page->pinned)
+			{
+				if(!page->referenced)
+				{
+					detach_page(cache, page);
+					gPool.evictions.fetch_add(1, std::memory_order_relaxed);
+					return page;
+				}
+				page->referenced = false;
+			}
+			++cache.hand;
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Frees one page of another connection's cache to get back under the budget
+	 * Caches locked by their owner are skipped, so no lock order between caches is needed
+	 */
+	void evict_elsewhere(Cache* self)
+	{
+		std::lock_guard<std::mutex> registry_lock(gPool.registryMutex);
+		for(size_t i = 0; i < gPool.caches.size(); ++i)
+		{
+			Cache* cache = gPool.caches[gPool.victim++ % gPool.caches.size()];
+			if( (cache == self) || !cache->mutex.try_lock() ) { continue; }
+			Page* page = clock_evict(*cache);
+			if(page != nullptr) { free_page(*cache, page); }
+			cache->mutex.unlock();
+			if(page != nullptr) { return; }
+		}
+	}
+
+	inline bool over_budget(const Cache& cache)
+	{ return gPool.bytes.load(std::memory_order_relaxed) + cache.pageBytes() > gPool.budget; }
+
+	int pcache_init(void*) { return SQLITE_OK; }
+
+	void pcache_shutdown(void*) {}
+
+	sqlite3_pcache* pcache_create(int page_size, int extra_size, int purgeable)
+	{
+		Cache* cache = new Cache(page_size, extra_size, purgeable != 0);
+		std::lock_guard<std::mutex> lock(gPool.registryMutex);
+		gPool.caches.push_back(cache);
+		return reinterpret_cast<sqlite3_pcache*>(cache);
+	}
+
+	void pcache_cachesize(sqlite3_pcache* handle, int max_pages)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		cache->maxPages = (max_pages > 0) ? static_cast<unsigned>(max_pages) : 0;
+	}
+
+	int pcache_pagecount(sqlite3_pcache* handle)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		return static_cast<int>(cache->pages.size());
+	}
+
+	sqlite3_pcache_page* pcache_fetch(sqlite3_pcache* handle, unsigned key, int create_flag)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		auto it = cache->pages.find(key);
+		if(it != cache->pages.end())
+		{
+			Page* page = it->second;
+			if(!page->pinned) { page->pinned = true; --cache->unpinned; }
+			page->referenced = true;
+			gPool.hits.fetch_add(1, std::memory_order_relaxed);
+			return &page->base;
+		}
+		gPool.misses.fetch_add(1, std::memory_order_relaxed);
+		if(create_flag == 0) { return nullptr; }
+
+		//reuse an own page when at cache_size or over the shared budget
+		Page* page = nullptr;
+		const bool full = cache->purgeable && (cache->pages.size() >= cache->maxPages);
+		if( full || (cache->purgeable && over_budget(*cache)) )
+		{
+			page = clock_evict(*cache);
+			if(page == nullptr)
+			{
+				//only "easy" allocations for create_flag 1, SQLite spills dirty pages and retries with 2
+				if(create_flag == 1) { return nullptr; }
+				if(over_budget(*cache)) { evict_elsewhere(cache); }
+			}
+		}
+		if(page == nullptr)
+		{
+			page = allocate_page(*cache);
+			if(page == nullptr) { return nullptr; }
+		}
+		//a zeroed extra area tells the pager that the page is new
+		memset(page->base.pExtra, 0, cache->extraSize);
+		attach_page(*cache, page, key);
+		return &page->base;
+	}
+
+	void pcache_unpin(sqlite3_pcache* handle, sqlite3_pcache_page* base, int discard)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		Page* page = reinterpret_cast<Page*>(base);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		if( discard || (cache->purgeable && (cache->pages.size() > cache->maxPages)) )
+		{
+			detach_page(*cache, page);
+			free_page(*cache, page);
+			return;
+		}
+		page->pinned = false;
+		++cache->unpinned;
+	}
+
+	void pcache_rekey(sqlite3_pcache* handle, sqlite3_pcache_page* base, unsigned old_key, unsigned new_key)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		Page* page = reinterpret_cast<Page*>(base);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		auto it = cache->pages.find(new_key);
+		if( (it != cache->pages.end()) && (it->second != page) )
+		{
+			//a page already using new_key is guaranteed to be unpinned
+			Page* stale = it->second;
+			detach_page(*cache, stale);
+			free_page(*cache, stale);
+		}
+		cache->pages.erase(old_key);
+		page->key = new_key;
+		cache->pages[new_key] = page;
+	}
+
+	void pcache_truncate(sqlite3_pcache* handle, unsigned limit)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		for(size_t i = cache->ring.size(); i > 0; --i)
+		{
+			Page* page = cache->ring[i - 1];
+			if(page->key >= limit)
+			{
+				//pages at or above the limit are implicitly unpinned
+				detach_page(*cache, page);
+				free_page(*cache, page);
+			}
+		}
+	}
+
+	void pcache_destroy(sqlite3_pcache* handle)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		{
+			std::lock_guard<std::mutex> registry_lock(gPool.registryMutex);
+			for(size_t i = 0; i < gPool.caches.size(); ++i)
+			{
+				if(gPool.caches[i] == cache)
+				{
+					gPool.caches[i] = gPool.caches.back();
+					gPool.caches.pop_back();
+					break;
+				}
+			}
+		}
+		//evict_elsewhere only touches caches while holding the registry lock, so nobody else can reach this one now
+		for(Page* page : cache->ring) { free_page(*cache, page); }
+		delete cache;
+	}
+
+	void pcache_shrink(sqlite3_pcache* handle)
+	{
+		Cache* cache = reinterpret_cast<Cache*>(handle);
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		for(size_t i = cache->ring.size(); i > 0; --i)
+		{
+			Page* page = cache->ring[i - 1];
+			if(!page->pinned)
+			{
+				detach_page(*cache, page);
+				free_page(*cache, page);
+			}
+		}
+	}
+}
+
+SQLiteCode::Enum SQLitePageCache::install(const SQLitePageCacheConfig& config)
+{
+	static const sqlite3_pcache_methods2 methods = { 1, nullptr, &pcache_init, &pcache_shutdown, &pcache_create
+												   , &pcache_cachesize, &pcache_pagecount, &pcache_fetch, &pcache_unpin
+												   , &pcache_rekey, &pcache_truncate, &pcache_destroy, &pcache_shrink };
+	int error_code = sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods);
+	if(error_code == SQLITE_OK) { gPool.budget = config.budgetBytes; }
+	return static_cast<SQLiteCode::Enum>(error_code);
+}
+
+SQLitePageCacheStats SQLitePageCache::stats()
+{
+	std::lock_guard<std::mutex> lock(gPool.registryMutex);
+	return { gPool.hits.load(std::memory_order_relaxed), gPool.misses.load(std::memory_order_relaxed)
+		   , gPool.evictions.load(std::memory_order_relaxed), gPool.bytes.load(std::memory_order_relaxed), gPool.caches.size() };
+}
+
+}
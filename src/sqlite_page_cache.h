@@ -0,0 +1,47 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_PAGE_CACHE_H_
+#define COMPONENTS_DATABASE_SQLITE_PAGE_CACHE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	struct SQLitePageCacheConfig
+	{
+		size_t budgetBytes = 256 * 1024 * 1024;//soft limit for all connections together
+	};
+
+	struct SQLitePageCacheStats
+	{
+		uint64_t	hits;
+		uint64_t	misses;
+		uint64_t	evictions;		//pages evicted by CLOCK, including other connections' pages under budget pressure
+		size_t		bytes;
+		size_t		caches;
+	};
+
+	/**
+	 * Process-wide page cache (SQLITE_CONFIG_PCACHE2) with one memory budget shared by all connections
+	 *
+	 * A pager keeps its own PgHdr in every page's extra bytes and writes uncommitted changes into the page buffers,
+	 * and WAL readers at different snapshots need different versions of the same page, so page contents can not be
+	 * handed to several connections. Each connection keeps a logical cache of its own (one lock stripe per cache),
+	 * while the budget and the CLOCK eviction span all of them: an idle connection's cold pages are given up for a busy
+	 * connection's hot ones instead of every connection holding cache_size pages.
+	 * To share one physical copy of a read-mostly file between readers, enable PRAGMA mmap_size as well, mapped pages
+	 * come from the OS page cache and bypass this cache.
+	 */
+	class SQLitePageCache
+	{
+	public:
+		/**
+		 * Installs the page cache, must be called before the first connection is opened
+		 * @return An SQLiteCode is returned, MISUSE if SQLite is already initialized
+		 */
+		static SQLiteCode::Enum install(const SQLitePageCacheConfig& config = SQLitePageCacheConfig());
+		static SQLitePageCacheStats stats();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_PAGE_CACHE_H_ */
@@ -0,0 +1,110 @@
+#include "sqlite_readahead_vfs.h"
+#include "sqlite_vfs.h"
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace database
+{
+
+namespace
+{
+	struct ReadAheadState
+	{
+		int										fd;
+		SQLiteSequentialDetector				detector;
+		uint64_t								frontier = 0;	//end of the range already handed to the kernel
+		uint64_t								window = 0;		//size of the last prefetched window
+		uint64_t								runStart = 0;	//offset of the first read of the current run
+		std::chrono::steady_clock::time_point	runStartTime;
+	};
+
+	class ReadAheadShim : public SQLiteVfsShim
+	{
+	public:
+		SQLiteReadAheadConfig	mConfig;
+		std::atomic<uint64_t>	mPrefetches{0};
+		std::atomic<uint64_t>	mPrefetchedBytes{0};
+	protected:
+		int onOpen(File* file, const char* name, int flags) override
+		{
+			int fd = (flags & SQLITE_OPEN_MAIN_DB) ? unixDescriptor(file, name) : -1;
+			if(fd >= 0) { file->state = new ReadAheadState{ fd, SQLiteSequentialDetector(), 0, 0, 0, std::chrono::steady_clock::now() }; }
+			return SQLITE_OK;
+		}
+
+		int close(File* file) override
+		{
+			delete static_cast<ReadAheadState*>(file->state);
+			file->state = nullptr;
+			return SQLiteVfsShim::close(file);
+		}
+
+		int read(File* file, void* buffer, int amount, sqlite3_int64 offset) override
+		{
+			int error_code = SQLiteVfsShim::read(file, buffer, amount, offset);
+			ReadAheadState* state = static_cast<ReadAheadState*>(file->state);
+			if( (state == nullptr) || (error_code != SQLITE_OK) ) { return error_code; }
+
+			SQLiteSequentialDetector& detector = state->detector;
+			const uint32_t run = detector.observe(offset, amount);
+			if(run == 0) { return error_code; }
+			//a run starting inside the prefetched range continues the previous one (b-tree interior pages interleave with leaves)
+			if( (run == 1) && !( (static_cast<uint64_t>(offset) >= state->runStart) && (static_cast<uint64_t>(offset) < state->frontier) ) )
+			{
+				state->frontier = 0;
+				state->window = 0;
+				state->runStart = offset - amount;
+				state->runStartTime = std::chrono::steady_clock::now();
+				return error_code;
+			}
+			if( (run < mConfig.sequentialTrigger) || !detector.pageSized() ) { return error_code; }
+
+			const uint64_t page = detector.amount();
+			const uint64_t position = detector.next();
+			//refill only when less than half of the last window is left ahead of the reader
+			if( (state->frontier > position) && ((state->frontier - position) * 2 >= state->window) ) { return error_code; }
+
+			//window = scan speed * lead, clamped and rounded to whole pages
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->runStartTime).count();
+			const double speed = (seconds > 0) ? (position - state->runStart) / seconds : 0;
+			uint64_t window = static_cast<uint64_t>(speed * std::chrono::duration<double>(mConfig.lead).count());
+			window = std::max<uint64_t>(mConfig.minWindowPages * page, std::min<uint64_t>(window, mConfig.maxWindowPages * page));
+			window -= window % page;
+
+			const uint64_t from = std::max(state->frontier, position);
+			const uint64_t to = position + window;
+			if(to <= from) { return error_code; }
+			//posix_fadvise only starts the reads, unlike readahead(2) it does not wait for them
+			if(posix_fadvise(state->fd, from, to - from, POSIX_FADV_WILLNEED) == 0)
+			{
+				mPrefetches.fetch_add(1, std::memory_order_relaxed);
+				mPrefetchedBytes.fetch_add(to - from, std::memory_order_relaxed);
+			}
+			state->frontier = to;
+			state->window = window;
+			return error_code;
+		}
+	};
+
+	ReadAheadShim& shim()
+	{
+		static ReadAheadShim instance;
+		return instance;
+	}
+}
+
+SQLiteCode::Enum SQLiteReadAheadVfs::install(const SQLiteReadAheadConfig& config, const std::string& parent, bool make_default)
+{
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+	if(shim().registered()) { return SQLiteCode::OK; }
+	shim().mConfig = config;
+	return shim().registerVfs(NAME, parent, make_default);
+}
+
+SQLiteReadAheadStats SQLiteReadAheadVfs::stats()
+{ return { shim().mPrefetches.load(std::memory_order_relaxed), shim().mPrefetchedBytes.load(std::memory_order_relaxed) }; }
+
+}
@@ -0,0 +1,46 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_READAHEAD_VFS_H_
+#define COMPONENTS_DATABASE_SQLITE_READAHEAD_VFS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	struct SQLiteReadAheadConfig
+	{
+		uint32_t					sequentialTrigger = 4;		//sequential page reads before prefetching starts
+		uint32_t					minWindowPages = 16;
+		uint32_t					maxWindowPages = 2048;
+		std::chrono::milliseconds	lead{50};					//the window covers this much reading at the observed scan speed
+	};
+
+	struct SQLiteReadAheadStats
+	{
+		uint64_t	prefetches;		//posix_fadvise calls issued
+		uint64_t	prefetchedBytes;
+	};
+
+	/**
+	 * Read-ahead VFS shim for sequential scans of main database files
+	 * Once a run of sequential page reads is detected, the pages ahead of the reader are handed to the kernel with
+	 * posix_fadvise(WILLNEED), which starts reading them without blocking the caller. The window is sized from the speed
+	 * of the current run (bytes per second times the configured lead) and refilled when half of it was consumed.
+	 * Only files of the unix VFS are prefetched, other files are passed through untouched.
+	 */
+	class SQLiteReadAheadVfs
+	{
+	public:
+		static constexpr const char* NAME = "readahead";
+		/**
+		 * Registers the shim
+		 * @param parent Name of the wrapped VFS, the current default VFS is used when empty
+		 * @return An SQLiteCode is returned, registering again is a no-op
+		 */
+		static SQLiteCode::Enum install(const SQLiteReadAheadConfig& config = SQLiteReadAheadConfig(), const std::string& parent = std::string(), bool make_default = false);
+		static SQLiteReadAheadStats stats();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_READAHEAD_VFS_H_ */
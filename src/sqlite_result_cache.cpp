@@ -0,0 +1,253 @@
+#include "sqlite_result_cache.h"
+#include <sqlite3.h>
+#include <cstdlib>
+#include <cstring>
+
+namespace database
+{
+
+int64_t SQLiteResultSet::asInt64(size_t row, size_t column) const
+{
+	const Cell& cell = mCells[row * columns() + column];
+	switch(type(row, column))
+	{
+		case SQLiteValueType::INTEGER: return cell.integer;
+		case SQLiteValueType::FLOAT: return static_cast<int64_t>(cell.real);
+		case SQLiteValueType::TEXT: return strtoll(mArena.data() + cell.bytes.offset, nullptr, 10);
+		default: return 0;
+	}
+}
+
+double SQLiteResultSet::asDouble(size_t row, size_t column) const
+{
+	const Cell& cell = mCells[row * columns() + column];
+	switch(type(row, column))
+	{
+		case SQLiteValueType::INTEGER: return static_cast<double>(cell.integer);
+		case SQLiteValueType::FLOAT: return cell.real;
+		case SQLiteValueType::TEXT: return strtod(mArena.data() + cell.bytes.offset, nullptr);
+		default: return 0.0;
+	}
+}
+
+std::string_view SQLiteResultSet::asStringView(size_t row, size_t column) const
+{
+	const SQLiteValueType::Enum value_type = type(row, column);
+	if( (value_type != SQLiteValueType::TEXT) && (value_type != SQLiteValueType::BLOB) ) { return std::string_view(); }
+	const Cell& cell = mCells[row * columns() + column];
+	return std::string_view(mArena.data() + cell.bytes.offset, cell.bytes.size);
+}
+
+std::string SQLiteResultSet::asString(size_t row, size_t column) const
+{
+	switch(type(row, column))
+	{
+		case SQLiteValueType::INTEGER: return std::to_string(mCells[row * columns() + column].integer);
+		case SQLiteValueType::FLOAT:
+		{
+			char buffer[32];
+			sqlite3_snprintf(sizeof(buffer), buffer, "%!.15g", mCells[row * columns() + column].real);
+			return buffer;
+		}
+		case SQLiteValueType::NULL_VALUE: return std::string();
+		default: return std::string(asStringView(row, column));
+	}
+}
+
+size_t SQLiteResultSet::bytes() const
+{
+	size_t result = sizeof(*this) + mTypes.capacity() + mCells.capacity() * sizeof(Cell) + mArena.capacity();
+	for(const auto& name : mColumnNames) { result += sizeof(name) + name.capacity(); }
+	return result;
+}
+
+void SQLiteResultSet::appendRow(sqlite3_stmt* stmt)
+{
+	const int count = sqlite3_column_count(stmt);
+	if(mRows == 0)
+	{
+		for(int i = 0; i < count; ++i) { mColumnNames.emplace_back(sqlite3_column_name(stmt, i)); }
+	}
+	for(int i = 0; i < count; ++i)
+	{
+		Cell cell;
+		cell.integer = 0;
+		const int value_type = sqlite3_column_type(stmt, i);
+		if(value_type == SQLITE_INTEGER) { cell.integer = sqlite3_column_int64(stmt, i); }
+		else if(value_type == SQLITE_FLOAT) { cell.real = sqlite3_column_double(stmt, i); }
+		else if( (value_type == SQLITE_TEXT) || (value_type == SQLITE_BLOB) )
+		{
+			const char* data = (value_type == SQLITE_TEXT)
+				? reinterpret_cast<const char*>(sqlite3_column_text(stmt, i))
+				: static_cast<const char*>(sqlite3_column_blob(stmt, i));
+			cell.bytes.offset = static_cast<uint32_t>(mArena.size());
+			cell.bytes.size = static_cast<uint32_t>(sqlite3_column_bytes(stmt, i));
+			if(data != nullptr) { mArena.insert(mArena.end(), data, data + cell.bytes.size); }
+			if(value_type == SQLITE_TEXT) { mArena.push_back('\0'); }
+		}
+		mTypes.push_back(static_cast<uint8_t>(value_type));
+		mCells.push_back(cell);
+	}
+	++mRows;
+}
+
+void SQLiteResultSet::shrink()
+{
+	mTypes.shrink_to_fit();
+	mCells.shrink_to_fit();
+	mArena.shrink_to_fit();
+}
+
+SQLiteResultCache::SQLiteResultCache(sqlite3* db, const SQLiteResultCacheConfig& config)
+	: mDb(db)
+	, mConfig(config)
+	, mEntries()
+	, mLru()
+	, mTableGenerations()
+	, mLastTable(nullptr)
+	, mLastGeneration(nullptr)
+	, mDataVersion(nullptr)
+	, mLastDataVersion(-1)
+	, mLastCheck()
+	, mTotalChanges(sqlite3_total_changes(db))
+	, mHookedChanges(0)
+	, mStats()
+{
+	sqlite3_prepare_v2(mDb, "PRAGMA data_version", -1, &mDataVersion, nullptr);
+}
+
+SQLiteResultCache::~SQLiteResultCache()
+{ detach(); }
+
+void SQLiteResultCache::detach()
+{
+	if(mDb == nullptr) { return; }
+	sqlite3_finalize(mDataVersion);
+	mDataVersion = nullptr;
+	mDb = nullptr;
+	clear();
+}
+
+bool SQLiteResultCache::revalidate()
+{
+	auto now = std::chrono::steady_clock::now();
+	if( (mConfig.revalidate.count() > 0) && (now - mLastCheck < mConfig.revalidate) ) { return true; }
+	mLastCheck = now;
+	int64_t data_version = -1;
+	if( (mDataVersion != nullptr) && (sqlite3_step(mDataVersion) == SQLITE_ROW) ) { data_version = sqlite3_column_int64(mDataVersion, 0); }
+	if(mDataVersion != nullptr) { sqlite3_reset(mDataVersion); }
+	//another connection committed since the last check
+	bool unchanged = (data_version >= 0) && (data_version == mLastDataVersion);
+	mLastDataVersion = data_version;
+	return unchanged;
+}
+
+SQLiteResultSet_sptr SQLiteResultCache::find(const std::string& key)
+{
+	if(mDb == nullptr) { return nullptr; }
+	if(!revalidate()) { clear(); }
+	checkChanges();
+	auto it = mEntries.find(key);
+	if(it == mEntries.end())
+	{
+		++mStats.misses;
+		return nullptr;
+	}
+	for(const auto& table : it->second.tables)
+	{
+		if(*table.first != table.second)
+		{
+			++mStats.invalidations;
+			++mStats.misses;
+			erase(it);
+			return nullptr;
+		}
+	}
+	mLru.splice(mLru.begin(), mLru, it->second.lru);
+	++mStats.hits;
+	return it->second.result;
+}
+
+void SQLiteResultCache::insert(const std::string& key, const SQLiteResultSet_sptr& result, const std::vector<std::string>& tables)
+{
+	const size_t bytes = result->bytes() + 2 * key.capacity() + sizeof(Entry);
+	if( (mDb == nullptr) || (bytes > mConfig.maxResultBytes) ) { return; }
+	auto existing = mEntries.find(key);
+	if(existing != mEntries.end()) { erase(existing); }
+	while( !mLru.empty() && (mStats.bytes + bytes > mConfig.maxBytes) )
+	{
+		++mStats.evictions;
+		erase(mEntries.find(mLru.back()));
+	}
+
+	Entry entry;
+	entry.result = result;
+	entry.bytes = bytes;
+	for(const auto& table : tables)
+	{
+		const uint64_t& generation = mTableGenerations.emplace(table, 0).first->second;
+		entry.tables.emplace_back(&generation, generation);
+	}
+	mLru.push_front(key);
+	entry.lru = mLru.begin();
+	mEntries.emplace(key, std::move(entry));
+	mStats.bytes += bytes;
+	mStats.entries = mEntries.size();
+}
+
+void SQLiteResultCache::invalidate(const char* table)
+{
+	++mHookedChanges;
+	if( (mLastTable == nullptr) || (strcmp(mLastTable->c_str(), table) != 0) )
+	{
+		auto it = mTableGenerations.emplace(table, 0).first;
+		mLastTable = &it->first;
+		mLastGeneration = &it->second;
+	}
+	++*mLastGeneration;
+}
+
+void SQLiteResultCache::clear()
+{
+	mStats.invalidations += mEntries.size();
+	mEntries.clear();
+	mLru.clear();
+	mStats.entries = 0;
+	mStats.bytes = 0;
+}
+
+SQLiteResultCacheStats SQLiteResultCache::stats() const
+{ return mStats; }
+
+void SQLiteResultCache::erase(std::unordered_map<std::string, Entry>::iterator it)
+{
+	mStats.bytes -= it->second.bytes;
+	mLru.erase(it->second.lru);
+	mEntries.erase(it);
+	mStats.entries = mEntries.size();
+}
+
+void SQLiteResultCache::checkChanges()
+{
+	//rows changed without passing the update hook (WITHOUT ROWID tables, truncation) cannot be attributed to a table
+	int64_t total_changes = sqlite3_total_changes(mDb);
+	if(total_changes - mTotalChanges > mHookedChanges) { clear(); }
+	mTotalChanges = total_changes;
+	mHookedChanges = 0;
+}
+
+void SQLiteResultCache::committed()
+{
+	if(mDb == nullptr) { return; }
+	checkChanges();
+}
+
+void SQLiteResultCache::rolledBack()
+{
+	if(mDb == nullptr) { return; }
+	clear();
+	mTotalChanges = sqlite3_total_changes(mDb);
+	mHookedChanges = 0;
+}
+
+}
@@ -0,0 +1,163 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_RESULT_CACHE_H_
+#define COMPONENTS_DATABASE_SQLITE_RESULT_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+//pre-declarations
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace database
+{
+	struct SQLiteValueType
+	{
+		enum Enum
+		{
+			INTEGER		= 1,
+			FLOAT		= 2,
+			TEXT		= 3,
+			BLOB		= 4,
+			NULL_VALUE	= 5
+		};
+	};
+
+	/**
+	 * Immutable, fully materialized result of a statement
+	 * Values live in two contiguous arrays: fixed size cells (numbers or offsets) and an arena with text and blob bytes
+	 */
+	class SQLiteResultSet
+	{
+		friend class SQLiteStatement;
+	public:
+		inline size_t rows() const { return mRows; }
+		inline size_t columns() const { return mColumnNames.size(); }
+		inline const std::string& columnName(size_t column) const { return mColumnNames[column]; }
+		inline SQLiteValueType::Enum type(size_t row, size_t column) const
+		{ return static_cast<SQLiteValueType::Enum>(mTypes[row * columns() + column]); }
+		inline bool isNull(size_t row, size_t column) const { return type(row, column) == SQLiteValueType::NULL_VALUE; }
+		int64_t asInt64(size_t row, size_t column) const;
+		double asDouble(size_t row, size_t column) const;
+		/**
+		 * Returns the bytes of a text or blob value, pointing into the result set, an empty view for other types
+		 */
+		std::string_view asStringView(size_t row, size_t column) const;
+		/**
+		 * Returns the value as text, numbers are formatted like SQLite does
+		 */
+		std::string asString(size_t row, size_t column) const;
+		/**
+		 * Returns the memory held by the result set
+		 */
+		size_t bytes() const;
+	private:
+		union Cell
+		{
+			int64_t		integer;
+			double		real;
+			struct
+			{
+				uint32_t offset;
+				uint32_t size;
+			}			bytes;
+		};
+		std::vector<std::string>	mColumnNames;
+		size_t						mRows = 0;
+		std::vector<uint8_t>		mTypes;
+		std::vector<Cell>			mCells;
+		std::vector<char>			mArena;//text is stored zero terminated
+
+		void appendRow(sqlite3_stmt* stmt);
+		void shrink();
+	};
+	using SQLiteResultSet_sptr = std::shared_ptr<const SQLiteResultSet>;
+
+	struct SQLiteResultCacheConfig
+	{
+		size_t						maxBytes = 64 << 20;		//memory of all cached results together
+		size_t						maxResultBytes = 1 << 20;	//larger results are returned but not cached
+		std::chrono::milliseconds	revalidate{0};				//PRAGMA data_version is checked at most this often
+	};
+
+	struct SQLiteResultCacheStats
+	{
+		uint64_t	hits;
+		uint64_t	misses;
+		uint64_t	invalidations;	//entries dropped because of changes
+		uint64_t	evictions;		//entries dropped for memory
+		size_t		entries;
+		size_t		bytes;
+	};
+
+	/**
+	 * Result cache of a connection, keyed by sql with the bound parameters expanded
+	 * Changes of this connection invalidate the entries reading the changed table (update hook), changes the update hook
+	 * does not see (WITHOUT ROWID tables, truncation) drop every entry by the next lookup, rollbacks drop them at once.
+	 * Commits of other connections and processes are detected through PRAGMA data_version and drop every entry as well.
+	 */
+	class SQLiteResultCache
+	{
+	public:
+		SQLiteResultCache(sqlite3* db, const SQLiteResultCacheConfig& config);
+		SQLiteResultCache(const SQLiteResultCache& other) = delete;
+		SQLiteResultCache& operator=(const SQLiteResultCache& other) = delete;
+		~SQLiteResultCache();
+		/**
+		 * Drops every entry and stops using the connection, the cache stays empty afterwards
+		 * Called when the connection closes, statements may still hold the cache
+		 */
+		void detach();
+		/**
+		 * Called by the commit and rollback listeners the connection registers for the cache
+		 */
+		void committed();
+		void rolledBack();
+		/**
+		 * Returns the cached result or nullptr
+		 */
+		SQLiteResultSet_sptr find(const std::string& key);
+		/**
+		 * Caches the result of a read-only statement reading the given tables
+		 */
+		void insert(const std::string& key, const SQLiteResultSet_sptr& result, const std::vector<std::string>& tables);
+		/**
+		 * Drops the entries reading the given table
+		 */
+		void invalidate(const char* table);
+		void clear();
+		SQLiteResultCacheStats stats() const;
+	private:
+		struct Entry
+		{
+			SQLiteResultSet_sptr							result;
+			std::vector<std::pair<const uint64_t*, uint64_t>>	tables;//generation of each table read when cached
+			size_t											bytes;
+			std::list<std::string>::iterator				lru;
+		};
+		sqlite3*									mDb;
+		const SQLiteResultCacheConfig				mConfig;
+		std::unordered_map<std::string, Entry>		mEntries;
+		std::list<std::string>						mLru;//most recently used first
+		std::unordered_map<std::string, uint64_t>	mTableGenerations;
+		const std::string*							mLastTable;//runs of rows of the same table skip hashing
+		uint64_t*									mLastGeneration;
+		sqlite3_stmt*								mDataVersion;
+		int64_t										mLastDataVersion;
+		std::chrono::steady_clock::time_point		mLastCheck;
+		int64_t										mTotalChanges;//sqlite3_total_changes at the last lookup or commit
+		int64_t										mHookedChanges;//rows reported by the update hook since
+		SQLiteResultCacheStats						mStats;
+
+		void erase(std::unordered_map<std::string, Entry>::iterator it);
+		bool revalidate();
+		void checkChanges();
+	};
+	using SQLiteResultCache_sptr = std::shared_ptr<SQLiteResultCache>;
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_RESULT_CACHE_H_ */
@@ -0,0 +1,105 @@
+#include "sqlite_slow_query_log.h"
+#include <cinttypes>
+
+namespace database
+{
+
+static size_t round_up_pow2(size_t value)
+{
+	size_t result = 2;
+	while(result < value) { result <<= 1; }
+	return result;
+}
+
+SQLiteSlowQueryLog::SQLiteSlowQueryLog(std::chrono::nanoseconds threshold, const SQLiteSlowQueryCallback& sink, size_t capacity)
+	: mThreshold(threshold)
+	, mSink(sink)
+	, mMask(round_up_pow2(capacity) - 1)
+	, mCells(new Cell[mMask + 1])
+	, mEnqueuePos(0)
+	, mDequeuePos(0)
+	, mDropped(0)
+	, mRunning(true)
+	, mThread()
+{
+	for(size_t i = 0; i <= mMask; ++i)
+	{ mCells[i].sequence.store(i, std::memory_order_relaxed); }
+	mThread = std::thread(&SQLiteSlowQueryLog::run, this);
+}
+
+SQLiteSlowQueryLog::~SQLiteSlowQueryLog()
+{
+	mRunning.store(false, std::memory_order_release);
+	if(mThread.joinable()) { mThread.join(); }
+}
+
+bool SQLiteSlowQueryLog::push(SQLiteSlowQuery&& query) noexcept
+{
+	//bounded MPMC queue by D. Vyukov, only a single consumer is used here
+	size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		Cell& cell = mCells[pos & mMask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if(diff == 0)
+		{
+			if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.query = std::move(query);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if(diff < 0)
+		{
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{ pos = mEnqueuePos.load(std::memory_order_relaxed); }
+	}
+}
+
+bool SQLiteSlowQueryLog::pop(SQLiteSlowQuery& query)
+{
+	Cell& cell = mCells[mDequeuePos & mMask];
+	size_t sequence = cell.sequence.load(std::memory_order_acquire);
+	if(sequence != mDequeuePos + 1) { return false; }
+	query = std::move(cell.query);
+	cell.sequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+	++mDequeuePos;
+	return true;
+}
+
+void SQLiteSlowQueryLog::run()
+{
+	SQLiteSlowQuery query;
+	bool running = true;
+	while(running)
+	{
+		running = mRunning.load(std::memory_order_acquire);
+		bool drained = true;
+		while(pop(query))
+		{
+			drained = false;
+			if(mSink) { mSink(query); }
+		}
+		if(running && drained)
+		{ std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+	}
+}
+
+SQLiteSlowQueryCallback SQLiteSlowQueryLog::writeTo(FILE* file)
+{
+	return [file](const SQLiteSlowQuery& query)
+	{
+		fprintf(file, "slow query: %" PRId64 "us wall=%" PRId64 "us rows=%" PRId64 " fullscan=%d sort=%d autoindex=%d vmstep=%d sql=%s\n"
+			, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(query.latency).count())
+			, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(query.wallTime).count())
+			, query.rows, query.fullscanSteps, query.sorts, query.autoIndexes, query.vmSteps, query.sql.c_str());
+		fflush(file);
+	};
+}
+
+}
@@ -0,0 +1,79 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_SLOW_QUERY_LOG_H_
+#define COMPONENTS_DATABASE_SQLITE_SLOW_QUERY_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace database
+{
+	struct SQLiteSlowQuery
+	{
+		std::string					sql;//sql with bound parameters expanded
+		std::chrono::nanoseconds	latency;//spent inside sqlite3_step, compared against the threshold
+		std::chrono::nanoseconds	wallTime;//from the first step to the end of the cycle, the caller's time between steps included
+		int64_t						rows;
+		//sqlite3_stmt_status counters of the cycle
+		int32_t						fullscanSteps;
+		int32_t						sorts;
+		int32_t						autoIndexes;
+		int32_t						vmSteps;
+	};
+	using SQLiteSlowQueryCallback = std::function<void (const SQLiteSlowQuery& query)>;
+
+	/**
+	 * Asynchronous slow query logger
+	 * Producers push into a bounded lock-free queue and never block, entries are dropped when the queue is full
+	 * A background thread drains the queue and hands the entries to the sink
+	 */
+	class SQLiteSlowQueryLog
+	{
+	public:
+		SQLiteSlowQueryLog(std::chrono::nanoseconds threshold, const SQLiteSlowQueryCallback& sink, size_t capacity = 1024);
+		SQLiteSlowQueryLog(const SQLiteSlowQueryLog& other) = delete;
+		SQLiteSlowQueryLog& operator=(const SQLiteSlowQueryLog& other) = delete;
+		/**
+		 * Drains the pending entries and stops the background thread
+		 */
+		~SQLiteSlowQueryLog();
+		inline std::chrono::nanoseconds threshold() const { return mThreshold; }
+		/**
+		 * Enqueues an entry without blocking
+		 * @return False is returned if the queue was full and the entry got dropped
+		 */
+		bool push(SQLiteSlowQuery&& query) noexcept;
+		/**
+		 * Returns the number of entries dropped because the queue was full
+		 */
+		inline uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+		/**
+		 * Returns a sink writing one line per entry to the given file
+		 */
+		static SQLiteSlowQueryCallback writeTo(FILE* file);
+	private:
+		struct Cell
+		{
+			std::atomic<size_t>	sequence;
+			SQLiteSlowQuery		query;
+		};
+		const std::chrono::nanoseconds	mThreshold;
+		const SQLiteSlowQueryCallback	mSink;
+		const size_t					mMask;
+		std::unique_ptr<Cell[]>			mCells;
+		alignas(64) std::atomic<size_t>	mEnqueuePos;
+		alignas(64) size_t				mDequeuePos;
+		std::atomic<uint64_t>			mDropped;
+		std::atomic<bool>				mRunning;
+		std::thread						mThread;
+
+		bool pop(SQLiteSlowQuery& query);
+		void run();
+	};
+	using SQLiteSlowQueryLog_sptr = std::shared_ptr<SQLiteSlowQueryLog>;
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_SLOW_QUERY_LOG_H_ */
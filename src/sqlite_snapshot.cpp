@@ -0,0 +1,91 @@
+#include "sqlite_snapshot.h"
+#include <sqlite3.h>
+#include <mutex>
+#include <unordered_map>
+
+namespace database
+{
+
+namespace
+{
+	std::mutex								gPinnedMutex;
+	std::unordered_map<std::string, int>	gPinned;//live snapshots per database file
+
+	SQLiteOpenOptions pin_options()
+	{
+		SQLiteOpenOptions options;
+		options.readOnly = true;
+		return options;
+	}
+}
+
+SQLiteReadSnapshot::SQLiteReadSnapshot(const std::string& filename)
+	: mFilename(filename)
+	, mPin(filename, pin_options())
+	, mSnapshot(nullptr)
+	, mErrorCode(SQLiteCode::CANTOPEN)
+{}
+
+SQLiteReadSnapshot::~SQLiteReadSnapshot()
+{
+	if(mSnapshot != nullptr)
+	{
+		sqlite3_snapshot_free(mSnapshot);
+		sqlite3_exec(mPin.native(), "COMMIT", nullptr, nullptr, nullptr);
+		std::lock_guard<std::mutex> lock(gPinnedMutex);
+		if(--gPinned[mFilename] == 0) { gPinned.erase(mFilename); }
+	}
+}
+
+SQLiteReadSnapshot_sptr SQLiteReadSnapshot::take(const SQLite& db)
+{
+	const char* filename = db.isOpen() ? sqlite3_db_filename(db.native(), "main") : nullptr;
+	std::shared_ptr<SQLiteReadSnapshot> snapshot(new SQLiteReadSnapshot((filename != nullptr) ? filename : ""));
+	if( (filename == nullptr) || (*filename == '\0') || !snapshot->mPin.isOpen() ) { return snapshot; }
+
+	//the read transaction starts with the first read and stays open until the snapshot is destroyed
+	SQLite& pin = snapshot->mPin;
+	int error_code = sqlite3_exec(pin.native(), "BEGIN", nullptr, nullptr, nullptr);
+	if(error_code == SQLITE_OK) { error_code = sqlite3_exec(pin.native(), "SELECT 1 FROM sqlite_master LIMIT 1", nullptr, nullptr, nullptr); }
+	if(error_code == SQLITE_OK) { error_code = sqlite3_snapshot_get(pin.native(), "main", &snapshot->mSnapshot); }
+	if(error_code != SQLITE_OK)
+	{
+		sqlite3_exec(pin.native(), "ROLLBACK", nullptr, nullptr, nullptr);
+		snapshot->mSnapshot = nullptr;
+		snapshot->mErrorCode = static_cast<SQLiteCode::Enum>(error_code & 0xFF);
+		return snapshot;
+	}
+	{
+		std::lock_guard<std::mutex> lock(gPinnedMutex);
+		++gPinned[snapshot->mFilename];
+	}
+	snapshot->mErrorCode = SQLiteCode::OK;
+	return snapshot;
+}
+
+bool SQLiteReadSnapshot::pinned(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(gPinnedMutex);
+	return gPinned.find(filename) != gPinned.end();
+}
+
+sqlite3_snapshot* SQLiteReadSnapshot::native() const
+{ return mSnapshot; }
+
+SQLiteSnapshotTransaction::SQLiteSnapshotTransaction(SQLite& reader, const SQLiteReadSnapshot& snapshot)
+	: mReader(reader)
+	, mErrorCode(SQLiteCode::CANTOPEN)
+{
+	if( !reader.isOpen() || !snapshot.valid() ) { return; }
+	int error_code = sqlite3_exec(reader.native(), "BEGIN", nullptr, nullptr, nullptr);
+	if(error_code == SQLITE_OK) { error_code = sqlite3_snapshot_open(reader.native(), "main", snapshot.native()); }
+	if(error_code != SQLITE_OK) { sqlite3_exec(reader.native(), "ROLLBACK", nullptr, nullptr, nullptr); }
+	mErrorCode = static_cast<SQLiteCode::Enum>(error_code & 0xFF);
+}
+
+SQLiteSnapshotTransaction::~SQLiteSnapshotTransaction()
+{
+	if(valid()) { sqlite3_exec(mReader.native(), "COMMIT", nullptr, nullptr, nullptr); }
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_SNAPSHOT_H_
+#define COMPONENTS_DATABASE_SQLITE_SNAPSHOT_H_
+
+#include <memory>
+#include <string>
+#include "sqlite.h"
+//pre-declarations
+struct sqlite3_snapshot;
+
+namespace database
+{
+	class SQLiteReadSnapshot;
+	using SQLiteReadSnapshot_sptr = std::shared_ptr<const SQLiteReadSnapshot>;
+
+	/**
+	 * Consistent read view of a WAL database that any number of reader connections can open in parallel
+	 * The snapshot keeps a connection of its own inside a read transaction for its whole lifetime, this pins the WAL:
+	 * checkpoints stop at the snapshot and the WAL is not restarted, so it stays openable. SQLiteCheckpointer does not
+	 * escalate to RESTART/TRUNCATE while a snapshot of its database is alive, long lived snapshots make the WAL grow.
+	 */
+	class SQLiteReadSnapshot
+	{
+	public:
+		SQLiteReadSnapshot(const SQLiteReadSnapshot& other) = delete;
+		SQLiteReadSnapshot& operator=(const SQLiteReadSnapshot& other) = delete;
+		~SQLiteReadSnapshot();
+		/**
+		 * Takes a snapshot of the last commit of the database the connection is opened on
+		 * @return A snapshot is always returned, valid() is false on failure (no WAL mode, in-memory database...)
+		 */
+		static SQLiteReadSnapshot_sptr take(const SQLite& db);
+		/**
+		 * Returns true if a snapshot of the given database file (as returned by sqlite3_db_filename) is alive
+		 */
+		static bool pinned(const std::string& filename);
+		inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+		inline bool valid() const { return errorCode() == SQLiteCode::OK; }
+		explicit operator bool() const noexcept { return valid(); }
+		inline const std::string& filename() const { return mFilename; }
+		sqlite3_snapshot* native() const;
+	private:
+		SQLiteReadSnapshot(const std::string& filename);
+
+		const std::string	mFilename;
+		SQLite				mPin;
+		sqlite3_snapshot*	mSnapshot;
+		SQLiteCode::Enum	mErrorCode;
+	};
+
+	/**
+	 * Read transaction of a reader connection on a snapshot, statements run while it is alive see the snapshot
+	 * The transaction ends (COMMIT) on destruction, statements have to be reset or destroyed before
+	 */
+	class SQLiteSnapshotTransaction
+	{
+	public:
+		/**
+		 * @param reader Connection on the same database without an open transaction
+		 */
+		SQLiteSnapshotTransaction(SQLite& reader, const SQLiteReadSnapshot& snapshot);
+		SQLiteSnapshotTransaction(const SQLiteSnapshotTransaction& other) = delete;
+		SQLiteSnapshotTransaction& operator=(const SQLiteSnapshotTransaction& other) = delete;
+		~SQLiteSnapshotTransaction();
+		/**
+		 * @return BUSY or ERROR is returned if the snapshot cannot be opened on this connection
+		 */
+		inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+		inline bool valid() const { return errorCode() == SQLiteCode::OK; }
+		explicit operator bool() const noexcept { return valid(); }
+	private:
+		SQLite&				mReader;
+		SQLiteCode::Enum	mErrorCode;
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_SNAPSHOT_H_ */
@@ -0,0 +1,236 @@
+#include "sqlite_trace.h"
+#include <cstring>
+#include "sqlite.h"
+
+namespace database
+{
+
+static const size_t MAGIC_SIZE = 8;
+static const uint8_t RECORD_SQL = 1;
+static const uint8_t RECORD_EVENT = 2;
+
+static void put_varint(std::string& buffer, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		buffer += static_cast<char>( (value & 0x7F) | 0x80 );
+		value >>= 7;
+	}
+	buffer += static_cast<char>(value);
+}
+
+static bool get_varint(FILE* file, uint64_t& value)
+{
+	value = 0;
+	for(int shift = 0; shift < 64; shift += 7)
+	{
+		int c = fgetc(file);
+		if(c == EOF) { return false; }
+		value |= static_cast<uint64_t>(c & 0x7F) << shift;
+		if( (c & 0x80) == 0 ) { return true; }
+	}
+	return false;
+}
+
+static inline uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+static inline int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+SQLiteTraceRecorder::SQLiteTraceRecorder(const std::string& path)
+	: mStart(std::chrono::steady_clock::now())
+	, mMutex()
+	, mFile(fopen(path.c_str(), "wb"))
+	, mSqlIds()
+	, mNextConnection(1)
+	, mEvents(0)
+{
+	if(mFile == nullptr) { return; }
+	setvbuf(mFile, nullptr, _IOFBF, 1 << 20);
+	fwrite(MAGIC, 1, MAGIC_SIZE, mFile);
+}
+
+SQLiteTraceRecorder::~SQLiteTraceRecorder()
+{
+	if(mFile != nullptr) { fclose(mFile); }
+}
+
+SQLiteCode::Enum SQLiteTraceRecorder::saveBaseline(SQLite& db, const std::string& path)
+{
+	if(!db.isOpen()) { return SQLiteCode::CANTOPEN; }
+	//prepared on the handle, SQLite::prepare would record the copy itself when the connection already records
+	sqlite3_stmt* stmt = nullptr;
+	int error_code = sqlite3_prepare_v2(db.native(), "VACUUM INTO ?1", -1, &stmt, nullptr);
+	if(error_code == SQLITE_OK) { error_code = sqlite3_bind_text(stmt, 1, path.c_str(), static_cast<int>(path.size()), SQLITE_TRANSIENT); }
+	if(error_code == SQLITE_OK) { error_code = sqlite3_step(stmt); }
+	sqlite3_finalize(stmt);
+	return static_cast<SQLiteCode::Enum>( (error_code == SQLITE_DONE) ? SQLITE_OK : error_code );
+}
+
+uint32_t SQLiteTraceRecorder::addConnection()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mNextConnection++;
+}
+
+uint32_t SQLiteTraceRecorder::sqlId(const std::string& sql)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto it = mSqlIds.find(sql);
+	if(it != mSqlIds.end()) { return it->second; }
+	const uint32_t id = static_cast<uint32_t>(mSqlIds.size());
+	mSqlIds.emplace(sql, id);
+	if(mFile != nullptr)
+	{
+		//ids are implicit, the n-th sql record has id n
+		std::string buffer(1, static_cast<char>(RECORD_SQL));
+		put_varint(buffer, sql.size());
+		buffer += sql;
+		fwrite(buffer.data(), 1, buffer.size(), mFile);
+	}
+	return id;
+}
+
+std::chrono::nanoseconds SQLiteTraceRecorder::sinceStart(std::chrono::steady_clock::time_point time) const
+{ return std::chrono::duration_cast<std::chrono::nanoseconds>(time - mStart); }
+
+void SQLiteTraceRecorder::record(const SQLiteTraceEvent& event)
+{
+	if(mFile == nullptr) { return; }
+	//encoded outside the lock, connections only serialize on the write
+	std::string buffer(1, static_cast<char>(RECORD_EVENT));
+	put_varint(buffer, event.connection);
+	put_varint(buffer, event.sql);
+	put_varint(buffer, static_cast<uint64_t>(event.start.count()));
+	put_varint(buffer, static_cast<uint64_t>(event.latency.count()));
+	put_varint(buffer, zigzag(event.rows));
+	put_varint(buffer, zigzag(event.result));
+	put_varint(buffer, event.parameters.size());
+	for(const auto& parameter : event.parameters)
+	{
+		buffer += static_cast<char>(parameter.type);
+		switch(parameter.type)
+		{
+			case SQLiteValueType::INTEGER: put_varint(buffer, zigzag(parameter.integer)); break;
+			case SQLiteValueType::FLOAT:
+			{
+				char bytes[sizeof(double)];
+				memcpy(bytes, &parameter.real, sizeof(bytes));
+				buffer.append(bytes, sizeof(bytes));
+				break;
+			}
+			case SQLiteValueType::TEXT:
+			case SQLiteValueType::BLOB:
+				put_varint(buffer, parameter.bytes.size());
+				buffer += parameter.bytes;
+				break;
+			default: break;
+		}
+	}
+	std::lock_guard<std::mutex> lock(mMutex);
+	fwrite(buffer.data(), 1, buffer.size(), mFile);
+	++mEvents;
+}
+
+uint64_t SQLiteTraceRecorder::events() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEvents;
+}
+
+SQLiteTraceReader::SQLiteTraceReader(const std::string& path)
+	: mFile(fopen(path.c_str(), "rb"))
+	, mCorrupt(false)
+	, mSql()
+{
+	char magic[MAGIC_SIZE];
+	if( (mFile != nullptr) && ( (fread(magic, 1, MAGIC_SIZE, mFile) != MAGIC_SIZE) || (memcmp(magic, SQLiteTraceRecorder::MAGIC, MAGIC_SIZE) != 0) ) )
+	{
+		fclose(mFile);
+		mFile = nullptr;
+	}
+	if(mFile != nullptr) { setvbuf(mFile, nullptr, _IOFBF, 1 << 20); }
+}
+
+SQLiteTraceReader::~SQLiteTraceReader()
+{
+	if(mFile != nullptr) { fclose(mFile); }
+}
+
+const std::string& SQLiteTraceReader::sql(uint32_t id) const
+{
+	static const std::string unknown;
+	return (id < mSql.size()) ? mSql[id] : unknown;
+}
+
+static bool get_bytes(FILE* file, std::string& bytes)
+{
+	uint64_t size = 0;
+	if(!get_varint(file, size) || (size > (1ull << 31)) ) { return false; }
+	bytes.resize(size);
+	return (size == 0) || (fread(&bytes[0], 1, size, file) == size);
+}
+
+bool SQLiteTraceReader::next(SQLiteTraceEvent& event)
+{
+	if(mFile == nullptr) { return false; }
+	for(;;)
+	{
+		const int tag = fgetc(mFile);
+		if(tag == EOF) { return false; }
+		if(tag == RECORD_SQL)
+		{
+			mSql.emplace_back();
+			if(!get_bytes(mFile, mSql.back())) { mCorrupt = true; return false; }
+			continue;
+		}
+		uint64_t connection = 0, sql = 0, start = 0, latency = 0, rows = 0, result = 0, count = 0;
+		if( (tag != RECORD_EVENT) || !get_varint(mFile, connection) || !get_varint(mFile, sql) || !get_varint(mFile, start) ||
+			!get_varint(mFile, latency) || !get_varint(mFile, rows) || !get_varint(mFile, result) || !get_varint(mFile, count) || (count > 32767) )
+		{
+			//a trace cut short by a crash ends with a partial record
+			mCorrupt = true;
+			return false;
+		}
+		event.connection = static_cast<uint32_t>(connection);
+		event.sql = static_cast<uint32_t>(sql);
+		event.start = std::chrono::nanoseconds(start);
+		event.latency = std::chrono::nanoseconds(latency);
+		event.rows = unzigzag(rows);
+		event.result = static_cast<int32_t>(unzigzag(result));
+		event.parameters.resize(count);
+		for(auto& parameter : event.parameters)
+		{
+			const int type = fgetc(mFile);
+			bool ok = true;
+			parameter.type = static_cast<SQLiteValueType::Enum>(type);
+			switch(type)
+			{
+				case SQLiteValueType::INTEGER:
+				{
+					uint64_t value = 0;
+					ok = get_varint(mFile, value);
+					parameter.integer = unzigzag(value);
+					break;
+				}
+				case SQLiteValueType::FLOAT:
+				{
+					char bytes[sizeof(double)];
+					ok = fread(bytes, 1, sizeof(bytes), mFile) == sizeof(bytes);
+					memcpy(&parameter.real, bytes, sizeof(bytes));
+					break;
+				}
+				case SQLiteValueType::TEXT:
+				case SQLiteValueType::BLOB: ok = get_bytes(mFile, parameter.bytes); break;
+				case SQLiteValueType::NULL_VALUE: break;
+				default: ok = false; break;
+			}
+			if(!ok)
+			{
+				mCorrupt = true;
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_TRACE_H_
+#define COMPONENTS_DATABASE_SQLITE_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sqlite_error_code.h"
+#include "sqlite_result_cache.h"
+
+namespace database
+{
+	class SQLite;
+
+	struct SQLiteTraceValue
+	{
+		SQLiteValueType::Enum	type = SQLiteValueType::NULL_VALUE;
+		int64_t					integer = 0;
+		double					real = 0.0;
+		std::string				bytes;//TEXT and BLOB
+	};
+
+	/**
+	 * One step/execute/evaluate cycle of a statement
+	 */
+	struct SQLiteTraceEvent
+	{
+		uint32_t						connection;	//id of the recording connection
+		uint32_t						sql;		//id of the sql text, see SQLiteTraceReader::sql()
+		std::chrono::nanoseconds		start;		//since the recorder was created
+		std::chrono::nanoseconds		latency;	//spent inside sqlite3_step, not between steps
+		int64_t							rows;
+		int32_t							result;		//SQLITE_DONE, SQLITE_ROW if it stopped before the end, or an error code
+		std::vector<SQLiteTraceValue>	parameters;	//by parameter index - 1
+	};
+
+	/**
+	 * Writes statement cycles into a compact binary trace file
+	 * Shared by any number of connections (SQLite::setTraceRecorder), each one gets a connection id. Every distinct sql
+	 * is written once, cycles refer to it by id, numbers are LEB128 varints.
+	 * Writes are buffered, the file is complete once the recorder and every statement holding it are destroyed.
+	 * A replay has to start from the database as it was before the recorded cycles ran, see saveBaseline().
+	 */
+	class SQLiteTraceRecorder
+	{
+	public:
+		static constexpr const char* MAGIC = "SQLTRC01";
+		explicit SQLiteTraceRecorder(const std::string& path);
+		SQLiteTraceRecorder(const SQLiteTraceRecorder& other) = delete;
+		SQLiteTraceRecorder& operator=(const SQLiteTraceRecorder& other) = delete;
+		~SQLiteTraceRecorder();
+		inline bool valid() const { return mFile != nullptr; }
+		explicit operator bool() const noexcept { return valid(); }
+		uint32_t addConnection();
+		/**
+		 * Copies the database of the connection into path with VACUUM INTO, the database to replay the trace on
+		 * Call it before any connection records, the copy must not hold the writes of the recorded cycles. path must
+		 * not exist yet.
+		 * @return An SQLiteCode is returned
+		 */
+		SQLiteCode::Enum saveBaseline(SQLite& db, const std::string& path);
+		/**
+		 * Returns the id of the sql, writing it into the trace the first time
+		 */
+		uint32_t sqlId(const std::string& sql);
+		std::chrono::nanoseconds sinceStart(std::chrono::steady_clock::time_point time) const;
+		void record(const SQLiteTraceEvent& event);
+		/**
+		 * Returns the number of cycles recorded
+		 */
+		uint64_t events() const;
+	private:
+		const std::chrono::steady_clock::time_point	mStart;
+		mutable std::mutex							mMutex;
+		FILE*										mFile;
+		std::unordered_map<std::string, uint32_t>	mSqlIds;
+		uint32_t									mNextConnection;
+		uint64_t									mEvents;
+	};
+	using SQLiteTraceRecorder_sptr = std::shared_ptr<SQLiteTraceRecorder>;
+
+	/**
+	 * Reads a trace written by SQLiteTraceRecorder, events come in the order their cycles ended
+	 */
+	class SQLiteTraceReader
+	{
+	public:
+		explicit SQLiteTraceReader(const std::string& path);
+		SQLiteTraceReader(const SQLiteTraceReader& other) = delete;
+		SQLiteTraceReader& operator=(const SQLiteTraceReader& other) = delete;
+		~SQLiteTraceReader();
+		inline bool valid() const { return mFile != nullptr; }
+		explicit operator bool() const noexcept { return valid(); }
+		/**
+		 * Reads the next event
+		 * @return False is returned at the end of the trace or if it is corrupt (see corrupt())
+		 */
+		bool next(SQLiteTraceEvent& event);
+		inline bool corrupt() const { return mCorrupt; }
+		/**
+		 * Returns the sql of the given id, sql texts read so far are known
+		 */
+		const std::string& sql(uint32_t id) const;
+		inline size_t sqlCount() const { return mSql.size(); }
+	private:
+		FILE*						mFile;
+		bool						mCorrupt;
+		std::vector<std::string>	mSql;
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_TRACE_H_ */
@@ -0,0 +1,189 @@
+#include "sqlite_uring.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SQLITE_WRAPPER_HAS_IO_URING 1
+#endif
+
+namespace database
+{
+
+SQLiteUring::SQLiteUring()
+	: mFd(-1)
+	, mSqRing(MAP_FAILED)
+	, mSqRingSize(0)
+	, mCqRing(MAP_FAILED)
+	, mCqRingSize(0)
+	, mSqes(MAP_FAILED)
+	, mSqesSize(0)
+	, mSqHead(nullptr)
+	, mSqTail(nullptr)
+	, mSqMask(0)
+	, mSqArray(nullptr)
+	, mCqHead(nullptr)
+	, mCqTail(nullptr)
+	, mCqMask(0)
+	, mCqes(nullptr)
+	, mPending(0)
+{}
+
+SQLiteUring::~SQLiteUring()
+{ release(); }
+
+void SQLiteUring::release()
+{
+	if(mSqes != MAP_FAILED) { munmap(mSqes, mSqesSize); }
+	if( (mCqRing != MAP_FAILED) && (mCqRing != mSqRing) ) { munmap(mCqRing, mCqRingSize); }
+	if(mSqRing != MAP_FAILED) { munmap(mSqRing, mSqRingSize); }
+	if(mFd >= 0) { close(mFd); }
+	mFd = -1;
+	mSqRing = mCqRing = mSqes = MAP_FAILED;
+}
+
+#ifdef SQLITE_WRAPPER_HAS_IO_URING
+
+bool SQLiteUring::init(uint32_t entries)
+{
+	if(mFd >= 0) { return true; }
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	mFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if(mFd < 0) { return false; }
+
+	mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(mCqRingSize > mSqRingSize) { mSqRingSize = mCqRingSize; }
+		mCqRingSize = mSqRingSize;
+	}
+	mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+	if(mSqRing == MAP_FAILED) { release(); return false; }
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{ mCqRing = mSqRing; }
+	else
+	{
+		mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+		if(mCqRing == MAP_FAILED) { release(); return false; }
+	}
+	mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	mSqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+	if(mSqes == MAP_FAILED) { release(); return false; }
+
+	char* sq = static_cast<char*>(mSqRing);
+	char* cq = static_cast<char*>(mCqRing);
+	mSqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+	mSqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+	mSqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+	mSqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+	mCqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+	mCqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+	mCqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+	mCqes = cq + params.cq_off.cqes;
+	return true;
+}
+
+void* SQLiteUring::nextSqe()
+{
+	if(mFd < 0) { return nullptr; }
+	uint32_t head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+	uint32_t tail = *mSqTail + mPending;
+	if(tail - head > mSqMask) { return nullptr; }
+	uint32_t index = tail & mSqMask;
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(mSqes) + index;
+	memset(sqe, 0, sizeof(*sqe));
+	mSqArray[index] = index;
+	++mPending;
+	return sqe;
+}
+
+bool SQLiteUring::readv(int fd, const iovec* iov, uint32_t count, uint64_t offset, uint64_t user_data)
+{
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+	if(sqe == nullptr) { return false; }
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(iov);
+	sqe->len = count;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	return true;
+}
+
+bool SQLiteUring::writev(int fd, const iovec* iov, uint32_t count, uint64_t offset, uint64_t user_data, bool link)
+{
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+	if(sqe == nullptr) { return false; }
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(iov);
+	sqe->len = count;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	return true;
+}
+
+bool SQLiteUring::fdatasync(int fd, uint64_t user_data)
+{
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+	if(sqe == nullptr) { return false; }
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	return true;
+}
+
+int SQLiteUring::submit(uint32_t wait_count)
+{
+	if(mFd < 0) { return -EBADF; }
+	uint32_t count = mPending;
+	__atomic_store_n(mSqTail, *mSqTail + mPending, __ATOMIC_RELEASE);
+	mPending = 0;
+	int result = 0;
+	do
+	{
+		result = static_cast<int>(syscall(__NR_io_uring_enter, mFd, count, wait_count, (wait_count > 0) ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+	} while( (result < 0) && (errno == EINTR) );
+	return (result < 0) ? -errno : result;
+}
+
+bool SQLiteUring::complete(uint64_t& user_data, int32_t& result, bool wait)
+{
+	if(mFd < 0) { return false; }
+	for(;;)
+	{
+		uint32_t head = *mCqHead;
+		if(head != __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+		{
+			const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(mCqes) + (head & mCqMask);
+			user_data = cqe->user_data;
+			result = cqe->res;
+			__atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		if(!wait) { return false; }
+		if( (syscall(__NR_io_uring_enter, mFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) && (errno != EINTR) )
+		{ return false; }
+	}
+}
+
+#else
+
+bool SQLiteUring::init(uint32_t) { return false; }
+void* SQLiteUring::nextSqe() { return nullptr; }
+bool SQLiteUring::readv(int, const iovec*, uint32_t, uint64_t, uint64_t) { return false; }
+bool SQLiteUring::writev(int, const iovec*, uint32_t, uint64_t, uint64_t, bool) { return false; }
+bool SQLiteUring::fdatasync(int, uint64_t) { return false; }
+int SQLiteUring::submit(uint32_t) { return -ENOSYS; }
+bool SQLiteUring::complete(uint64_t&, int32_t&, bool) { return false; }
+
+#endif
+
+}
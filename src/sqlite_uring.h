@@ -0,0 +1,68 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_URING_H_
+#define COMPONENTS_DATABASE_SQLITE_URING_H_
+
+#include <cstdint>
+#include <sys/uio.h>
+
+namespace database
+{
+	/**
+	 * Minimal io_uring submission/completion ring on top of the raw system calls (no liburing dependency)
+	 * Not thread safe, every user keeps a ring of its own
+	 */
+	class SQLiteUring
+	{
+	public:
+		SQLiteUring();
+		SQLiteUring(const SQLiteUring& other) = delete;
+		SQLiteUring& operator=(const SQLiteUring& other) = delete;
+		~SQLiteUring();
+		/**
+		 * Sets up the ring
+		 * @return False is returned if io_uring is not available (old kernel, seccomp, missing headers)
+		 */
+		bool init(uint32_t entries);
+		inline bool valid() const { return mFd >= 0; }
+		/**
+		 * Queue operations, they are sent to the kernel by submit()
+		 * The iovec array has to stay valid until the completion is reaped
+		 * @param link The next queued operation starts only after this one completed successfully
+		 * @return False is returned if the submission queue is full
+		 */
+		bool readv(int fd, const iovec* iov, uint32_t count, uint64_t offset, uint64_t user_data);
+		bool writev(int fd, const iovec* iov, uint32_t count, uint64_t offset, uint64_t user_data, bool link = false);
+		bool fdatasync(int fd, uint64_t user_data);
+		/**
+		 * Submits the queued operations and waits until at least wait_count completions are available
+		 * @return The number of submitted operations or a negative errno
+		 */
+		int submit(uint32_t wait_count = 0);
+		/**
+		 * Pops one completion, waiting for it if wait is set
+		 * @return False is returned if there was no completion (or waiting failed)
+		 */
+		bool complete(uint64_t& user_data, int32_t& result, bool wait);
+	private:
+		int			mFd;
+		void*		mSqRing;
+		size_t		mSqRingSize;
+		void*		mCqRing;
+		size_t		mCqRingSize;
+		void*		mSqes;
+		size_t		mSqesSize;
+		uint32_t*	mSqHead;
+		uint32_t*	mSqTail;
+		uint32_t	mSqMask;
+		uint32_t*	mSqArray;
+		uint32_t*	mCqHead;
+		uint32_t*	mCqTail;
+		uint32_t	mCqMask;
+		void*		mCqes;
+		uint32_t	mPending;//queued but not yet submitted
+
+		void* nextSqe();
+		void release();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_URING_H_ */
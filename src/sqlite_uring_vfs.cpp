@@ -0,0 +1,504 @@
+#include "sqlite_uring_vfs.h"
+#include "sqlite_uring.h"
+#include "sqlite_vfs.h"
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace database
+{
+
+namespace
+{
+	constexpr uint32_t	RING_ENTRIES = 64;
+	constexpr uint32_t	READ_CHUNKS = 4;	//reads submitted per read-ahead window
+	constexpr uint64_t	FSYNC_TAG = ~0ull;
+
+	bool pread_all(int fd, char* buffer, size_t length, uint64_t offset, size_t& done)
+	{
+		done = 0;
+		while(done < length)
+		{
+			ssize_t result = pread(fd, buffer + done, length - done, offset + done);
+			if( (result < 0) && (errno == EINTR) ) { continue; }
+			if(result <= 0) { return result == 0; }
+			done += result;
+		}
+		return true;
+	}
+
+	bool pwrite_all(int fd, const char* buffer, size_t length, uint64_t offset)
+	{
+		size_t done = 0;
+		while(done < length)
+		{
+			ssize_t result = pwrite(fd, buffer + done, length - done, offset + done);
+			if( (result < 0) && (errno == EINTR) ) { continue; }
+			if(result <= 0) { return false; }
+			done += result;
+		}
+		return true;
+	}
+
+	/**
+	 * Sequential read-ahead of a main database file into two alternating windows
+	 */
+	struct ReadAhead
+	{
+		struct Window
+		{
+			char*		data = nullptr;
+			uint64_t	offset = 0;
+			uint32_t	length = 0;		//0 if the window holds nothing
+			uint32_t	valid = 0;		//bytes actually read
+			uint32_t	chunks = 0;
+			uint32_t	outstanding = 0;//reads not completed yet
+			bool		ready = false;
+			iovec		iov[READ_CHUNKS];
+			int32_t		results[READ_CHUNKS];
+
+			inline bool covers(uint64_t off, int amount) const
+			{ return (length > 0) && (off >= offset) && (off + amount <= offset + length); }
+		};
+
+		const SQLiteUringVfsConfig&	config;
+		const int					fd;
+		SQLiteUring					ring;
+		bool						useRing;
+		Window						windows[2];
+		size_t						capacity;
+		SQLiteSequentialDetector	detector;
+
+		ReadAhead(const SQLiteUringVfsConfig& cfg, int file_descriptor)
+			: config(cfg), fd(file_descriptor), ring(), useRing(false), windows(), capacity(0), detector()
+		{ useRing = ring.init(RING_ENTRIES); }
+
+		~ReadAhead()
+		{
+			invalidate();
+			for(Window& window : windows) { free(window.data); }
+		}
+
+		void finish(Window& window)
+		{
+			window.valid = 0;
+			for(uint32_t i = 0; i < window.chunks; ++i)
+			{
+				if(window.results[i] < 0) { break; }
+				window.valid += window.results[i];
+				if(static_cast<size_t>(window.results[i]) < window.iov[i].iov_len) { break; }
+			}
+			window.ready = true;
+		}
+
+		void wait(Window& window)
+		{
+			while(window.outstanding > 0)
+			{
+				uint64_t user_data = 0;
+				int32_t result = 0;
+				if(!ring.complete(user_data, result, true))
+				{
+					abandon();
+					return;
+				}
+				Window& target = windows[(user_data >> 8) & 1];
+				target.results[user_data & 0xFF] = result;
+				if(--target.outstanding == 0) { finish(target); }
+			}
+		}
+
+		/**
+		 * Stops using a broken ring, windows with reads in flight are leaked as the kernel may still write into them
+		 */
+		void abandon()
+		{
+			for(Window& window : windows)
+			{
+				if(window.outstanding > 0) { window.data = nullptr; }
+				window.outstanding = 0;
+				window.length = 0;
+				window.ready = false;
+			}
+			//start() allocates the windows again
+			capacity = 0;
+			useRing = false;
+		}
+
+		void invalidate()
+		{
+			for(Window& window : windows)
+			{
+				wait(window);
+				window.length = 0;
+				window.ready = false;
+			}
+		}
+
+		void issue(size_t index, uint64_t offset)
+		{
+			Window& window = windows[index];
+			wait(window);
+			const uint32_t page = static_cast<uint32_t>(detector.amount());
+			const uint32_t pages_per_chunk = (config.readAheadPages + READ_CHUNKS - 1) / READ_CHUNKS;
+			window.offset = offset;
+			window.length = static_cast<uint32_t>(capacity);
+			window.ready = false;
+			window.chunks = 0;
+			for(uint32_t done = 0; done < window.length; done += pages_per_chunk * page)
+			{
+				iovec& iov = window.iov[window.chunks];
+				iov.iov_base = window.data + done;
+				iov.iov_len = std::min<size_t>(pages_per_chunk * page, window.length - done);
+				window.results[window.chunks++] = 0;
+			}
+			if(useRing)
+			{
+				for(uint32_t i = 0; i < window.chunks; ++i)
+				{ ring.readv(fd, &window.iov[i], 1, offset + (static_cast<char*>(window.iov[i].iov_base) - window.data), (index << 8) | i); }
+				//all chunks of the window go to the kernel in one call, nobody waits for them here
+				const int submitted = ring.submit(0);
+				if(submitted == static_cast<int>(window.chunks))
+				{
+					window.outstanding = window.chunks;
+					return;
+				}
+				//reads submitted before the failure still land in the window
+				window.outstanding = (submitted > 0) ? static_cast<uint32_t>(submitted) : 0;
+				abandon();
+				return;
+			}
+			size_t done = 0;
+			pread_all(fd, window.data, window.length, offset, done);
+			window.results[0] = static_cast<int32_t>(done);
+			window.chunks = 1;
+			window.iov[0].iov_len = window.length;
+			finish(window);
+		}
+
+		bool serve(void* buffer, int amount, uint64_t offset)
+		{
+			for(size_t i = 0; i < 2; ++i)
+			{
+				Window& window = windows[i];
+				if(!window.covers(offset, amount)) { continue; }
+				wait(window);
+				if( !window.ready || (offset + amount > window.offset + window.valid) ) { return false; }
+				memcpy(buffer, window.data + (offset - window.offset), amount);
+				//past half of the window the next one is requested, so it is in flight while this one is consumed
+				const uint64_t end = window.offset + window.length;
+				Window& other = windows[1 - i];
+				if( (offset + amount > window.offset + window.length / 2) && (window.valid == window.length) && !( (other.length > 0) && (other.offset == end) ) )
+				{ issue(1 - i, end); }
+				return true;
+			}
+			return false;
+		}
+
+		void start()
+		{
+			if( (detector.run() < config.sequentialTrigger) || !detector.pageSized() ) { return; }
+			const size_t needed = static_cast<size_t>(config.readAheadPages) * detector.amount();
+			if(needed != capacity)
+			{
+				invalidate();
+				for(Window& window : windows)
+				{
+					free(window.data);
+					window.data = nullptr;
+					if(posix_memalign(reinterpret_cast<void**>(&window.data), 4096, needed) != 0) { window.data = nullptr; }
+				}
+				if( (windows[0].data == nullptr) || (windows[1].data == nullptr) ) { capacity = 0; return; }
+				capacity = needed;
+			}
+			invalidate();
+			issue(0, detector.next());
+		}
+	};
+
+	/**
+	 * Buffered, coalesced writes of a WAL file
+	 */
+	struct WalWriter
+	{
+		struct Segment
+		{
+			uint64_t			offset;
+			std::vector<char>	data;
+		};
+
+		const SQLiteUringVfsConfig&	config;
+		const int					fd;
+		std::mutex					mutex;
+		SQLiteUring					ring;
+		bool						useRing;
+		bool						parentSynced;		//the first sync goes through the VFS, it may have to sync the directory
+		bool						expectCommitData;	//the last write was the header of a commit frame
+		std::vector<Segment>		segments;
+		size_t						pendingBytes;
+		std::vector<iovec>			iovs;
+
+		WalWriter(const SQLiteUringVfsConfig& cfg, int file_descriptor)
+			: config(cfg), fd(file_descriptor), mutex(), ring(), useRing(false), parentSynced(false)
+			, expectCommitData(false), segments(), pendingBytes(0), iovs()
+		{ useRing = ring.init(RING_ENTRIES); }
+
+		void append(const void* buffer, int amount, uint64_t offset)
+		{
+			const char* data = static_cast<const char*>(buffer);
+			if( !segments.empty() && (segments.back().offset + segments.back().data.size() == offset) )
+			{ segments.back().data.insert(segments.back().data.end(), data, data + amount); }
+			else
+			{ segments.push_back({ offset, std::vector<char>(data, data + amount) }); }
+			pendingBytes += amount;
+		}
+
+		int flushSynchronously(size_t first, bool sync)
+		{
+			for(size_t i = first; i < segments.size(); ++i)
+			{
+				if(!pwrite_all(fd, segments[i].data.data(), segments[i].data.size(), segments[i].offset)) { return SQLITE_IOERR_WRITE; }
+			}
+			return ( sync && (::fdatasync(fd) != 0) ) ? SQLITE_IOERR_FSYNC : SQLITE_OK;
+		}
+
+		/**
+		 * Writes every buffered segment, with sync they are linked to a trailing fdatasync, the writer must be locked
+		 */
+		int flush(bool sync)
+		{
+			int error_code = SQLITE_OK;
+			if( segments.empty() && !sync ) { return error_code; }
+			size_t first = 0;
+			while( useRing && ( (first < segments.size()) || sync ) )
+			{
+				const size_t count = std::min<size_t>(segments.size() - first, RING_ENTRIES - 1);
+				const bool last_batch = (first + count == segments.size());
+				const bool with_sync = sync && last_batch;
+				iovs.resize(count);
+				for(size_t i = 0; i < count; ++i)
+				{
+					iovs[i].iov_base = segments[first + i].data.data();
+					iovs[i].iov_len = segments[first + i].data.size();
+					ring.writev(fd, &iovs[i], 1, segments[first + i].offset, i, (i + 1 < count) || with_sync);
+				}
+				if(with_sync) { ring.fdatasync(fd, FSYNC_TAG); }
+				const uint32_t queued = static_cast<uint32_t>(count + (with_sync ? 1 : 0));
+				if(ring.submit(queued) != static_cast<int>(queued))
+				{
+					useRing = false;
+					break;
+				}
+				bool failed = false;
+				for(uint32_t i = 0; i < queued; ++i)
+				{
+					uint64_t user_data = 0;
+					int32_t result = 0;
+					if(!ring.complete(user_data, result, true)) { useRing = false; failed = true; break; }
+					if(user_data == FSYNC_TAG) { failed |= (result != 0); }
+					else { failed |= (result != static_cast<int32_t>(iovs[user_data].iov_len)); }
+				}
+				//writes go to fixed offsets, a broken or short chain is simply repeated with plain system calls
+				if(failed)
+				{
+					error_code = flushSynchronously(first, with_sync);
+					if(error_code != SQLITE_OK) { return error_code; }
+				}
+				first += count;
+				if(with_sync) { sync = false; }
+			}
+			if( !useRing && ( (first < segments.size()) || sync ) )
+			{ error_code = flushSynchronously(first, sync); }
+			if(error_code == SQLITE_OK)
+			{
+				segments.clear();
+				pendingBytes = 0;
+			}
+			return error_code;
+		}
+	};
+
+	struct FileState
+	{
+		ReadAhead*	readAhead = nullptr;
+		WalWriter*	wal = nullptr;
+	};
+
+
+	inline uint32_t read_be32(const void* data)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+	}
+
+	class UringShim : public SQLiteVfsShim
+	{
+	public:
+		SQLiteUringVfsConfig mConfig;
+	protected:
+		static inline FileState* state(File* file) { return static_cast<FileState*>(file->state); }
+
+		int onOpen(File* file, const char* name, int flags) override
+		{
+			int fd = unixDescriptor(file, name);
+			if(fd < 0) { return SQLITE_OK; }
+			if( (flags & SQLITE_OPEN_MAIN_DB) && (mConfig.readAheadPages > 1) )
+			{ file->state = new FileState{ new ReadAhead(mConfig, fd), nullptr }; }
+			else if( (flags & SQLITE_OPEN_WAL) && mConfig.coalesceWal )
+			{ file->state = new FileState{ nullptr, new WalWriter(mConfig, fd) }; }
+			return SQLITE_OK;
+		}
+
+		int close(File* file) override
+		{
+			FileState* file_state = state(file);
+			int error_code = SQLITE_OK;
+			if(file_state != nullptr)
+			{
+				delete file_state->readAhead;
+				if(file_state->wal != nullptr)
+				{
+					error_code = file_state->wal->flush(false);
+					delete file_state->wal;
+				}
+				delete file_state;
+				file->state = nullptr;
+			}
+			int close_code = SQLiteVfsShim::close(file);
+			return (error_code != SQLITE_OK) ? error_code : close_code;
+		}
+
+		int read(File* file, void* buffer, int amount, sqlite3_int64 offset) override
+		{
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->readAhead != nullptr) )
+			{
+				ReadAhead& read_ahead = *file_state->readAhead;
+				if(read_ahead.serve(buffer, amount, offset))
+				{
+					read_ahead.detector.observe(offset, amount);
+					return SQLITE_OK;
+				}
+				int error_code = SQLiteVfsShim::read(file, buffer, amount, offset);
+				read_ahead.detector.observe(offset, amount);
+				if(error_code == SQLITE_OK) { read_ahead.start(); }
+				return error_code;
+			}
+			if( (file_state != nullptr) && (file_state->wal != nullptr) )
+			{
+				std::lock_guard<std::mutex> lock(file_state->wal->mutex);
+				int error_code = file_state->wal->flush(false);
+				if(error_code != SQLITE_OK) { return error_code; }
+			}
+			return SQLiteVfsShim::read(file, buffer, amount, offset);
+		}
+
+		int write(File* file, const void* buffer, int amount, sqlite3_int64 offset) override
+		{
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->readAhead != nullptr) )
+			{ file_state->readAhead->invalidate(); }
+			if( (file_state == nullptr) || (file_state->wal == nullptr) )
+			{ return SQLiteVfsShim::write(file, buffer, amount, offset); }
+
+			WalWriter& wal = *file_state->wal;
+			std::lock_guard<std::mutex> lock(wal.mutex);
+			wal.append(buffer, amount, offset);
+			//the frames of a commit are on disk before its xWrite returns, a failure reaches SQLite before it
+			//publishes the wal-index header; there is no later call that could report it
+			if(wal.expectCommitData)
+			{
+				wal.expectCommitData = false;
+				return wal.flush(false);
+			}
+			//a 24 byte frame header with a non-zero database size marks the commit frame
+			if( (amount == 24) && (offset >= 32) && (read_be32(static_cast<const char*>(buffer) + 4) != 0) )
+			{ wal.expectCommitData = true; }
+			if(wal.pendingBytes >= mConfig.maxPendingWalBytes) { return wal.flush(false); }
+			return SQLITE_OK;
+		}
+
+		int truncate(File* file, sqlite3_int64 size) override
+		{
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->readAhead != nullptr) )
+			{ file_state->readAhead->invalidate(); }
+			if( (file_state != nullptr) && (file_state->wal != nullptr) )
+			{
+				std::lock_guard<std::mutex> lock(file_state->wal->mutex);
+				int error_code = file_state->wal->flush(false);
+				if(error_code != SQLITE_OK) { return error_code; }
+			}
+			return SQLiteVfsShim::truncate(file, size);
+		}
+
+		int sync(File* file, int flags) override
+		{
+			FileState* file_state = state(file);
+			if( (file_state == nullptr) || (file_state->wal == nullptr) )
+			{ return SQLiteVfsShim::sync(file, flags); }
+			WalWriter& wal = *file_state->wal;
+			std::lock_guard<std::mutex> lock(wal.mutex);
+			if(wal.parentSynced) { return wal.flush(true); }
+			int error_code = wal.flush(false);
+			if(error_code == SQLITE_OK) { error_code = SQLiteVfsShim::sync(file, flags); }
+			wal.parentSynced = (error_code == SQLITE_OK);
+			return error_code;
+		}
+
+		int fileSize(File* file, sqlite3_int64* size) override
+		{
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->wal != nullptr) )
+			{
+				std::lock_guard<std::mutex> lock(file_state->wal->mutex);
+				int error_code = file_state->wal->flush(false);
+				if(error_code != SQLITE_OK) { return error_code; }
+			}
+			return SQLiteVfsShim::fileSize(file, size);
+		}
+
+		int lock(File* file, int level) override
+		{
+			//a new read transaction (rollback journal mode) must not see pages read before it
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->readAhead != nullptr) && (level == SQLITE_LOCK_SHARED) )
+			{ file_state->readAhead->invalidate(); }
+			return SQLiteVfsShim::lock(file, level);
+		}
+
+		int shmLock(File* file, int offset, int count, int flags) override
+		{
+			//WAL read transactions start by taking a read-mark lock on the wal-index
+			FileState* file_state = state(file);
+			if( (file_state != nullptr) && (file_state->readAhead != nullptr) && (flags & SQLITE_SHM_LOCK) && (flags & SQLITE_SHM_SHARED) )
+			{ file_state->readAhead->invalidate(); }
+			return SQLiteVfsShim::shmLock(file, offset, count, flags);
+		}
+	};
+
+	UringShim& shim()
+	{
+		static UringShim instance;
+		return instance;
+	}
+}
+
+SQLiteCode::Enum SQLiteUringVfs::install(const SQLiteUringVfsConfig& config, bool make_default)
+{
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+	if(shim().registered()) { return SQLiteCode::OK; }
+	shim().mConfig = config;
+	return shim().registerVfs(NAME, "unix", make_default);
+}
+
+bool SQLiteUringVfs::uringAvailable()
+{
+	SQLiteUring ring;
+	return ring.init(2);
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_URING_VFS_H_
+#define COMPONENTS_DATABASE_SQLITE_URING_VFS_H_
+
+#include <cstdint>
+#include <cstddef>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	struct SQLiteUringVfsConfig
+	{
+		uint32_t	readAheadPages = 64;			//pages per read-ahead window
+		uint32_t	sequentialTrigger = 4;			//sequential page reads before read-ahead starts
+		bool		coalesceWal = true;				//batch WAL frame writes until commit/sync
+		size_t		maxPendingWalBytes = 4 << 20;	//buffered WAL bytes that force a flush inside a transaction
+	};
+
+	/**
+	 * VFS shim over the unix VFS issuing database reads and WAL writes through io_uring
+	 *
+	 * Main database files: once sequential page reads are detected, the next window of pages is read with a batch of
+	 * reads submitted at once into a private buffer, and the following window is submitted asynchronously while the
+	 * current one is consumed. Buffers are dropped on every lock change and write, so a read transaction never sees
+	 * pages read before it started.
+	 *
+	 * WAL files: frame writes are buffered and coalesced, the frames of a commit are submitted as one batch when its
+	 * commit frame is written, so a failure is returned by that xWrite before SQLite publishes the wal-index header.
+	 * Frames buffered on xSync are submitted as linked writes followed by a linked fdatasync in a single system call.
+	 *
+	 * Without io_uring (old kernel, seccomp, non-linux) the same batching falls back to pread/pwrite/fdatasync.
+	 */
+	class SQLiteUringVfs
+	{
+	public:
+		static constexpr const char* NAME = "io_uring";
+		/**
+		 * Registers the shim over the default unix VFS
+		 * @return An SQLiteCode is returned, registering again is a no-op
+		 */
+		static SQLiteCode::Enum install(const SQLiteUringVfsConfig& config = SQLiteUringVfsConfig(), bool make_default = false);
+		/**
+		 * Returns true if io_uring rings can be created in this process
+		 */
+		static bool uringAvailable();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_URING_VFS_H_ */
@@ -0,0 +1,240 @@
+#include "sqlite_vfs.h"
+#include <sys/stat.h>
+#include <cstring>
+
+namespace database
+{
+
+namespace
+{
+	using File = SQLiteVfsShim::File;
+
+	inline sqlite3_file* real(sqlite3_file* file) { return reinterpret_cast<File*>(file)->real; }
+
+	inline sqlite3_vfs* parent_of(sqlite3_vfs* vfs) { return static_cast<SQLiteVfsShim*>(vfs->pAppData)->parent(); }
+
+	//io methods without a hook in the shim
+	int file_check_reserved_lock(sqlite3_file* file, int* out) { return real(file)->pMethods->xCheckReservedLock(real(file), out); }
+	int file_control(sqlite3_file* file, int op, void* arg) { return real(file)->pMethods->xFileControl(real(file), op, arg); }
+	int file_sector_size(sqlite3_file* file) { return real(file)->pMethods->xSectorSize(real(file)); }
+	int file_device_characteristics(sqlite3_file* file) { return real(file)->pMethods->xDeviceCharacteristics(real(file)); }
+	int file_shm_map(sqlite3_file* file, int page, int size, int extend, void volatile** out)
+	{ return real(file)->pMethods->xShmMap(real(file), page, size, extend, out); }
+	int file_shm_unmap(sqlite3_file* file, int remove) { return real(file)->pMethods->xShmUnmap(real(file), remove); }
+	int file_fetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** out) { return real(file)->pMethods->xFetch(real(file), offset, amount, out); }
+	int file_unfetch(sqlite3_file* file, sqlite3_int64 offset, void* ptr) { return real(file)->pMethods->xUnfetch(real(file), offset, ptr); }
+
+	//vfs methods forwarded to the parent
+	int vfs_delete(sqlite3_vfs* vfs, const char* name, int sync_dir) { return parent_of(vfs)->xDelete(parent_of(vfs), name, sync_dir); }
+	int vfs_access(sqlite3_vfs* vfs, const char* name, int flags, int* out) { return parent_of(vfs)->xAccess(parent_of(vfs), name, flags, out); }
+	int vfs_full_pathname(sqlite3_vfs* vfs, const char* name, int size, char* out) { return parent_of(vfs)->xFullPathname(parent_of(vfs), name, size, out); }
+	void* vfs_dl_open(sqlite3_vfs* vfs, const char* name) { return parent_of(vfs)->xDlOpen(parent_of(vfs), name); }
+	void vfs_dl_error(sqlite3_vfs* vfs, int size, char* out) { parent_of(vfs)->xDlError(parent_of(vfs), size, out); }
+	void (*vfs_dl_sym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void) { return parent_of(vfs)->xDlSym(parent_of(vfs), handle, symbol); }
+	void vfs_dl_close(sqlite3_vfs* vfs, void* handle) { parent_of(vfs)->xDlClose(parent_of(vfs), handle); }
+	int vfs_randomness(sqlite3_vfs* vfs, int size, char* out) { return parent_of(vfs)->xRandomness(parent_of(vfs), size, out); }
+	int vfs_sleep(sqlite3_vfs* vfs, int microseconds) { return parent_of(vfs)->xSleep(parent_of(vfs), microseconds); }
+	int vfs_current_time(sqlite3_vfs* vfs, double* out) { return parent_of(vfs)->xCurrentTime(parent_of(vfs), out); }
+	int vfs_get_last_error(sqlite3_vfs* vfs, int size, char* out) { return parent_of(vfs)->xGetLastError(parent_of(vfs), size, out); }
+	int vfs_current_time_int64(sqlite3_vfs* vfs, sqlite3_int64* out) { return parent_of(vfs)->xCurrentTimeInt64(parent_of(vfs), out); }
+	int vfs_set_system_call(sqlite3_vfs* vfs, const char* name, sqlite3_syscall_ptr call) { return parent_of(vfs)->xSetSystemCall(parent_of(vfs), name, call); }
+	sqlite3_syscall_ptr vfs_get_system_call(sqlite3_vfs* vfs, const char* name) { return parent_of(vfs)->xGetSystemCall(parent_of(vfs), name); }
+	const char* vfs_next_system_call(sqlite3_vfs* vfs, const char* name) { return parent_of(vfs)->xNextSystemCall(parent_of(vfs), name); }
+}
+
+SQLiteVfsShim::SQLiteVfsShim()
+	: mName()
+	, mVfs()
+	, mParent(nullptr)
+	, mRegistered(false)
+{}
+
+SQLiteVfsShim::~SQLiteVfsShim()
+{
+	if(mRegistered) { sqlite3_vfs_unregister(&mVfs); }
+}
+
+SQLiteCode::Enum SQLiteVfsShim::registerVfs(const std::string& name, const std::string& parent, bool make_default)
+{
+	if(mRegistered) { return SQLiteCode::MISUSE; }
+	mParent = sqlite3_vfs_find(parent.empty() ? nullptr : parent.c_str());
+	if(mParent == nullptr) { return SQLiteCode::NOTFOUND; }
+	mName = name;
+	memset(&mVfs, 0, sizeof(mVfs));
+	mVfs.iVersion = mParent->iVersion;
+	mVfs.szOsFile = static_cast<int>(sizeof(File)) + mParent->szOsFile;
+	mVfs.mxPathname = mParent->mxPathname;
+	mVfs.zName = mName.c_str();
+	mVfs.pAppData = this;
+	mVfs.xOpen = &SQLiteVfsShim::xOpen;
+	mVfs.xDelete = &vfs_delete;
+	mVfs.xAccess = &vfs_access;
+	mVfs.xFullPathname = &vfs_full_pathname;
+	mVfs.xDlOpen = &vfs_dl_open;
+	mVfs.xDlError = &vfs_dl_error;
+	mVfs.xDlSym = &vfs_dl_sym;
+	mVfs.xDlClose = &vfs_dl_close;
+	mVfs.xRandomness = &vfs_randomness;
+	mVfs.xSleep = &vfs_sleep;
+	mVfs.xCurrentTime = &vfs_current_time;
+	mVfs.xGetLastError = &vfs_get_last_error;
+	if(mVfs.iVersion >= 2) { mVfs.xCurrentTimeInt64 = &vfs_current_time_int64; }
+	if(mVfs.iVersion >= 3)
+	{
+		mVfs.xSetSystemCall = &vfs_set_system_call;
+		mVfs.xGetSystemCall = &vfs_get_system_call;
+		mVfs.xNextSystemCall = &vfs_next_system_call;
+	}
+	auto error_code = static_cast<SQLiteCode::Enum>(sqlite3_vfs_register(&mVfs, make_default ? 1 : 0));
+	mRegistered = (error_code == SQLiteCode::OK);
+	return error_code;
+}
+
+int SQLiteVfsShim::onOpen(File*, const char*, int)
+{ return SQLITE_OK; }
+
+int SQLiteVfsShim::close(File* file)
+{ return file->real->pMethods->xClose(file->real); }
+
+int SQLiteVfsShim::read(File* file, void* buffer, int amount, sqlite3_int64 offset)
+{ return file->real->pMethods->xRead(file->real, buffer, amount, offset); }
+
+int SQLiteVfsShim::write(File* file, const void* buffer, int amount, sqlite3_int64 offset)
+{ return file->real->pMethods->xWrite(file->real, buffer, amount, offset); }
+
+int SQLiteVfsShim::truncate(File* file, sqlite3_int64 size)
+{ return file->real->pMethods->xTruncate(file->real, size); }
+
+int SQLiteVfsShim::sync(File* file, int flags)
+{ return file->real->pMethods->xSync(file->real, flags); }
+
+int SQLiteVfsShim::fileSize(File* file, sqlite3_int64* size)
+{ return file->real->pMethods->xFileSize(file->real, size); }
+
+int SQLiteVfsShim::lock(File* file, int lock)
+{ return file->real->pMethods->xLock(file->real, lock); }
+
+int SQLiteVfsShim::unlock(File* file, int lock)
+{ return file->real->pMethods->xUnlock(file->real, lock); }
+
+int SQLiteVfsShim::shmLock(File* file, int offset, int count, int flags)
+{ return file->real->pMethods->xShmLock(file->real, offset, count, flags); }
+
+void SQLiteVfsShim::shmBarrier(File* file)
+{ file->real->pMethods->xShmBarrier(file->real); }
+
+int SQLiteVfsShim::unixDescriptor(File* file, const char* name) const
+{
+	//unixFile is private to SQLite, its descriptor follows three pointers (pMethod, pVfs, pInode) since 3.7
+	if( (name == nullptr) || (mParent == nullptr) || (strncmp(mParent->zName, "unix", 4) != 0) ) { return -1; }
+	int fd = *reinterpret_cast<const int*>(reinterpret_cast<const char*>(file->real) + 3 * sizeof(void*));
+	struct stat by_fd, by_name;
+	if( (fd < 0) || (fstat(fd, &by_fd) != 0) || (stat(name, &by_name) != 0) ) { return -1; }
+	return ( (by_fd.st_dev == by_name.st_dev) && (by_fd.st_ino == by_name.st_ino) ) ? fd : -1;
+}
+
+const sqlite3_io_methods* SQLiteVfsShim::ioMethods(int version)
+{
+	//the shim advertises the same io methods version as the parent's file, so SQLite never calls a missing method
+	static const sqlite3_io_methods methods[3] =
+	{
+		{ 1, &xClose, &xRead, &xWrite, &xTruncate, &xSync, &xFileSize, &xLock, &xUnlock, &file_check_reserved_lock
+		, &file_control, &file_sector_size, &file_device_characteristics, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+		{ 2, &xClose, &xRead, &xWrite, &xTruncate, &xSync, &xFileSize, &xLock, &xUnlock, &file_check_reserved_lock
+		, &file_control, &file_sector_size, &file_device_characteristics, &file_shm_map, &xShmLock, &xShmBarrier, &file_shm_unmap, nullptr, nullptr },
+		{ 3, &xClose, &xRead, &xWrite, &xTruncate, &xSync, &xFileSize, &xLock, &xUnlock, &file_check_reserved_lock
+		, &file_control, &file_sector_size, &file_device_characteristics, &file_shm_map, &xShmLock, &xShmBarrier, &file_shm_unmap, &file_fetch, &file_unfetch }
+	};
+	if(version < 1) { version = 1; }
+	if(version > 3) { version = 3; }
+	return &methods[version - 1];
+}
+
+int SQLiteVfsShim::xOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* base, int flags, int* out_flags)
+{
+	File* file = reinterpret_cast<File*>(base);
+	SQLiteVfsShim* shim = static_cast<SQLiteVfsShim*>(vfs->pAppData);
+	file->base.pMethods = nullptr;
+	file->real = reinterpret_cast<sqlite3_file*>(file + 1);
+	file->shim = shim;
+	file->state = nullptr;
+	file->real->pMethods = nullptr;
+	int error_code = shim->mParent->xOpen(shim->mParent, name, file->real, flags, out_flags);
+	if(error_code != SQLITE_OK)
+	{
+		//a parent may expect xClose even after a failed open, SQLite will not call it through the shim
+		if(file->real->pMethods != nullptr) { file->real->pMethods->xClose(file->real); }
+		return error_code;
+	}
+	if(file->real->pMethods == nullptr) { return SQLITE_CANTOPEN; }
+	error_code = shim->onOpen(file, name, flags);
+	if(error_code != SQLITE_OK)
+	{
+		file->real->pMethods->xClose(file->real);
+		return error_code;
+	}
+	file->base.pMethods = ioMethods(file->real->pMethods->iVersion);
+	return SQLITE_OK;
+}
+
+int SQLiteVfsShim::xClose(sqlite3_file* base)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->close(file);
+}
+
+int SQLiteVfsShim::xRead(sqlite3_file* base, void* buffer, int amount, sqlite3_int64 offset)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->read(file, buffer, amount, offset);
+}
+
+int SQLiteVfsShim::xWrite(sqlite3_file* base, const void* buffer, int amount, sqlite3_int64 offset)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->write(file, buffer, amount, offset);
+}
+
+int SQLiteVfsShim::xTruncate(sqlite3_file* base, sqlite3_int64 size)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->truncate(file, size);
+}
+
+int SQLiteVfsShim::xSync(sqlite3_file* base, int flags)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->sync(file, flags);
+}
+
+int SQLiteVfsShim::xFileSize(sqlite3_file* base, sqlite3_int64* size)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->fileSize(file, size);
+}
+
+int SQLiteVfsShim::xLock(sqlite3_file* base, int lock)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->lock(file, lock);
+}
+
+int SQLiteVfsShim::xUnlock(sqlite3_file* base, int lock)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->unlock(file, lock);
+}
+
+int SQLiteVfsShim::xShmLock(sqlite3_file* base, int offset, int count, int flags)
+{
+	File* file = reinterpret_cast<File*>(base);
+	return file->shim->shmLock(file, offset, count, flags);
+}
+
+void SQLiteVfsShim::xShmBarrier(sqlite3_file* base)
+{
+	File* file = reinterpret_cast<File*>(base);
+	file->shim->shmBarrier(file);
+}
+
+}
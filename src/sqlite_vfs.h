@@ -0,0 +1,126 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_VFS_H_
+#define COMPONENTS_DATABASE_SQLITE_VFS_H_
+
+#include <cstdint>
+#include <string>
+#include <sqlite3.h>
+#include "sqlite_error_code.h"
+
+namespace database
+{
+	/**
+	 * Tracks runs of sequential, equally sized reads of a file (page reads of a scan)
+	 * A single read elsewhere (an interior b-tree page) does not end a run, it resumes if the next read continues it
+	 */
+	class SQLiteSequentialDetector
+	{
+	public:
+		SQLiteSequentialDetector() : mNext(~0ull), mAmount(0), mRun(0), mSuspendedNext(~0ull), mSuspendedRun(0) {}
+		/**
+		 * Records a read
+		 * @return The number of reads of the current run that followed its first one, 0 if this read is not part of a run
+		 */
+		inline uint32_t observe(uint64_t offset, int amount)
+		{
+			if( (offset == mNext) && (amount == mAmount) ) { ++mRun; }
+			else if( (offset == mSuspendedNext) && (amount == mAmount) ) { mRun = mSuspendedRun + 1; }
+			else
+			{
+				mSuspendedNext = mNext;
+				mSuspendedRun = mRun;
+				mRun = 0;
+			}
+			if(mRun > 0) { mSuspendedNext = ~0ull; }
+			mNext = offset + amount;
+			mAmount = amount;
+			return mRun;
+		}
+		inline void reset() { mNext = mSuspendedNext = ~0ull; mAmount = 0; mRun = mSuspendedRun = 0; }
+		inline uint32_t run() const { return mRun; }
+		inline uint64_t next() const { return mNext; }
+		inline int amount() const { return mAmount; }
+		//reads of a power of two of at least 512 bytes, as database pages are
+		inline bool pageSized() const { return (mAmount >= 512) && ((mAmount & (mAmount - 1)) == 0); }
+	private:
+		uint64_t	mNext;//offset right after the last read
+		int			mAmount;
+		uint32_t	mRun;
+		uint64_t	mSuspendedNext;//run interrupted by the last read
+		uint32_t	mSuspendedRun;
+	};
+
+	/**
+	 * Base of VFS shims layered over an existing VFS (the default unix VFS unless specified otherwise)
+	 * Every call is forwarded to the parent, subclasses override the file operations they are interested in
+	 * A shim must outlive every connection opened through it
+	 */
+	class SQLiteVfsShim
+	{
+	public:
+		struct File
+		{
+			sqlite3_file	base;//must be the first member
+			sqlite3_file*	real;//parent's file object, placed right after this struct
+			SQLiteVfsShim*	shim;
+			void*			state;//owned by the subclass
+		};
+		SQLiteVfsShim(const SQLiteVfsShim& other) = delete;
+		SQLiteVfsShim& operator=(const SQLiteVfsShim& other) = delete;
+		virtual ~SQLiteVfsShim();
+		/**
+		 * Registers the shim under the given name
+		 * @param parent Name of the wrapped VFS, the current default VFS is used when empty
+		 * @param make_default Makes the shim the default VFS for connections opened without naming one
+		 * @return An SQLiteCode is returned
+		 */
+		SQLiteCode::Enum registerVfs(const std::string& name, const std::string& parent = std::string(), bool make_default = false);
+		inline bool registered() const { return mRegistered; }
+		inline const std::string& name() const { return mName; }
+		inline sqlite3_vfs* parent() const { return mParent; }
+	protected:
+		SQLiteVfsShim();
+		/**
+		 * Called after the parent opened the file, a non-OK result closes it again and fails the open
+		 * @param name Full path of the file or nullptr for temporary files
+		 */
+		virtual int onOpen(File* file, const char* name, int flags);
+		/**
+		 * Closes the parent's file, overrides have to release their state and call the base implementation
+		 */
+		virtual int close(File* file);
+		virtual int read(File* file, void* buffer, int amount, sqlite3_int64 offset);
+		virtual int write(File* file, const void* buffer, int amount, sqlite3_int64 offset);
+		virtual int truncate(File* file, sqlite3_int64 size);
+		virtual int sync(File* file, int flags);
+		virtual int fileSize(File* file, sqlite3_int64* size);
+		virtual int lock(File* file, int lock);
+		virtual int unlock(File* file, int lock);
+		virtual int shmLock(File* file, int offset, int count, int flags);
+		virtual void shmBarrier(File* file);
+		/**
+		 * Returns the descriptor of a file opened by the unix VFS or -1 if the parent is not a unix VFS
+		 * @param name Path given to onOpen, the descriptor is only returned if it refers to the same inode
+		 */
+		int unixDescriptor(File* file, const char* name) const;
+	private:
+		std::string		mName;
+		sqlite3_vfs		mVfs;
+		sqlite3_vfs*	mParent;
+		bool			mRegistered;
+
+		static int xOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags);
+		static int xClose(sqlite3_file* file);
+		static int xRead(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset);
+		static int xWrite(sqlite3_file* file, const void* buffer, int amount, sqlite3_int64 offset);
+		static int xTruncate(sqlite3_file* file, sqlite3_int64 size);
+		static int xSync(sqlite3_file* file, int flags);
+		static int xFileSize(sqlite3_file* file, sqlite3_int64* size);
+		static int xLock(sqlite3_file* file, int lock);
+		static int xUnlock(sqlite3_file* file, int lock);
+		static int xShmLock(sqlite3_file* file, int offset, int count, int flags);
+		static void xShmBarrier(sqlite3_file* file);
+		static const sqlite3_io_methods* ioMethods(int version);
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_VFS_H_ */
@@ -0,0 +1,198 @@
+#include "sqlite_write_behind.h"
+#include <sqlite3.h>
+#include <functional>
+#include <vector>
+
+namespace database
+{
+
+SQLiteWriteBehind::SQLiteWriteBehind(const std::string& path, const std::string& table, const std::string& key_column,
+	const std::string& value_column, const SQLiteWriteBehindConfig& config)
+	: mConfig(config)
+	, mConnection(path)
+	, mErrorCode(SQLiteCode::OK)
+	, mAdd()
+	, mSet()
+	, mStripes(new Stripe[(config.stripes > 0) ? config.stripes : 1])
+	, mPendingKeys(0)
+	, mChanges(0)
+	, mFlushMutex()
+	, mMutex()
+	, mWakeUp()
+	, mRunning(true)
+	, mStats()
+	, mThread()
+{
+	if(!mConnection.isOpen())
+	{
+		mErrorCode = SQLiteCode::CANTOPEN;
+		return;
+	}
+	sqlite3_busy_timeout(mConnection.native(), static_cast<int>(mConfig.busyTimeout.count()));
+	const std::string key = SQLite::quoteIdentifier(key_column);
+	const std::string value = SQLite::quoteIdentifier(value_column);
+	const std::string insert = "INSERT INTO " + SQLite::quoteIdentifier(table) + " (" + key + ", " + value + ") VALUES (?1, ?2) ON CONFLICT (" + key + ") DO UPDATE SET " + value + " = ";
+	mAdd = mConnection.prepare(insert + value + " + excluded." + value);
+	mSet = mConnection.prepare(insert + "excluded." + value);
+	mErrorCode = !mAdd->valid() ? mAdd->errorCode() : mSet->errorCode();
+	if(!valid()) { return; }
+	mThread = std::thread(&SQLiteWriteBehind::run, this);
+}
+
+SQLiteWriteBehind::~SQLiteWriteBehind()
+{
+	const SQLiteCode::Enum error_code = close();
+	if(error_code != SQLiteCode::OK)
+	{ sqlite3_log(error_code, "write-behind: %zu buffered keys lost on shutdown", mPendingKeys.load(std::memory_order_relaxed)); }
+}
+
+SQLiteCode::Enum SQLiteWriteBehind::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+	mWakeUp.notify_one();
+	if(mThread.joinable()) { mThread.join(); }
+	return flush();
+}
+
+SQLiteWriteBehind::Stripe& SQLiteWriteBehind::stripeOf(const std::string& key)
+{ return mStripes[std::hash<std::string>()(key) % ( (mConfig.stripes > 0) ? mConfig.stripes : 1 )]; }
+
+void SQLiteWriteBehind::merge(Changes& into, const std::string& key, const Change& change, bool newer)
+{
+	auto result = into.try_emplace(key, change);
+	if(result.second)
+	{
+		mPendingKeys.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	Change& current = result.first->second;
+	if(newer)
+	{
+		if(change.assigned) { current = change; }
+		else { current.delta += change.delta; }
+	}
+	else if(!current.assigned)
+	{
+		//the buffered deltas apply on top of the older change
+		current.assigned = change.assigned;
+		current.value = change.value;
+		current.delta += change.delta;
+	}
+}
+
+void SQLiteWriteBehind::add(const std::string& key, int64_t delta)
+{
+	if(!valid()) { return; }
+	Stripe& stripe = stripeOf(key);
+	{
+		std::lock_guard<std::mutex> lock(stripe.mutex);
+		merge(stripe.changes, key, Change{ false, 0, delta }, true);
+	}
+	mChanges.fetch_add(1, std::memory_order_relaxed);
+	if(mPendingKeys.load(std::memory_order_relaxed) >= mConfig.maxPendingKeys) { mWakeUp.notify_one(); }
+}
+
+void SQLiteWriteBehind::set(const std::string& key, int64_t value)
+{
+	if(!valid()) { return; }
+	Stripe& stripe = stripeOf(key);
+	{
+		std::lock_guard<std::mutex> lock(stripe.mutex);
+		merge(stripe.changes, key, Change{ true, value, 0 }, true);
+	}
+	mChanges.fetch_add(1, std::memory_order_relaxed);
+	if(mPendingKeys.load(std::memory_order_relaxed) >= mConfig.maxPendingKeys) { mWakeUp.notify_one(); }
+}
+
+SQLiteCode::Enum SQLiteWriteBehind::flush()
+{
+	if(!valid()) { return mErrorCode; }
+	std::lock_guard<std::mutex> flush_lock(mFlushMutex);
+	const size_t stripes = (mConfig.stripes > 0) ? mConfig.stripes : 1;
+	//writers only wait for the swap of their stripe, not for the transaction
+	std::vector<Changes> batch(stripes);
+	size_t keys = 0;
+	for(size_t i = 0; i < stripes; ++i)
+	{
+		std::lock_guard<std::mutex> lock(mStripes[i].mutex);
+		batch[i].swap(mStripes[i].changes);
+		mPendingKeys.fetch_sub(batch[i].size(), std::memory_order_relaxed);
+		keys += batch[i].size();
+	}
+	if(keys == 0) { return SQLiteCode::OK; }
+
+	auto start = std::chrono::steady_clock::now();
+	int error_code = sqlite3_exec(mConnection.native(), "BEGIN IMMEDIATE", nullptr, nullptr, nullptr);
+	for(size_t i = 0; (i < stripes) && (error_code == SQLITE_OK); ++i)
+	{
+		for(const auto& entry : batch[i])
+		{
+			const Change& change = entry.second;
+			SQLiteStatement& stmt = change.assigned ? *mSet : *mAdd;
+			error_code = stmt.bind(entry.first, 1).bind(change.assigned ? change.value + change.delta : change.delta, 2).execute();
+			if(error_code != SQLITE_DONE) { break; }
+			error_code = SQLITE_OK;
+		}
+	}
+	if(error_code == SQLITE_OK) { error_code = sqlite3_exec(mConnection.native(), "COMMIT", nullptr, nullptr, nullptr); }
+	if(error_code != SQLITE_OK)
+	{
+		if(sqlite3_get_autocommit(mConnection.native()) == 0) { sqlite3_exec(mConnection.native(), "ROLLBACK", nullptr, nullptr, nullptr); }
+		//changes buffered meanwhile are newer than the ones of the failed transaction
+		for(size_t i = 0; i < stripes; ++i)
+		{
+			std::lock_guard<std::mutex> lock(mStripes[i].mutex);
+			for(const auto& entry : batch[i]) { merge(mStripes[i].changes, entry.first, entry.second, false); }
+		}
+	}
+	auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if(error_code == SQLITE_OK)
+	{
+		++mStats.flushes;
+		mStats.flushedKeys += keys;
+		mStats.consecutiveFailures = 0;
+		mStats.lastError = SQLiteCode::OK;
+	}
+	else
+	{
+		++mStats.failedFlushes;
+		++mStats.consecutiveFailures;
+		mStats.lastError = static_cast<SQLiteCode::Enum>(error_code);
+	}
+	mStats.lastLatency = latency;
+	if(latency > mStats.maxLatency) { mStats.maxLatency = latency; }
+	return static_cast<SQLiteCode::Enum>(error_code);
+}
+
+SQLiteWriteBehindStats SQLiteWriteBehind::stats() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	SQLiteWriteBehindStats result = mStats;
+	result.changes = mChanges.load(std::memory_order_relaxed);
+	result.pendingKeys = mPendingKeys.load(std::memory_order_relaxed);
+	return result;
+}
+
+void SQLiteWriteBehind::run()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	bool failed = false;
+	while(mRunning)
+	{
+		//a failed flush leaves the buffer full, the interval is waited out instead of retrying at once
+		auto deadline = std::chrono::steady_clock::now() + mConfig.flushInterval;
+		mWakeUp.wait_until(lock, deadline, [this, failed]()
+		{ return !mRunning || ( !failed && (mPendingKeys.load(std::memory_order_relaxed) >= mConfig.maxPendingKeys) ); });
+		if(!mRunning) { break; }
+		lock.unlock();
+		failed = (flush() != SQLiteCode::OK);
+		lock.lock();
+	}
+}
+
+}
@@ -0,0 +1,122 @@
+#ifndef COMPONENTS_DATABASE_SQLITE_WRITE_BEHIND_H_
+#define COMPONENTS_DATABASE_SQLITE_WRITE_BEHIND_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "sqlite.h"
+
+namespace database
+{
+	struct SQLiteWriteBehindConfig
+	{
+		std::chrono::milliseconds	flushInterval{100};		//longest time a change stays buffered
+		size_t						stripes = 16;			//independently locked parts of the buffer
+		size_t						maxPendingKeys = 65536;	//buffered keys that trigger a flush before the interval
+		std::chrono::milliseconds	busyTimeout{1000};		//how long a flush waits for other writers
+	};
+
+	struct SQLiteWriteBehindStats
+	{
+		uint64_t					changes;		//add() and set() calls
+		uint64_t					flushes;		//committed transactions
+		uint64_t					flushedKeys;	//rows written by them
+		uint64_t					failedFlushes;	//rolled back, their changes stay buffered
+		uint64_t					consecutiveFailures;//failed flushes since the last one that succeeded
+		SQLiteCode::Enum			lastError;		//error of the last failed flush, OK once a flush succeeds
+		size_t						pendingKeys;
+		std::chrono::nanoseconds	lastLatency;
+		std::chrono::nanoseconds	maxLatency;
+	};
+
+	/**
+	 * Write-behind buffer for counters and last-value rows of one table keyed by a unique column
+	 * Changes are coalesced per key in a striped hash map, a background thread with a connection of its own writes
+	 * every buffered key as one UPSERT transaction per flush interval (cached INSERT ... ON CONFLICT statements).
+	 * Buffered changes are not visible to readers of the table until they are flushed, a failed flush keeps them
+	 * buffered and merges them with the changes made meanwhile; the thread then waits a whole flush interval before it
+	 * retries, even with a full buffer. Errors that persist (a dropped table, a constraint) show in stats().lastError
+	 * while the buffer keeps growing. close() or the destructor flushes what is left.
+	 */
+	class SQLiteWriteBehind
+	{
+	public:
+		/**
+		 * @param key_column Column with a PRIMARY KEY or UNIQUE constraint, required by the UPSERT
+		 */
+		SQLiteWriteBehind(const std::string& path, const std::string& table, const std::string& key_column,
+			const std::string& value_column, const SQLiteWriteBehindConfig& config = SQLiteWriteBehindConfig());
+		SQLiteWriteBehind(const SQLiteWriteBehind& other) = delete;
+		SQLiteWriteBehind& operator=(const SQLiteWriteBehind& other) = delete;
+		/**
+		 * Calls close(), a failure is reported through sqlite3_log as the buffered changes are lost
+		 */
+		~SQLiteWriteBehind();
+		/**
+		 * Returns the actual error code, nothing is buffered when the connection or the statements failed
+		 */
+		inline SQLiteCode::Enum errorCode() const { return mErrorCode; }
+		inline bool valid() const { return errorCode() == SQLiteCode::OK; }
+		explicit operator bool() const noexcept { return valid(); }
+		inline bool isRunning() const { return mThread.joinable(); }
+		/**
+		 * value = value + delta, a missing row is inserted with delta
+		 */
+		void add(const std::string& key, int64_t delta = 1);
+		/**
+		 * value = value, replacing the changes buffered for the key before
+		 */
+		void set(const std::string& key, int64_t value);
+		/**
+		 * Writes the buffered changes now, on the calling thread
+		 * @return An SQLiteCode is returned
+		 */
+		SQLiteCode::Enum flush();
+		/**
+		 * Stops the background thread and flushes the buffered changes, changes made afterwards are only written by
+		 * flush() or close()
+		 * @return The result of the last flush is returned, the changes stay buffered on failure
+		 */
+		SQLiteCode::Enum close();
+		SQLiteWriteBehindStats stats() const;
+	private:
+		struct Change
+		{
+			bool	assigned;//value set by set(), otherwise only a delta to add to the stored value
+			int64_t	value;
+			int64_t	delta;
+		};
+		using Changes = std::unordered_map<std::string, Change>;
+		struct alignas(64) Stripe
+		{
+			std::mutex	mutex;
+			Changes		changes;
+		};
+		const SQLiteWriteBehindConfig		mConfig;
+		SQLite								mConnection;
+		SQLiteCode::Enum					mErrorCode;
+		SQLiteStmt_sptr						mAdd;
+		SQLiteStmt_sptr						mSet;
+		std::unique_ptr<Stripe[]>			mStripes;
+		std::atomic<size_t>					mPendingKeys;
+		std::atomic<uint64_t>				mChanges;
+		std::mutex							mFlushMutex;//flushes of the thread and of flush()
+		mutable std::mutex					mMutex;
+		std::condition_variable				mWakeUp;
+		bool								mRunning;
+		SQLiteWriteBehindStats				mStats;//guarded by mMutex
+		std::thread							mThread;
+
+		Stripe& stripeOf(const std::string& key);
+		void merge(Changes& into, const std::string& key, const Change& change, bool newer);
+		void run();
+	};
+}
+
+#endif /* COMPONENTS_DATABASE_SQLITE_WRITE_BEHIND_H_ */